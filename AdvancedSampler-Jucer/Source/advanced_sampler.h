@@ -26,9 +26,63 @@
 
 #pragma once
 
+#if JUCE_LINUX || JUCE_BSD || JUCE_MAC || JUCE_ANDROID
+ #include <fcntl.h>
+ #include <poll.h>
+ #include <sys/mman.h>
+ #include <sys/resource.h>
+ #include <sys/socket.h>
+ #include <sys/stat.h>
+ #include <sys/un.h>
+ #include <unistd.h>
+#endif
+
+#if JUCE_LINUX || JUCE_BSD || JUCE_MAC
+ #define SAMPLER_USE_SHARED_MEMORY 1
+ #include <csignal>
+#else
+ #define SAMPLER_USE_SHARED_MEMORY 0
+#endif
+
+#if JUCE_LINUX
+ #include <sys/inotify.h>
+ #include <linux/futex.h>
+ #include <sys/syscall.h>
+ #define SAMPLER_USE_FUTEX 1
+#else
+ #define SAMPLER_USE_FUTEX 0
+#endif
+
+#if JUCE_LINUX && __has_include(<linux/io_uring.h>)
+ #include <linux/io_uring.h>
+ #include <sys/syscall.h>
+ #include <sys/uio.h>
+ #if defined(__NR_io_uring_setup) && defined(__NR_io_uring_enter) && defined(IORING_FEAT_SINGLE_MMAP)
+  #define SAMPLER_USE_IO_URING 1
+ #endif
+#endif
+
+#ifndef SAMPLER_USE_IO_URING
+ #define SAMPLER_USE_IO_URING 0
+#endif
+
+class SampleEditHistory;
+class SampleMemoryRegion;
+class SampleArena;
+class SharedMemorySegment;
+
 //==============================================================================
 // SAMPLE DATA STRUCTURE
 //==============================================================================
+// UTF-8 zone text stored in the sample set's arena
+struct SampleText
+{
+    const char* utf8 = "";
+
+    juce::String toString() const { return juce::String::fromUTF8(utf8); }
+    bool isEmpty() const { return *utf8 == 0; }
+};
+
 struct SampleData
 {
     juce::AudioBuffer<float> audioData;
@@ -36,12 +90,21 @@ struct SampleData
     int rootNote = 60;
     int lowestNote = 0;
     int highestNote = 127;
+    int lowestVelocity = 1;  // Velocity layer range, 1-127
+    int highestVelocity = 127;
     float loopStart = 0.25f;
     float loopEnd = 0.75f;
     bool loopEnabled = false;
     int loopMode = 0; // 0=Forward, 1=Backward, 2=Ping-Pong
-    juce::String name;
-    juce::String filePath;  // Added: store the source file path for reloading
+    SampleText name;
+    SampleText filePath;  // Added: store the source file path for reloading
+    juce::uint64 contentHash = 0;  // Lets the file be found again after it moves
+    juce::int64 fileSize = 0;
+    std::shared_ptr<SampleEditHistory> editHistory;  // Created on first edit
+    std::shared_ptr<SampleArena> arena;  // Owns the decoded audio and the zone text
+    std::shared_ptr<SampleMemoryRegion> audioMemory;  // Set once edited audio replaces the arena copy
+    const float* interleavedStereo = nullptr;  // L/R frame pairs the voices read instead, if present
+    std::shared_ptr<SharedMemorySegment> sharedAudio;  // Set when the audio lives in the sample server's memory
 };
 
 //==============================================================================
@@ -60,6 +123,24 @@ enum class ModulationDestination
     FilterResonance, SampleStart, LoopStart, LoopEnd
 };
 
+// LFO parameter IDs and names are spelled out so creating an instance, or moving
+// a knob, never builds them by string concatenation
+struct LFOParameterIDs
+{
+    const char* rate;
+    const char* amount;
+    const char* waveform;
+    const char* rateName;
+    const char* amountName;
+    const char* waveformName;
+};
+
+inline constexpr std::array<LFOParameterIDs, 3> lfoParameterIDs {{
+    { "lfo1_rate", "lfo1_amount", "lfo1_waveform", "LFO1 Rate", "LFO1 Amount", "LFO1 Waveform" },
+    { "lfo2_rate", "lfo2_amount", "lfo2_waveform", "LFO2 Rate", "LFO2 Amount", "LFO2 Waveform" },
+    { "lfo3_rate", "lfo3_amount", "lfo3_waveform", "LFO3 Rate", "LFO3 Amount", "LFO3 Waveform" }
+}};
+
 //==============================================================================
 // LFO CLASS
 //==============================================================================
@@ -76,6 +157,14 @@ public:
         sampleRate = sr;
     }
     
+    // Back to the start of the cycle with a known random sequence
+    void reset(juce::uint32 seed)
+    {
+        phase = 0.0f;
+        randomValue = 0.0f;
+        randomState = seed | 1;
+    }
+    
     void setFrequency(float freq)
     {
         frequency = freq;
@@ -88,43 +177,68 @@ public:
     
     float getNextSample()
     {
-        float output = 0.0f;
+        return advance(1);
+    }
+    
+    // Moves on by a whole block and returns the value at its last sample.
+    // The random waveform picks a new value each time the phase wraps.
+    float advance(int numSamples)
+    {
+        float increment = frequency / (float)sampleRate;
+        float lastPhase = phase + increment * (float)(numSamples - 1);
+        
+        if (waveform == 4 && lastPhase >= 1.0f)
+            randomValue = nextRandom() * 2.0f - 1.0f;
+        
+        float output = getValueAt(lastPhase - std::floor(lastPhase));
         
+        phase += increment * (float)numSamples;
+        phase -= std::floor(phase);
+        
+        return output;
+    }
+    
+private:
+    float getValueAt(float p) const
+    {
         switch (waveform)
         {
             case 0: // Sine
-                output = std::sin(phase * 2.0f * juce::MathConstants<float>::pi);
-                break;
+                return std::sin(p * 2.0f * juce::MathConstants<float>::pi);
             case 1: // Triangle
-                output = 2.0f * std::abs(2.0f * (phase - std::floor(phase + 0.5f))) - 1.0f;
-                break;
+                return 2.0f * std::abs(2.0f * (p - std::floor(p + 0.5f))) - 1.0f;
             case 2: // Square
-                output = phase < 0.5f ? 1.0f : -1.0f;
-                break;
+                return p < 0.5f ? 1.0f : -1.0f;
             case 3: // Sawtooth
-                output = 2.0f * (phase - std::floor(phase + 0.5f));
-                break;
+                return 2.0f * (p - std::floor(p + 0.5f));
             case 4: // Random
-                if (phase >= 1.0f)
-                    randomValue = random.nextFloat() * 2.0f - 1.0f;
-                output = randomValue;
-                break;
+                return randomValue;
+            default:
+                return 0.0f;
         }
-        
-        phase += frequency / (float)sampleRate;
-        if (phase >= 1.0f)
-            phase -= 1.0f;
-        
-        return output;
     }
     
-private:
+    // xorshift32: four bytes of state instead of a juce::Random per LFO
+    float nextRandom()
+    {
+        randomState ^= randomState << 13;
+        randomState ^= randomState >> 17;
+        randomState ^= randomState << 5;
+        return (float)(randomState >> 8) * (1.0f / 16777216.0f);
+    }
+    
+    static juce::uint32 nextSeed()
+    {
+        static std::atomic<juce::uint32> counter{0x9e3779b9};
+        return counter.fetch_add(0x6d2b79f5) | 1;
+    }
+    
     double sampleRate = 44100.0;
     float frequency = 1.0f;
     int waveform = 0;
     float phase = 0.0f;
     float randomValue = 0.0f;
-    juce::Random random;
+    juce::uint32 randomState = nextSeed();
 };
 
 //==============================================================================
@@ -133,7 +247,16 @@ private:
 class ModulationMatrix
 {
 public:
-    ModulationMatrix(juce::AudioProcessorValueTreeState& vts) : valueTreeState(vts) {}
+    ModulationMatrix(juce::AudioProcessorValueTreeState& vts) : valueTreeState(vts)
+    {
+        // Looked up once; the IDs never change
+        for (size_t i = 0; i < lfoParameterIDs.size(); ++i)
+        {
+            lfoRate[i] = valueTreeState.getRawParameterValue(lfoParameterIDs[i].rate);
+            lfoAmount[i] = valueTreeState.getRawParameterValue(lfoParameterIDs[i].amount);
+            lfoWaveform[i] = valueTreeState.getRawParameterValue(lfoParameterIDs[i].waveform);
+        }
+    }
     
     void prepareToPlay(double sampleRate, int)
     {
@@ -144,58 +267,59 @@ public:
     void processBlock(int numSamples)
     {
         // Update LFO parameters
-        for (int i = 0; i < 3; ++i)
+        for (size_t i = 0; i < 3; ++i)
         {
-            juce::String prefix = "lfo" + juce::String(i + 1) + "_";
-            float rate = *valueTreeState.getRawParameterValue(prefix + "rate");
-            float amount = *valueTreeState.getRawParameterValue(prefix + "amount");
-            int waveform = (int)*valueTreeState.getRawParameterValue(prefix + "waveform");
-            
-            lfos[i].setFrequency(rate);
-            lfos[i].setWaveform(waveform);
+            lfos[i].setFrequency(*lfoRate[i]);
+            lfos[i].setWaveform((int)*lfoWaveform[i]);
         }
         
-        // Process LFO samples and update destination values
-        destinationValues.clear();
+        // Destinations only see the LFOs once per block, so step them a block at a time
+        destinationValues.fill(0.0f);
         
-        for (int sample = 0; sample < numSamples; ++sample)
-        {
-            sourceValues[ModulationSource::LFO1] = lfos[0].getNextSample();
-            sourceValues[ModulationSource::LFO2] = lfos[1].getNextSample();
-            sourceValues[ModulationSource::LFO3] = lfos[2].getNextSample();
-        }
+        setSourceValue(ModulationSource::LFO1, lfos[0].advance(numSamples));
+        setSourceValue(ModulationSource::LFO2, lfos[1].advance(numSamples));
+        setSourceValue(ModulationSource::LFO3, lfos[2].advance(numSamples));
         
         // Apply modulation amounts to destinations
-        float lfo1Amount = *valueTreeState.getRawParameterValue("lfo1_amount");
-        float lfo2Amount = *valueTreeState.getRawParameterValue("lfo2_amount");
-        float lfo3Amount = *valueTreeState.getRawParameterValue("lfo3_amount");
-        
-        destinationValues[ModulationDestination::FilterCutoff] = 
-            sourceValues[ModulationSource::LFO1] * lfo1Amount * 0.5f;
+        destinationValues[(size_t)ModulationDestination::FilterCutoff] = 
+            getSourceValue(ModulationSource::LFO1) * *lfoAmount[0] * 0.5f;
         
-        destinationValues[ModulationDestination::Pitch] = 
-            sourceValues[ModulationSource::LFO2] * lfo2Amount * 0.1f;
+        destinationValues[(size_t)ModulationDestination::Pitch] = 
+            getSourceValue(ModulationSource::LFO2) * *lfoAmount[1] * 0.1f;
         
-        destinationValues[ModulationDestination::Volume] = 
-            sourceValues[ModulationSource::LFO3] * lfo3Amount * 0.3f;
+        destinationValues[(size_t)ModulationDestination::Volume] = 
+            getSourceValue(ModulationSource::LFO3) * *lfoAmount[2] * 0.3f;
     }
     
     float getModulationValue(ModulationDestination destination) const
     {
-        auto it = destinationValues.find(destination);
-        return (it != destinationValues.end()) ? it->second : 0.0f;
+        return destinationValues[(size_t)destination];
     }
     
+    // Neutral destinations, for patches that don't modulate at all
+    void clearDestinations() { destinationValues.fill(0.0f); }
+    
     void setSourceValue(ModulationSource source, float value)
     {
-        sourceValues[source] = value;
+        sourceValues[(size_t)source] = value;
+    }
+    
+    float getSourceValue(ModulationSource source) const { return sourceValues[(size_t)source]; }
+    
+    void reset(juce::uint32 seed)
+    {
+        for (size_t i = 0; i < lfos.size(); ++i)
+            lfos[i].reset(seed + (juce::uint32)i * 0x9e3779b9u);
+        sourceValues.fill(0.0f);
+        destinationValues.fill(0.0f);
     }
     
 private:
     juce::AudioProcessorValueTreeState& valueTreeState;
     std::array<LFO, 3> lfos;
-    std::map<ModulationSource, float> sourceValues;
-    std::map<ModulationDestination, float> destinationValues;
+    std::array<std::atomic<float>*, 3> lfoRate {}, lfoAmount {}, lfoWaveform {};
+    std::array<float, (size_t)ModulationSource::Aftertouch + 1> sourceValues {};
+    std::array<float, (size_t)ModulationDestination::LoopEnd + 1> destinationValues {};
 };
 
 //==============================================================================
@@ -204,13 +328,17 @@ private:
 class FilterEngine
 {
 public:
-    FilterEngine(juce::AudioProcessorValueTreeState& vts) : valueTreeState(vts) {}
+    FilterEngine(juce::AudioProcessorValueTreeState& vts)
+        : valueTreeState(vts),
+          cutoffParam(vts.getRawParameterValue("filter_cutoff")),
+          resonanceParam(vts.getRawParameterValue("filter_resonance"))
+    {}
     
-    void prepareToPlay(double sr, int samplesPerBlock)
+    void prepareToPlay(double sr, int samplesPerBlock, int numChannels)
     {
         spec.sampleRate = sr;
         spec.maximumBlockSize = samplesPerBlock;
-        spec.numChannels = 2;
+        spec.numChannels = (juce::uint32)juce::jmax(2, numChannels);
         
         filter.prepare(spec);
         filter.setCutoffFrequency(1000.0f);
@@ -220,8 +348,8 @@ public:
     
     void processBlock(juce::AudioBuffer<float>& buffer)
     {
-        float cutoff = *valueTreeState.getRawParameterValue("filter_cutoff");
-        float res = *valueTreeState.getRawParameterValue("filter_resonance");
+        float cutoff = *cutoffParam;
+        float res = *resonanceParam;
         
         // Apply LFO modulation to filter cutoff if we have modMatrix reference
         if (modMatrix != nullptr)
@@ -243,6 +371,8 @@ public:
         filter.process(context);
     }
     
+    void reset() { filter.reset(); }
+    
     void setModulationMatrix(ModulationMatrix* matrix)
     {
         modMatrix = matrix;
@@ -250,6 +380,8 @@ public:
     
 private:
     juce::AudioProcessorValueTreeState& valueTreeState;
+    std::atomic<float>* cutoffParam;
+    std::atomic<float>* resonanceParam;
     juce::dsp::StateVariableTPTFilter<float> filter;
     juce::dsp::ProcessSpec spec;
     ModulationMatrix* modMatrix = nullptr;
@@ -311,756 +443,9102 @@ private:
 */
 
 //==============================================================================
-// SAMPLE ENGINE
+// SAMPLE MEMORY
 //==============================================================================
-class SampleEngine
+struct SampleMemoryOptions
+{
+    bool lockPages = true;   // mlock the region so it can never be paged out
+    bool prefault = true;    // Touch every page right after allocation
+    bool hugePages = false;  // Explicit huge pages, falling back to transparent huge pages
+    bool interleaveStereo = false;  // Also keep an L/R interleaved copy of stereo zones; doubles their RAM
+};
+
+// Decoded sample data lives in regions mapped straight from the OS rather than
+// the heap, so they can be locked, prefaulted and backed by huge pages. The
+// audio thread then never takes a first-touch fault on a rarely used zone.
+class SampleMemoryRegion
 {
 public:
-    SampleEngine(juce::AudioProcessorValueTreeState& vts) : valueTreeState(vts)
+    static constexpr size_t alignment = 64;
+    static constexpr size_t hugePageSize = 2 * 1024 * 1024;
+
+    SampleMemoryRegion(size_t bytesNeeded, const SampleMemoryOptions& options)
     {
-        formatManager.registerBasicFormats();
+        size = juce::jmax((size_t)1, bytesNeeded);
+
+       #if JUCE_LINUX || JUCE_BSD || JUCE_MAC || JUCE_ANDROID
+        size_t pageSize = (size_t)sysconf(_SC_PAGESIZE);
+        bool wantsHugePages = options.hugePages && size >= hugePageSize;
+        size = roundUp(size, wantsHugePages ? hugePageSize : pageSize);
+
+        #if JUCE_LINUX || JUCE_ANDROID
+        if (wantsHugePages)
+        {
+            data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+            if (data == MAP_FAILED)
+                data = nullptr;
+            else
+                hugePages = true;
+        }
+        #endif
+
+        if (data == nullptr)
+        {
+            data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (data == MAP_FAILED)
+                data = nullptr;
+
+           #if JUCE_LINUX || JUCE_ANDROID
+            // No reserved huge pages: ask for transparent ones instead
+            if (data != nullptr && wantsHugePages)
+                madvise(data, size, MADV_HUGEPAGE);
+           #endif
+        }
+
+        if (data != nullptr && options.lockPages)
+            locked = mlock(data, size) == 0;  // Fails quietly when RLIMIT_MEMLOCK is too low
+
+        if (data != nullptr && options.prefault)
+            for (size_t offset = 0; offset < size; offset += pageSize)
+                static_cast<volatile char*>(data)[offset] = 0;
+       #else
+        juce::ignoreUnused(options);
+       #endif
+
+        if (data == nullptr)
+        {
+            // Heap fallback keeps sample loading working where mmap isn't available
+            heapBlock.allocate(size + alignment, true);
+            data = reinterpret_cast<void*>(roundUp(reinterpret_cast<size_t>(heapBlock.getData()), alignment));
+        }
+
+        getStats().allocatedBytes += (juce::int64)size;
+        if (locked)
+            getStats().lockedBytes += (juce::int64)size;
     }
-    
-    void prepareToPlay(double, int) {}
-    
-    void loadSample(const juce::File& file, int rootNote = 60)
+
+    ~SampleMemoryRegion()
     {
-        std::unique_ptr<juce::AudioFormatReader> reader(formatManager.createReaderFor(file));
-        
-        if (reader != nullptr)
+        getStats().allocatedBytes -= (juce::int64)size;
+        if (locked)
+            getStats().lockedBytes -= (juce::int64)size;
+
+       #if JUCE_LINUX || JUCE_BSD || JUCE_MAC || JUCE_ANDROID
+        if (heapBlock.getData() == nullptr && data != nullptr)
         {
-            SampleData newSample;
-            newSample.name = file.getFileNameWithoutExtension();
-            newSample.filePath = file.getFullPathName();  // Store full path for reloading
-            newSample.sampleRate = reader->sampleRate;
-            newSample.rootNote = rootNote;
-            newSample.audioData.setSize(reader->numChannels, (int)reader->lengthInSamples);
-            
-            reader->read(&newSample.audioData, 0, (int)reader->lengthInSamples, 0, true, true);
-            
-            samples.push_back(std::move(newSample));
+            if (locked)
+                munlock(data, size);
+            munmap(data, size);
         }
+       #endif
     }
-    
-    void clearSamples()
+
+    void* getData() const { return data; }
+    size_t getSize() const { return size; }
+    bool isLocked() const { return locked; }
+    bool usesHugePages() const { return hugePages; }
+
+    struct Stats
+    {
+        std::atomic<juce::int64> allocatedBytes{0};
+        std::atomic<juce::int64> lockedBytes{0};
+    };
+
+    // Process-wide totals across every instance
+    static Stats& getStats()
     {
-        samples.clear();
+        static Stats stats;
+        return stats;
     }
-    
-    SampleData* getSampleForNote(int noteNumber)
+
+    static size_t roundUp(size_t value, size_t multiple)
     {
-        for (auto& sample : samples)
-        {
-            if (noteNumber >= sample.lowestNote && noteNumber <= sample.highestNote)
-                return &sample;
-        }
-        return samples.empty() ? nullptr : &samples[0];
+        return (value + multiple - 1) / multiple * multiple;
     }
-    
-    const std::vector<SampleData>& getAllSamples() const { return samples; }
-    std::vector<SampleData>& getAllSamples() { return samples; }
-    
+
 private:
-    juce::AudioProcessorValueTreeState& valueTreeState;
-    std::vector<SampleData> samples;
-    juce::AudioFormatManager formatManager;
-};
+    void* data = nullptr;
+    size_t size = 0;
+    bool locked = false;
+    bool hugePages = false;
+    juce::HeapBlock<char> heapBlock;
 
-//==============================================================================
-// FORWARD DECLARATIONS
-//==============================================================================
-class AdvancedSamplerProcessor;
+    JUCE_DECLARE_NON_COPYABLE(SampleMemoryRegion)
+};
 
 //==============================================================================
-// SAMPLER VOICE
+// PAGE FAULT COUNTER
 //==============================================================================
-class AdvancedSamplerSound : public juce::SynthesiserSound
+// Counts page faults taken by the audio thread inside processBlock. Only Linux
+// reports per-thread fault counts; elsewhere the counters stay at zero.
+class PageFaultCounter
 {
 public:
-    bool appliesToNote(int) override { return true; }
-    bool appliesToChannel(int) override { return true; }
-};
+    static bool isSupported()
+    {
+       #if JUCE_LINUX
+        return true;
+       #else
+        return false;
+       #endif
+    }
 
-class AdvancedSamplerVoice : public juce::SynthesiserVoice
-{
-public:
-    AdvancedSamplerVoice(SampleEngine& sampleEng, ModulationMatrix& modMatrix, AdvancedSamplerProcessor& proc, int index);
-    
-    void setValueTreeState(juce::AudioProcessorValueTreeState* vts)
+    void blockStart()
     {
-        valueTreeState = vts;
+       #if JUCE_LINUX
+        readThreadFaults(startMinor, startMajor);
+       #endif
     }
-    bool canPlaySound(juce::SynthesiserSound* sound) override
+
+    void blockEnd()
     {
-        return dynamic_cast<AdvancedSamplerSound*>(sound) != nullptr;
+       #if JUCE_LINUX
+        long minor = 0, major = 0;
+        readThreadFaults(minor, major);
+
+        if (minor > startMinor || major > startMajor)
+        {
+            minorFaults += minor - startMinor;
+            majorFaults += major - startMajor;
+            ++blocksWithFaults;
+        }
+       #endif
     }
-    
-    void updateADSRParams()
+
+    juce::int64 getMinorFaults() const { return minorFaults.load(); }
+    juce::int64 getMajorFaults() const { return majorFaults.load(); }
+    juce::int64 getBlocksWithFaults() const { return blocksWithFaults.load(); }
+
+private:
+   #if JUCE_LINUX
+    static void readThreadFaults(long& minor, long& major)
     {
-        if (valueTreeState != nullptr)
+        rusage usage {};
+        if (getrusage(RUSAGE_THREAD, &usage) == 0)
         {
-            adsrParams.attack = *valueTreeState->getRawParameterValue("env_attack");
-            adsrParams.decay = *valueTreeState->getRawParameterValue("env_decay");
-            adsrParams.sustain = *valueTreeState->getRawParameterValue("env_sustain");
-            adsrParams.release = *valueTreeState->getRawParameterValue("env_release");
-            adsr.setParameters(adsrParams);
+            minor = usage.ru_minflt;
+            major = usage.ru_majflt;
         }
     }
-    
-    void startNote(int midiNoteNumber, float vel, juce::SynthesiserSound*, int) override;
-    void stopNote(float, bool allowTailOff) override
+   #endif
+
+    long startMinor = 0, startMajor = 0;
+    std::atomic<juce::int64> minorFaults{0}, majorFaults{0}, blocksWithFaults{0};
+};
+
+//==============================================================================
+// SAMPLE ARENA
+//==============================================================================
+// Bump allocator for everything a sample set owns: audio channels and zone text.
+// Blocks come from SampleMemoryRegion, so they're locked and prefaulted like any
+// other sample memory, and the whole set is released in one go when the last
+// zone referring to the arena goes away. Nothing is freed individually; edited
+// audio lives in its own region instead.
+class SampleArena
+{
+public:
+    static constexpr size_t defaultBlockSize = 8 * 1024 * 1024;
+    static constexpr size_t simdPadding = 64;  // Zeroed tail so vector loads can read past the end
+
+    explicit SampleArena(const SampleMemoryOptions& options, size_t blockSizeToUse = defaultBlockSize)
+        : memoryOptions(options), blockSize(blockSizeToUse) {}
+
+    void* allocate(size_t bytes, size_t alignment = SampleMemoryRegion::alignment)
     {
-        adsr.noteOff();
-        if (!allowTailOff)
-            clearCurrentNote();
+        const juce::ScopedLock sl(lock);
+        bytesUsed += bytes;
+
+        // Oversized requests get a block of their own so the open block isn't wasted
+        if (bytes > blockSize / 2)
+        {
+            blocks.insert(blocks.begin(), std::make_unique<SampleMemoryRegion>(bytes, memoryOptions));
+            ++numDedicatedBlocks;
+            return blocks.front()->getData();
+        }
+
+        if (blocks.size() == numDedicatedBlocks
+             || SampleMemoryRegion::roundUp(blockUsed, alignment) + bytes > blocks.back()->getSize())
+        {
+            blocks.push_back(std::make_unique<SampleMemoryRegion>(blockSize, memoryOptions));
+            blockUsed = 0;
+        }
+
+        blockUsed = SampleMemoryRegion::roundUp(blockUsed, alignment);
+        void* result = static_cast<char*>(blocks.back()->getData()) + blockUsed;
+        blockUsed += bytes;
+        return result;
     }
-    
-    void pitchWheelMoved(int newValue) override
+
+    // Points buffer at arena channels, each 64-byte aligned and followed by zeroed padding
+    void allocateAudio(juce::AudioBuffer<float>& buffer, int numChannels, int numFrames)
     {
-        float pitchBend = (newValue - 8192) / 8192.0f * 2.0f;
-        modulationMatrix.setSourceValue(ModulationSource::PitchBend, pitchBend / 12.0f);
+        size_t channelStride = getChannelStride(numFrames);
+        auto* base = static_cast<char*>(allocate(channelStride * (size_t)juce::jmax(1, numChannels)));
+
+        std::vector<float*> channels;
+        for (int ch = 0; ch < numChannels; ++ch)
+            channels.push_back(reinterpret_cast<float*>(base + channelStride * (size_t)ch));
+
+        buffer.setDataToReferTo(channels.data(), numChannels, numFrames);
     }
-    
-    void controllerMoved(int controllerNumber, int newValue) override
+
+    SampleText copyText(const juce::String& text)
     {
-        float normalizedValue = newValue / 127.0f;
-        
-        if (controllerNumber == 1)
-            modulationMatrix.setSourceValue(ModulationSource::ModWheel, normalizedValue);
+        auto numBytes = text.getNumBytesAsUTF8() + 1;
+        auto* dest = static_cast<char*>(allocate(numBytes, 1));
+        text.copyToUTF8(dest, numBytes);
+        return { dest };
     }
-    float getCurrentPlaybackPosition() const { return normalizedPosition; }
-    void renderNextBlock(juce::AudioBuffer<float>& outputBuffer, int startSample, int numSamples) override;
-    
+
+    static size_t getChannelStride(int numFrames)
+    {
+        return SampleMemoryRegion::roundUp((size_t)juce::jmax(0, numFrames) * sizeof(float) + simdPadding,
+                                           SampleMemoryRegion::alignment);
+    }
+
+    size_t getBytesUsed() const { const juce::ScopedLock sl(lock); return bytesUsed; }
+
+    size_t getBytesReserved() const
+    {
+        const juce::ScopedLock sl(lock);
+        size_t total = 0;
+        for (const auto& block : blocks)
+            total += block->getSize();
+        return total;
+    }
+
 private:
-    float normalizedPosition ;
-    juce::AudioProcessorValueTreeState* valueTreeState = nullptr;
-    SampleEngine& sampleEngine;
-    ModulationMatrix& modulationMatrix;
-    AdvancedSamplerProcessor& processor;
-    int voiceIndex;
-    SampleData* currentSample = nullptr;
-    double currentPosition = 0.0;
-    double positionIncrement = 0.0;
-    int noteNumber = 0;
-    float velocity = 0.0f;
-    bool loopingForward = true;
-    juce::ADSR adsr;
-    juce::ADSR::Parameters adsrParams;
+    SampleMemoryOptions memoryOptions;
+    size_t blockSize;
+    std::vector<std::unique_ptr<SampleMemoryRegion>> blocks;  // Dedicated blocks first, the open block last
+    size_t numDedicatedBlocks = 0;
+    size_t blockUsed = 0;
+    size_t bytesUsed = 0;
+    juce::CriticalSection lock;
+
+    JUCE_DECLARE_NON_COPYABLE(SampleArena)
 };
 
 //==============================================================================
-// CUSTOM KNOB COMPONENT
+// SAMPLE FILE I/O
 //==============================================================================
-class CustomKnob : public juce::Component
+struct SampleIOOptions
+{
+    bool directIO = false;                                // Bypass the page cache for big files
+    juce::int64 directIOMinFileSize = 64 * 1024 * 1024;   // Smaller files always use the page cache
+};
+
+// A sample file opened for positioned reads, safe to use from several threads
+class SampleFileHandle
 {
 public:
-    CustomKnob()
+    SampleFileHandle(const juce::File& file, const SampleIOOptions& options)
     {
-        setSize(70, 100);
+        size = file.getSize();
+        bool wantsDirect = options.directIO && size >= options.directIOMinFileSize;
+
+       #if JUCE_LINUX || JUCE_BSD || JUCE_MAC || JUCE_ANDROID
+        auto* path = file.getFullPathName().toRawUTF8();
+
+        #if defined(O_DIRECT)
+        if (wantsDirect)
+        {
+            // Not every filesystem supports O_DIRECT, so fall back to a normal open
+            fd = ::open(path, O_RDONLY | O_CLOEXEC | O_DIRECT);
+            direct = fd >= 0;
+        }
+        #endif
+
+        if (fd < 0)
+            fd = ::open(path, O_RDONLY | O_CLOEXEC);
+
+        #if JUCE_MAC
+        if (fd >= 0 && wantsDirect)
+            direct = fcntl(fd, F_NOCACHE, 1) == 0;
+        #endif
+       #else
+        juce::ignoreUnused(wantsDirect);
+        stream = file.createInputStream();
+       #endif
     }
-    
-    void paint(juce::Graphics& g) override
+
+    ~SampleFileHandle()
     {
-        auto bounds = getLocalBounds().reduced(5);
-        auto knobBounds = bounds.removeFromTop(60);
-        
-        // Draw knob shadow
-        g.setColour(juce::Colours::black.withAlpha(0.3f));
-        g.fillEllipse(knobBounds.toFloat().translated(2, 2));
-        
-        // Draw knob base
-        juce::ColourGradient gradient(
-            juce::Colour(0xff444444), knobBounds.getCentreX(), knobBounds.getY(),
-            juce::Colour(0xff222222), knobBounds.getCentreX(), knobBounds.getBottom(),
-            false
-        );
-        g.setGradientFill(gradient);
-        g.fillEllipse(knobBounds.toFloat());
-        
-        // Draw knob ring
-        g.setColour(juce::Colour(0xff333333));
-        g.drawEllipse(knobBounds.toFloat().reduced(2), 2.0f);
-        
-        // 7 o'clock = 210° = 7π/6 radians
-        // 5 o'clock = 150° = 5π/6 radians
-        // Total sweep = 300° clockwise = 5π/3 radians
-        constexpr float startAngle = juce::MathConstants<float>::pi * 7.0f / 6.0f;  // 7 o'clock
-        constexpr float endAngle = juce::MathConstants<float>::pi * 5.0f / 6.0f;    // 5 o'clock
-        constexpr float totalSweep = juce::MathConstants<float>::twoPi - (juce::MathConstants<float>::pi / 3.0f); // 300° = 5π/3
-        
-        // Draw active indicator arc (clockwise from 7 to current position)
-        float currentAngle = startAngle + (value * totalSweep);
-        juce::Path arcPath;
-        arcPath.addCentredArc(knobBounds.getCentreX(), knobBounds.getCentreY(),
-                             knobBounds.getWidth() / 2.0f - 5, knobBounds.getHeight() / 2.0f - 5,
-                             0.0f, startAngle, currentAngle, true);
-        
-        g.setColour(juce::Colour(0xff00ff88));
-        g.strokePath(arcPath, juce::PathStrokeType(3.0f));
-        
-        // Draw pointer
-        float pointerAngle = startAngle + (value * totalSweep);
-        float pointerLength = knobBounds.getWidth() / 2.0f - 10;
-        float pointerX = knobBounds.getCentreX() + pointerLength * std::cos(pointerAngle - juce::MathConstants<float>::pi / 2.0f);
-        float pointerY = knobBounds.getCentreY() + pointerLength * std::sin(pointerAngle - juce::MathConstants<float>::pi / 2.0f);
-        
-        g.setColour(juce::Colours::white);
-        g.drawLine(knobBounds.getCentreX(), knobBounds.getCentreY(), pointerX, pointerY, 3.0f);
-        
-        // Draw label
-        g.setColour(juce::Colour(0xffaaaaaa));
-        g.setFont(11.0f);
-        g.drawText(label, bounds.removeFromTop(15), juce::Justification::centred);
-        
-        // Draw value
-        g.setColour(juce::Colour(0xff00ff88));
-        g.setFont(12.0f);
-        g.drawText(valueText, bounds, juce::Justification::centred);
-    }
-    
-    void mouseDown(const juce::MouseEvent& e) override
-    {
-        startDragY = e.y;
-        startValue = value;
-    }
-    
-    void mouseDrag(const juce::MouseEvent& e) override
-    {
-        float delta = (startDragY - e.y) / 100.0f;
-        value = juce::jlimit(0.0f, 1.0f, startValue + delta);
-        
-        if (onValueChange)
-            onValueChange(value);
-        
-        repaint();
+       #if JUCE_LINUX || JUCE_BSD || JUCE_MAC || JUCE_ANDROID
+        if (fd >= 0)
+            ::close(fd);
+       #endif
     }
-    
-    void setValue(float newValue)
+
+    bool isOpen() const { return fd >= 0 || stream != nullptr; }
+    int getDescriptor() const { return fd; }
+    bool isDirect() const { return direct; }
+    juce::int64 getSize() const { return size; }
+
+    // Blocking read at an absolute offset; returns the bytes read, or -1 on error
+    int readAt(juce::int64 offset, void* dest, int length)
     {
-        value = juce::jlimit(0.0f, 1.0f, newValue);
-        repaint();
+       #if JUCE_LINUX || JUCE_BSD || JUCE_MAC || JUCE_ANDROID
+        return (int)::pread(fd, dest, (size_t)length, (off_t)offset);
+       #else
+        const juce::ScopedLock sl(streamLock);
+        if (stream == nullptr || !stream->setPosition(offset))
+            return -1;
+        return stream->read(dest, length);
+       #endif
     }
-    
-    void setLabel(const juce::String& text) { label = text; repaint(); }
-    void setValueText(const juce::String& text) { valueText = text; repaint(); }
-    
-    std::function<void(float)> onValueChange;
-    
-private:
-    float value = 0.5f;
-    float startValue = 0.0f;
-    int startDragY = 0;
-    juce::String label;
-    juce::String valueText = "0.5";
-};
 
+private:
+    int fd = -1;
+    bool direct = false;
+    juce::int64 size = 0;
+    std::unique_ptr<juce::FileInputStream> stream;
+    juce::CriticalSection streamLock;
 
+    JUCE_DECLARE_NON_COPYABLE(SampleFileHandle)
+};
 
+struct SampleReadRequest
+{
+    SampleFileHandle* file = nullptr;
+    juce::int64 offset = 0;
+    void* dest = nullptr;
+    int length = 0;
+    int bytesRead = 0;  // Set on completion, -1 on error
+};
 
-//==============================================================================
-// AUDIO PROCESSOR
-//==============================================================================
-class AdvancedSamplerProcessor : public juce::AudioProcessor
+// Issues batches of reads and waits for all of them. The io_uring backend keeps
+// the whole batch in flight at once; the fallback spreads it over a thread pool.
+class SampleIOBackend
 {
 public:
-    AdvancedSamplerProcessor()
-        : AudioProcessor(BusesProperties().withOutput("Output", juce::AudioChannelSet::stereo(), true)),
-          parameters(*this, nullptr, "Parameters", createParameterLayout()),
-          sampleEngine(parameters),
-          modMatrix(parameters),
-          filterEngine(parameters)
+    struct Stats
     {
-        // Initialize voice position arrays
-        for (auto& pos : voicePositions)
-            pos.store(0.0f);
-        for (auto& active : voiceActive)
-            active.store(false);
-            
-        for (int i = 0; i < 16; ++i)
+        std::atomic<juce::int64> batches{0}, requests{0}, bytesRead{0}, errors{0};
+        std::atomic<int> lastQueueDepth{0}, maxQueueDepth{0};
+        std::atomic<juce::int64> totalLatencyMicros{0};
+        std::atomic<int> maxLatencyMicros{0};
+
+        double getAverageLatencyMicros() const
         {
-            auto* voice = new AdvancedSamplerVoice(sampleEngine, modMatrix, *this, i);
-            voice->setValueTreeState(&parameters);
-            synthesizer.addVoice(voice);
+            auto numRequests = requests.load();
+            return numRequests > 0 ? (double)totalLatencyMicros.load() / (double)numRequests : 0.0;
         }
-        
-        synthesizer.addSound(new AdvancedSamplerSound());
-        
-        // Connect filter engine to modulation matrix
-        filterEngine.setModulationMatrix(&modMatrix);
-    }
-    
-    ~AdvancedSamplerProcessor() override {}
-    
-    void prepareToPlay(double sampleRate, int samplesPerBlock) override
+    };
+
+    virtual ~SampleIOBackend() = default;
+
+    virtual void readBatch(SampleReadRequest* requests, int numRequests) = 0;
+    virtual const char* getName() const = 0;
+
+    const Stats& getStats() const { return stats; }
+
+    // io_uring where the kernel allows it, otherwise the thread pool
+    static std::unique_ptr<SampleIOBackend> create();
+
+protected:
+    void recordQueueDepth(int queueDepth)
     {
-        synthesizer.setCurrentPlaybackSampleRate(sampleRate);
-        sampleEngine.prepareToPlay(sampleRate, samplesPerBlock);
-        modMatrix.prepareToPlay(sampleRate, samplesPerBlock);
-        filterEngine.prepareToPlay(sampleRate, samplesPerBlock);
-        
-        cpuLoadMeasurer.reset();
-        cpuLoadMeasurer.setSampleRate(sampleRate);
-        cpuLoadMeasurer.setBlockSize(samplesPerBlock);
+        stats.lastQueueDepth = queueDepth;
+        if (queueDepth > stats.maxQueueDepth.load())
+            stats.maxQueueDepth = queueDepth;
     }
-    
-    void releaseResources() override {}
-    
-    bool isBusesLayoutSupported(const BusesLayout& layouts) const override
+
+    void recordCompletion(const SampleReadRequest& request, juce::int64 submitTicks)
     {
-        return layouts.getMainOutputChannelSet() == juce::AudioChannelSet::stereo();
+        auto micros = (int)(juce::Time::highResolutionTicksToSeconds(juce::Time::getHighResolutionTicks() - submitTicks) * 1.0e6);
+
+        ++stats.requests;
+        stats.totalLatencyMicros += micros;
+        if (micros > stats.maxLatencyMicros.load())
+            stats.maxLatencyMicros = micros;
+
+        if (request.bytesRead < 0)
+            ++stats.errors;
+        else
+            stats.bytesRead += request.bytesRead;
     }
-    
-    void processBlock(juce::AudioBuffer<float>& buffer, juce::MidiBuffer& midiMessages) override
+
+    Stats stats;
+};
+
+class ThreadPoolIOBackend : public SampleIOBackend
+{
+public:
+    void readBatch(SampleReadRequest* requests, int numRequests) override
     {
-        juce::ScopedNoDenormals noDenormals;
-        cpuLoadMeasurer.measureBlockStart();
-        
-        auto totalNumInputChannels = getTotalNumInputChannels();
-        auto totalNumOutputChannels = getTotalNumOutputChannels();
-        
-        for (auto i = totalNumInputChannels; i < totalNumOutputChannels; ++i)
-            buffer.clear(i, 0, buffer.getNumSamples());
-        
-        modMatrix.processBlock(buffer.getNumSamples());
-        synthesizer.renderNextBlock(buffer, midiMessages, 0, buffer.getNumSamples());
-        for (int i = 0; i < synthesizer.getNumVoices(); ++i)
-            if (auto* voice = dynamic_cast<AdvancedSamplerVoice*>(synthesizer.getVoice(i)))
-                if (voice->isVoiceActive())
-                    currentPlaybackPosition = voice->getCurrentPlaybackPosition();
-        filterEngine.processBlock(buffer);
-        
-        float masterVolume = *parameters.getRawParameterValue("master_volume");
-        buffer.applyGain(masterVolume);
-        
-        // Count active voices
-        activeVoiceCount = 0;
-        for (int i = 0; i < synthesizer.getNumVoices(); ++i)
+        if (numRequests <= 0)
+            return;
+
+        ++stats.batches;
+        recordQueueDepth(numRequests);
+
+        std::atomic<int> remaining{numRequests};
+        juce::WaitableEvent finished;
+        auto submitTicks = juce::Time::getHighResolutionTicks();
+
+        for (int i = 0; i < numRequests; ++i)
         {
-            if (auto* voice = dynamic_cast<AdvancedSamplerVoice*>(synthesizer.getVoice(i)))
+            auto* request = requests + i;
+            ioPool.addJob([this, request, submitTicks, &remaining, &finished]
             {
-                if (voice->isVoiceActive())
-                    activeVoiceCount++;
-            }
+                request->bytesRead = request->file->readAt(request->offset, request->dest, request->length);
+                recordCompletion(*request, submitTicks);
+
+                if (--remaining == 0)
+                    finished.signal();
+            });
         }
-        
-        cpuLoadMeasurer.measureBlockEnd();
+
+        finished.wait();
     }
-    
-    juce::AudioProcessorEditor* createEditor() override;
-    bool hasEditor() const override { return true; }
-    
-    const juce::String getName() const override { return "Advanced Sampler"; }
-    bool acceptsMidi() const override { return true; }
-    bool producesMidi() const override { return false; }
-    bool isMidiEffect() const override { return false; }
-    double getTailLengthSeconds() const override { return 0.0; }
-    
-    int getNumPrograms() override { return 1; }
-    int getCurrentProgram() override { return 0; }
-    void setCurrentProgram(int) override {}
-    const juce::String getProgramName(int) override { return {}; }
-    void changeProgramName(int, const juce::String&) override {}
-    
-    void getStateInformation(juce::MemoryBlock& destData) override
+
+    const char* getName() const override { return "threads"; }
+
+private:
+    juce::ThreadPool ioPool { 4 };
+};
+
+#if SAMPLER_USE_IO_URING
+// Talks to the kernel through the raw syscalls so no liburing dependency is needed
+class IoUringBackend : public SampleIOBackend
+{
+public:
+    static constexpr unsigned ringEntries = 256;
+
+    IoUringBackend()
     {
-        // Create root state containing everything
-        juce::ValueTree rootState("PluginState");
-        
-        // Add APVTS parameters as a child
-        rootState.addChild(parameters.copyState(), -1, nullptr);
-        
-        // Add sample data as a separate child
-        juce::ValueTree samplesState("SampleData");
-        const auto& samples = sampleEngine.getAllSamples();
-        
-        DBG("=== SAVING STATE ===");
-        DBG("Number of samples: " + juce::String(samples.size()));
-        
-        for (size_t i = 0; i < samples.size(); ++i)
+        io_uring_params params {};
+        ringFd = (int)syscall(__NR_io_uring_setup, ringEntries, &params);
+        if (ringFd < 0)
+            return;
+
+        sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        bool singleMap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+        if (singleMap)
+            sqRingSize = cqRingSize = juce::jmax(sqRingSize, cqRingSize);
+
+        sqRing = mmap(nullptr, sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQ_RING);
+        cqRing = singleMap ? sqRing
+                           : mmap(nullptr, cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_CQ_RING);
+        sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+        auto* sqesMap = mmap(nullptr, sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQES);
+
+        if (sqRing == MAP_FAILED || cqRing == MAP_FAILED || sqesMap == MAP_FAILED)
         {
-            juce::ValueTree sampleState("Sample");
-            sampleState.setProperty("filePath", samples[i].filePath, nullptr);  // Save file path for reloading
-            sampleState.setProperty("name", samples[i].name, nullptr);
-            sampleState.setProperty("rootNote", samples[i].rootNote, nullptr);
-            sampleState.setProperty("lowestNote", samples[i].lowestNote, nullptr);
-            sampleState.setProperty("highestNote", samples[i].highestNote, nullptr);
-            sampleState.setProperty("loopStart", (double)samples[i].loopStart, nullptr);
-            sampleState.setProperty("loopEnd", (double)samples[i].loopEnd, nullptr);
-            sampleState.setProperty("loopEnabled", samples[i].loopEnabled, nullptr);
-            sampleState.setProperty("loopMode", samples[i].loopMode, nullptr);
-            
-            DBG("Sample " + juce::String((int)i) + " - file: " + samples[i].filePath
-                + " loopStart: " + juce::String(samples[i].loopStart) 
-                + " loopEnd: " + juce::String(samples[i].loopEnd) 
-                + " enabled: " + juce::String(samples[i].loopEnabled ? 1 : 0)
-                + " mode: " + juce::String(samples[i].loopMode));
-            
-            samplesState.addChild(sampleState, -1, nullptr);
+            release();
+            return;
         }
-        rootState.addChild(samplesState, -1, nullptr);
-        
-        // Serialize
-        std::unique_ptr<juce::XmlElement> xml(rootState.createXml());
-        DBG("XML: " + xml->toString());
-        copyXmlToBinary(*xml, destData);
+
+        auto* sq = static_cast<char*>(sqRing);
+        auto* cq = static_cast<char*>(cqRing);
+        sqHead = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+        sqTail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+        sqMask = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+        sqArray = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+        cqHead = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+        cqTail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+        cqMask = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+        cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+        sqes = static_cast<io_uring_sqe*>(sqesMap);
+        capacity = params.sq_entries;
+
+        // At most one read per SQ entry in flight, so the CQ (twice the size) can't overflow
+        slots.resize(capacity);
+        for (int i = (int)capacity; --i >= 0;)
+            freeSlots.push_back(i);
     }
-    
-    void setStateInformation(const void* data, int sizeInBytes) override
+
+    ~IoUringBackend() override { release(); }
+
+    bool isValid() const { return sqes != nullptr; }
+
+    // Any thread. Batches from several threads share the ring: the lock is only held
+    // while touching the rings, and one caller at a time waits in the kernel and
+    // hands out completions to every batch.
+    void readBatch(SampleReadRequest* requests, int numRequests) override
     {
-        std::unique_ptr<juce::XmlElement> xmlState(getXmlFromBinary(data, sizeInBytes));
-        
-        DBG("=== LOADING STATE ===");
-        
-        if (xmlState != nullptr)
+        if (numRequests <= 0)
+            return;
+
+        ++stats.batches;
+
+        Batch batch;
+        batch.requests = requests;
+        batch.numRequests = numRequests;
+        batch.iovecs.resize((size_t)numRequests);
+        batch.submitTicks.resize((size_t)numRequests);
+
+        for (int i = 0; i < numRequests; ++i)
+            requests[i].bytesRead = -1;
+
+        for (;;)
         {
-            DBG("XML loaded: " + xmlState->toString().substring(0, 200));
-            
-            auto rootState = juce::ValueTree::fromXml(*xmlState);
-            
-            if (rootState.isValid())
+            bool isWaiter = false;
             {
-                DBG("Root state valid, type: " + rootState.getType().toString());
-                
-                // Restore APVTS - find the Parameters child
-                auto paramsState = rootState.getChildWithName("Parameters");
-                if (paramsState.isValid())
-                {
-                    DBG("Found Parameters state, restoring...");
-                    parameters.replaceState(paramsState);
-                }
-                else
+                const juce::ScopedLock sl(ringLock);
+                submit(batch);
+
+                if (batch.nextToSubmit == numRequests && batch.inFlight == 0)
                 {
-                    DBG("WARNING: Parameters state not found!");
+                    waitingBatches.erase(std::remove(waitingBatches.begin(), waitingBatches.end(), &batch), waitingBatches.end());
+                    break;
                 }
-                
-                // Restore samples - RELOAD audio files first!
-                auto samplesState = rootState.getChildWithName("SampleData");
-                if (samplesState.isValid())
+
+                if (!waiterActive)
                 {
-                    DBG("Found SampleData with " + juce::String(samplesState.getNumChildren()) + " children");
-                    
-                    // Clear existing samples
-                    sampleEngine.clearSamples();
-                    
-                    // Reload each sample from saved file path
-                    for (int i = 0; i < samplesState.getNumChildren(); ++i)
-                    {
-                        auto sampleState = samplesState.getChild(i);
-                        juce::String filePath = sampleState.getProperty("filePath", "");
-                        
-                        if (filePath.isNotEmpty())
-                        {
-                            juce::File file(filePath);
-                            if (file.existsAsFile())
-                            {
-                                DBG("Reloading sample from: " + filePath);
-                                
-                                // Reload the audio file
-                                int rootNote = sampleState.getProperty("rootNote", 60);
-                                sampleEngine.loadSample(file, rootNote);
-                                
-                                // Now restore the loop settings
-                                auto& samples = sampleEngine.getAllSamples();
-                                if (!samples.empty())
-                                {
-                                    auto& sample = samples[samples.size() - 1];  // Get the just-loaded sample
-                                    sample.lowestNote = sampleState.getProperty("lowestNote", 0);
-                                    sample.highestNote = sampleState.getProperty("highestNote", 127);
-                                    sample.loopStart = (float)(double)sampleState.getProperty("loopStart", 0.25);
-                                    sample.loopEnd = (float)(double)sampleState.getProperty("loopEnd", 0.75);
-                                    sample.loopEnabled = sampleState.getProperty("loopEnabled", false);
-                                    sample.loopMode = sampleState.getProperty("loopMode", 0);
-                                    
-                                    DBG("Restored sample " + juce::String(i) + " - loopStart: " + juce::String(sample.loopStart) 
-                                        + " loopEnd: " + juce::String(sample.loopEnd) 
-                                        + " enabled: " + juce::String(sample.loopEnabled ? 1 : 0)
-                                        + " mode: " + juce::String(sample.loopMode));
-                                }
-                            }
-                            else
-                            {
-                                DBG("WARNING: Sample file not found: " + filePath);
-                            }
-                        }
-                    }
-                    
-                    DBG("Final sample count: " + juce::String(sampleEngine.getAllSamples().size()));
+                    waiterActive = isWaiter = true;
+                    waitingBatches.erase(std::remove(waitingBatches.begin(), waitingBatches.end(), &batch), waitingBatches.end());
                 }
-                else
+                else if (std::find(waitingBatches.begin(), waitingBatches.end(), &batch) == waitingBatches.end())
                 {
-                    DBG("WARNING: SampleData not found in state!");
+                    waitingBatches.push_back(&batch);
                 }
             }
-            else
+
+            if (!isWaiter)
             {
-                DBG("ERROR: Root state invalid!");
+                batch.wakeUp.wait();  // A completion of ours, or the waiter stepping down
+                continue;
             }
+
+            waitForCompletion();
+
+            const juce::ScopedLock sl(ringLock);
+            reapCompletions();
+            waiterActive = false;
+            for (auto* other : waitingBatches)
+                other->wakeUp.signal();  // One of them takes over waiting
         }
-        else
+
+        // Whatever the ring couldn't take after it failed is read the slow way
+        for (auto index : batch.readHere)
         {
-            DBG("ERROR: xmlState is null!");
+            auto& request = requests[index];
+            request.bytesRead = request.file->readAt(request.offset, request.dest, request.length);
+            recordCompletion(request, batch.submitTicks[(size_t)index]);
         }
     }
-    
-    SampleEngine& getSampleEngine() { return sampleEngine; }
-    juce::AudioProcessorValueTreeState& getValueTreeState() { return parameters; }
+
+    const char* getName() const override { return "io_uring"; }
+
+private:
+    struct Batch
+    {
+        SampleReadRequest* requests = nullptr;
+        int numRequests = 0;
+        int nextToSubmit = 0;
+        int inFlight = 0;
+        std::vector<iovec> iovecs;
+        std::vector<juce::int64> submitTicks;
+        std::vector<int> readHere;
+        juce::WaitableEvent wakeUp;
+    };
+
+    // A read in the ring. user_data carries the slot index and its generation, so a
+    // completion can never be matched to a later read reusing the slot.
+    struct Slot
+    {
+        Batch* batch = nullptr;
+        int index = 0;
+        juce::uint32 generation = 0;
+    };
+
+    // Called with ringLock held
+    void submit(Batch& batch)
+    {
+        if (broken)
+        {
+            for (; batch.nextToSubmit < batch.numRequests; ++batch.nextToSubmit)
+                batch.readHere.push_back(batch.nextToSubmit);
+            return;
+        }
+
+        unsigned tail = *sqTail;
+        while (batch.nextToSubmit < batch.numRequests && !freeSlots.empty())
+        {
+            int requestIndex = batch.nextToSubmit++;
+            auto& request = batch.requests[requestIndex];
+            auto& iov = batch.iovecs[(size_t)requestIndex];
+            iov.iov_base = request.dest;
+            iov.iov_len = (size_t)request.length;
+
+            int slotIndex = freeSlots.back();
+            freeSlots.pop_back();
+            auto& slot = slots[(size_t)slotIndex];
+            slot.batch = &batch;
+            slot.index = requestIndex;
+            ++slot.generation;
+
+            unsigned index = tail & sqMask;
+            auto& sqe = sqes[index];
+            std::memset(&sqe, 0, sizeof(sqe));
+            sqe.opcode = IORING_OP_READV;
+            sqe.fd = request.file->getDescriptor();
+            sqe.off = (juce::uint64)request.offset;
+            sqe.addr = (juce::uint64)(uintptr_t)&iov;
+            sqe.len = 1;
+            sqe.user_data = ((juce::uint64)slot.generation << 32) | (juce::uint64)slotIndex;
+            sqArray[index] = index;
+
+            batch.submitTicks[(size_t)requestIndex] = juce::Time::getHighResolutionTicks();
+            ++batch.inFlight;
+            ++tail;
+        }
+        __atomic_store_n(sqTail, tail, __ATOMIC_RELEASE);
+        recordQueueDepth((int)(capacity - freeSlots.size()));
+
+        auto unconsumed = tail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE);
+        if (unconsumed == 0)
+            return;
+
+        auto result = syscall(__NR_io_uring_enter, ringFd, unconsumed, 0u, 0u, nullptr, 0);
+        if (result >= 0 || errno == EINTR || errno == EAGAIN || errno == EBUSY)
+            return;  // Anything left over goes in with the next call
+
+        // The ring is unusable. Reads the kernel never picked up are taken back and
+        // read the slow way; the ones it did pick up still complete and are drained.
+        jassertfalse;
+        broken = true;
+        for (unsigned head = __atomic_load_n(sqHead, __ATOMIC_ACQUIRE); head != tail; ++head)
+        {
+            auto& slot = slots[(size_t)(sqes[sqArray[head & sqMask]].user_data & 0xffffffffu)];
+            slot.batch->readHere.push_back(slot.index);
+            --slot.batch->inFlight;
+            slot.batch->wakeUp.signal();
+            freeSlot(slot);
+        }
+        __atomic_store_n(sqTail, __atomic_load_n(sqHead, __ATOMIC_ACQUIRE), __ATOMIC_RELEASE);
+
+        for (; batch.nextToSubmit < batch.numRequests; ++batch.nextToSubmit)
+            batch.readHere.push_back(batch.nextToSubmit);
+    }
+
+    // Outside the lock, by the one waiting caller
+    void waitForCompletion()
+    {
+        for (;;)
+        {
+            if (__atomic_load_n(cqTail, __ATOMIC_ACQUIRE) != *cqHead)
+                return;
+
+            if (broken)
+            {
+                juce::Thread::sleep(1);  // Draining; the kernel can't be asked to wait any more
+                continue;
+            }
+
+            auto result = syscall(__NR_io_uring_enter, ringFd, 0u, 1u, IORING_ENTER_GETEVENTS, nullptr, 0);
+            if (result >= 0 || errno == EINTR)
+                continue;
+
+            jassertfalse;
+            broken = true;  // Set under the lock elsewhere; a stale read only means one more poll
+        }
+    }
+
+    // Called with ringLock held, by the waiting caller only
+    void reapCompletions()
+    {
+        unsigned head = *cqHead;
+        unsigned readyTail = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+        for (; head != readyTail; ++head)
+        {
+            const auto& cqe = cqes[head & cqMask];
+            auto slotIndex = (size_t)(cqe.user_data & 0xffffffffu);
+            if (slotIndex >= slots.size() || slots[slotIndex].batch == nullptr
+                 || slots[slotIndex].generation != (juce::uint32)(cqe.user_data >> 32))
+                continue;  // Stale
+
+            auto& slot = slots[slotIndex];
+            auto& request = slot.batch->requests[slot.index];
+            request.bytesRead = cqe.res >= 0 ? cqe.res : -1;
+            recordCompletion(request, slot.batch->submitTicks[(size_t)slot.index]);
+
+            --slot.batch->inFlight;
+            slot.batch->wakeUp.signal();
+            freeSlot(slot);
+        }
+        __atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+    }
+
+    void freeSlot(Slot& slot)
+    {
+        slot.batch = nullptr;
+        freeSlots.push_back((int)(&slot - slots.data()));
+    }
+
+    void release()
+    {
+        if (sqes != nullptr)
+            munmap(sqes, sqesSize);
+        if (cqRing != nullptr && cqRing != MAP_FAILED && cqRing != sqRing)
+            munmap(cqRing, cqRingSize);
+        if (sqRing != nullptr && sqRing != MAP_FAILED)
+            munmap(sqRing, sqRingSize);
+        if (ringFd >= 0)
+            ::close(ringFd);
+
+        sqes = nullptr;
+        sqRing = cqRing = nullptr;
+        ringFd = -1;
+    }
+
+    int ringFd = -1;
+    void* sqRing = nullptr;
+    void* cqRing = nullptr;
+    size_t sqRingSize = 0, cqRingSize = 0, sqesSize = 0;
+    unsigned* sqHead = nullptr;
+    unsigned* sqTail = nullptr;
+    unsigned* sqArray = nullptr;
+    unsigned sqMask = 0;
+    unsigned* cqHead = nullptr;
+    unsigned* cqTail = nullptr;
+    unsigned cqMask = 0;
+    unsigned capacity = 0;
+    io_uring_sqe* sqes = nullptr;
+    io_uring_cqe* cqes = nullptr;
+
+    juce::CriticalSection ringLock;
+    std::vector<Slot> slots;
+    std::vector<int> freeSlots;
+    std::vector<Batch*> waitingBatches;
+    bool waiterActive = false;
+    std::atomic<bool> broken{false};
+};
+#endif
+
+inline std::unique_ptr<SampleIOBackend> SampleIOBackend::create()
+{
+   #if SAMPLER_USE_IO_URING
+    auto ring = std::make_unique<IoUringBackend>();
+    if (ring->isValid())
+        return ring;
+   #endif
+    return std::make_unique<ThreadPoolIOBackend>();
+}
+
+// One backend per process, shared by loading and streaming in every instance
+struct SharedSampleIO
+{
+    std::unique_ptr<SampleIOBackend> backend = SampleIOBackend::create();
+    SampleIOOptions options;
+};
+
+class SampleReadAheadQueue;
+
+// Reads a sample file through the I/O backend in aligned blocks, so the same
+// buffers work with O_DIRECT. A miss fetches the whole read-ahead window in one
+// batch; streams added to a SampleReadAheadQueue also get the window refilled
+// in the background as playback moves through the file.
+class BlockFileInputStream : public juce::InputStream
+{
+public:
+    static constexpr int blockSize = 128 * 1024;
+    static constexpr int numSlots = 16;
+    static constexpr int readAheadBlocks = 8;
+
+    BlockFileInputStream(const juce::File& file, SampleIOBackend& ioBackend, const SampleIOOptions& options)
+        : handle(file, options), backend(ioBackend),
+          slotMemory((size_t)blockSize * numSlots, getSlotMemoryOptions())
+    {
+    }
+
+    ~BlockFileInputStream() override;
+
+    void enableReadAhead(SampleReadAheadQueue& queue);
+
+    // Hashes blocks as they arrive, so a decode gets the file's content hash
+    // without reading it a second time. Call before the first read.
+    void enableContentHash() { hashContent = true; }
+
+    // Finishes the hash over any bytes the decoder never asked for. 0 on a read error.
+    juce::uint64 getContentHash();
+
+    juce::int64 getTotalLength() override { return handle.isOpen() ? handle.getSize() : 0; }
+    bool isExhausted() override { return position >= getTotalLength(); }
+    juce::int64 getPosition() override { return position; }
+
+    bool setPosition(juce::int64 newPosition) override
+    {
+        position = juce::jlimit((juce::int64)0, getTotalLength(), newPosition);
+        return true;
+    }
+
+    int read(void* destBuffer, int maxBytesToRead) override
+    {
+        const juce::ScopedLock sl(lock);
+        auto* dest = static_cast<char*>(destBuffer);
+        int total = 0;
+
+        while (total < maxBytesToRead && position < getTotalLength())
+        {
+            auto block = position / blockSize;
+            auto* slot = findSlot(block);
+
+            if (slot == nullptr)
+            {
+                fetchWindow(block);
+                slot = findSlot(block);
+                if (slot == nullptr)
+                    break;  // Read error
+            }
+
+            int offsetInBlock = (int)(position - block * blockSize);
+            int toCopy = juce::jmin(slot->validBytes - offsetInBlock, maxBytesToRead - total);
+            if (toCopy <= 0)
+                break;
+
+            std::memcpy(dest + total, getSlotData(*slot) + offsetInBlock, (size_t)toCopy);
+            slot->lastUsed = ++useCounter;
+            total += toCopy;
+            position += toCopy;
+            lastBlockRead = block;
+        }
+
+        return total;
+    }
+
+    // Streaming thread: queues the blocks ahead of the read position that aren't
+    // cached. Streams with read-ahead enabled must only be read on that thread too.
+    void collectReadAhead(std::vector<SampleReadRequest>& batch)
+    {
+        const juce::ScopedLock sl(lock);
+        readAheadFirstRequest = (int)batch.size();
+        readAheadSlots.clear();
+
+        if (lastBlockRead >= 0)
+            queueWindow(lastBlockRead + 1, batch, readAheadSlots);
+    }
+
+    void completeReadAhead(const std::vector<SampleReadRequest>& batch)
+    {
+        const juce::ScopedLock sl(lock);
+        completeWindow(batch.data() + readAheadFirstRequest, readAheadSlots);
+        readAheadSlots.clear();
+    }
+
+private:
+    struct Slot
+    {
+        juce::int64 block = -1;
+        int validBytes = 0;
+        bool pending = false;
+        juce::uint64 lastUsed = 0;
+    };
+
+    static SampleMemoryOptions getSlotMemoryOptions()
+    {
+        SampleMemoryOptions options;
+        options.lockPages = false;  // Transient buffers; only decoded sample data is locked
+        return options;
+    }
+
+    char* getSlotData(const Slot& slot)
+    {
+        return static_cast<char*>(slotMemory.getData()) + (size_t)(&slot - slots.data()) * blockSize;
+    }
+
+    Slot* findSlot(juce::int64 block)
+    {
+        for (auto& slot : slots)
+            if (slot.block == block && !slot.pending)
+                return &slot;
+        return nullptr;
+    }
+
+    bool isQueuedOrCached(juce::int64 block) const
+    {
+        for (auto& slot : slots)
+            if (slot.block == block)
+                return true;
+        return false;
+    }
+
+    Slot* claimSlot()
+    {
+        Slot* oldest = nullptr;
+        for (auto& slot : slots)
+            if (!slot.pending && (oldest == nullptr || slot.lastUsed < oldest->lastUsed))
+                oldest = &slot;
+        return oldest;
+    }
+
+    void queueWindow(juce::int64 firstBlock, std::vector<SampleReadRequest>& batch, std::vector<Slot*>& queuedSlots)
+    {
+        auto numBlocks = (getTotalLength() + blockSize - 1) / blockSize;
+
+        for (auto block = firstBlock; block < juce::jmin(numBlocks, firstBlock + readAheadBlocks); ++block)
+        {
+            if (isQueuedOrCached(block))
+                continue;
+
+            auto* slot = claimSlot();
+            if (slot == nullptr)
+                break;
+
+            slot->block = block;
+            slot->pending = true;
+            slot->validBytes = 0;
+            slot->lastUsed = ++useCounter;
+            queuedSlots.push_back(slot);
+
+            SampleReadRequest request;
+            request.file = &handle;
+            request.offset = block * blockSize;
+            request.dest = getSlotData(*slot);
+            request.length = blockSize;  // Whole blocks keep O_DIRECT happy; the last one reads short
+            batch.push_back(request);
+        }
+    }
+
+    void completeWindow(const SampleReadRequest* results, const std::vector<Slot*>& queuedSlots)
+    {
+        retryBatch.clear();
+        retrySlots.clear();
+
+        for (size_t i = 0; i < queuedSlots.size(); ++i)
+        {
+            auto* slot = queuedSlots[i];
+            slot->pending = false;
+            slot->validBytes = juce::jmax(0, results[i].bytesRead);
+            if (results[i].bytesRead < 0)
+            {
+                slot->block = -1;
+            }
+            else if (slot->validBytes < getBlockLength(slot->block))
+            {
+                // Short before the end of the file, e.g. an interrupted read: try once more
+                retryBatch.push_back(results[i]);
+                retrySlots.push_back(slot);
+            }
+        }
+
+        if (!retryBatch.empty())
+        {
+            backend.readBatch(retryBatch.data(), (int)retryBatch.size());
+            for (size_t i = 0; i < retrySlots.size(); ++i)
+            {
+                auto* slot = retrySlots[i];
+                slot->validBytes = juce::jmax(0, retryBatch[i].bytesRead);
+                if (slot->validBytes < getBlockLength(slot->block))
+                {
+                    slot->block = -1;  // Still short; dropped like a failed read
+                    slot->validBytes = 0;
+                }
+            }
+        }
+
+        if (hashContent)
+            hashCompletedBlocks();
+    }
+
+    int getBlockLength(juce::int64 block)
+    {
+        return (int)juce::jlimit((juce::int64)0, (juce::int64)blockSize, getTotalLength() - block * blockSize);
+    }
+
+    void hashCompletedBlocks();
+
+    // Caller thread: a miss brings in the block and the window behind it in one batch
+    void fetchWindow(juce::int64 block)
+    {
+        missBatch.clear();
+        missSlots.clear();
+        queueWindow(block, missBatch, missSlots);
+        backend.readBatch(missBatch.data(), (int)missBatch.size());
+        completeWindow(missBatch.data(), missSlots);
+    }
+
+    SampleFileHandle handle;
+    SampleIOBackend& backend;
+    SampleMemoryRegion slotMemory;
+    std::array<Slot, numSlots> slots;
+    std::vector<Slot*> readAheadSlots, missSlots, retrySlots;
+    std::vector<SampleReadRequest> missBatch, retryBatch;
+    int readAheadFirstRequest = 0;
+    juce::int64 position = 0;
+    juce::int64 lastBlockRead = -1;
+    juce::uint64 useCounter = 0;
+    SampleReadAheadQueue* readAheadQueue = nullptr;
+    bool hashContent = false;
+    juce::int64 hashedBlocks = 0;
+    juce::uint64 contentHash = 0;
+    juce::CriticalSection lock;
+
+    JUCE_DECLARE_NON_COPYABLE(BlockFileInputStream)
+};
+
+// Gathers the read-ahead of every registered stream into a single batch, so the
+// backend sees one deep queue per streaming cycle instead of one read per stream
+class SampleReadAheadQueue
+{
+public:
+    explicit SampleReadAheadQueue(SampleIOBackend& ioBackend) : backend(ioBackend) {}
+
+    void add(BlockFileInputStream* stream)
+    {
+        const juce::ScopedLock sl(lock);
+        streams.addIfNotAlreadyThere(stream);
+    }
+
+    void remove(BlockFileInputStream* stream)
+    {
+        const juce::ScopedLock sl(lock);
+        streams.removeFirstMatchingValue(stream);
+    }
+
+    // Returns the number of reads issued
+    int service()
+    {
+        const juce::ScopedLock sl(lock);
+        batch.clear();
+
+        for (auto* stream : streams)
+            stream->collectReadAhead(batch);
+
+        if (!batch.empty())
+        {
+            backend.readBatch(batch.data(), (int)batch.size());
+            for (auto* stream : streams)
+                stream->completeReadAhead(batch);
+        }
+
+        return (int)batch.size();
+    }
+
+private:
+    SampleIOBackend& backend;
+    juce::Array<BlockFileInputStream*> streams;
+    std::vector<SampleReadRequest> batch;
+    juce::CriticalSection lock;
+};
+
+inline BlockFileInputStream::~BlockFileInputStream()
+{
+    if (readAheadQueue != nullptr)
+        readAheadQueue->remove(this);
+}
+
+inline void BlockFileInputStream::enableReadAhead(SampleReadAheadQueue& queue)
+{
+    readAheadQueue = &queue;
+    queue.add(this);
+}
+
+//==============================================================================
+// SAMPLE CONTENT HASH
+//==============================================================================
+// 64-bit hash of a file's bytes, stored alongside sample paths so a moved file
+// can be recognised by content. Not cryptographic; it only needs to tell
+// different recordings apart.
+struct SampleContentHash
+{
+    static juce::uint64 ofFile(const juce::File& file)
+    {
+        juce::FileInputStream in(file);
+        if (!in.openedOk())
+            return 0;
+
+        auto hash = begin(in.getTotalLength());
+        juce::HeapBlock<char> chunk(chunkSize);
+
+        for (;;)
+        {
+            auto bytesRead = in.read(chunk.getData(), chunkSize);
+            if (bytesRead <= 0)
+                break;
+
+            hash = update(hash, chunk.getData(), (size_t)bytesRead);
+        }
+
+        return finalise(hash);
+    }
+
+    static juce::String toString(juce::uint64 hash) { return juce::String::toHexString((juce::int64)hash).paddedLeft('0', 16); }
+    static juce::uint64 fromString(const juce::String& text) { return (juce::uint64)text.getHexValue64(); }
+
+    // Incremental form, for callers that already have the bytes in memory. Every
+    // update but the last must cover a multiple of 8 bytes.
+    static juce::uint64 begin(juce::int64 totalLength) { return seed ^ ((juce::uint64)totalLength * prime1); }
+
+    static juce::uint64 update(juce::uint64 hash, const char* data, size_t size)
+    {
+        size_t i = 0;
+        for (; i + 8 <= size; i += 8)
+        {
+            juce::uint64 word;
+            std::memcpy(&word, data + i, 8);
+            hash ^= rotateLeft(word * prime2, 31) * prime1;
+            hash = rotateLeft(hash, 27) * prime1 + prime2;
+        }
+
+        for (; i < size; ++i)
+            hash = rotateLeft(hash ^ ((juce::uint64)(juce::uint8)data[i] * prime1), 11) * prime2;
+
+        return hash;
+    }
+
+    static juce::uint64 finalise(juce::uint64 hash)
+    {
+        hash ^= hash >> 33;
+        hash *= prime2;
+        hash ^= hash >> 29;
+        hash *= prime1;
+        return hash ^ (hash >> 32);
+    }
+
+private:
+    static constexpr int chunkSize = 1 << 20;  // A multiple of 8, so chunking doesn't change the result
+    static constexpr juce::uint64 seed = 0x27d4eb2f165667c5ull;
+    static constexpr juce::uint64 prime1 = 0x9e3779b185ebca87ull;
+    static constexpr juce::uint64 prime2 = 0xc2b2ae3d27d4eb4full;
+
+    static juce::uint64 rotateLeft(juce::uint64 x, int bits) { return (x << bits) | (x >> (64 - bits)); }
+};
+
+// Blocks are hashed in file order; ones that arrive early wait in their slot
+// until the gap before them is filled. Only whole blocks are cached, so every
+// update but the last covers a multiple of 8 bytes.
+inline void BlockFileInputStream::hashCompletedBlocks()
+{
+    if (hashedBlocks == 0 && contentHash == 0)
+        contentHash = SampleContentHash::begin(getTotalLength());
+
+    while (hashedBlocks * blockSize < getTotalLength())
+    {
+        auto* slot = findSlot(hashedBlocks);
+        if (slot == nullptr || slot->validBytes != getBlockLength(hashedBlocks))
+            break;
+
+        contentHash = SampleContentHash::update(contentHash, getSlotData(*slot), (size_t)slot->validBytes);
+        ++hashedBlocks;
+    }
+}
+
+inline juce::uint64 BlockFileInputStream::getContentHash()
+{
+    const juce::ScopedLock sl(lock);
+    if (!hashContent || !handle.isOpen())
+        return 0;
+
+    hashCompletedBlocks();
+    while (hashedBlocks * blockSize < getTotalLength())
+    {
+        fetchWindow(hashedBlocks);
+        auto before = hashedBlocks;
+        hashCompletedBlocks();
+        if (hashedBlocks == before)
+            return 0;  // Read error
+    }
+
+    return SampleContentHash::finalise(contentHash);
+}
+
+//==============================================================================
+// LAZY THREAD POOL
+//==============================================================================
+// A ThreadPool that starts its threads when the first job arrives. Most instances
+// in a big template never edit, reload or switch programs, so they shouldn't each
+// keep a set of idle worker threads around.
+class LazyThreadPool
+{
+public:
+    explicit LazyThreadPool(int threadsToUse) : numThreads(threadsToUse) {}
+
+    void addJob(std::function<void()> job)
+    {
+        const juce::ScopedLock sl(lock);
+        if (pool == nullptr)
+            pool = std::make_unique<juce::ThreadPool>(numThreads);
+        pool->addJob(std::move(job));
+    }
+
+    void removeAllJobs(bool interruptRunningJobs, int timeoutMs)
+    {
+        const juce::ScopedLock sl(lock);
+        if (pool != nullptr)
+            pool->removeAllJobs(interruptRunningJobs, timeoutMs);
+    }
+
+    int getNumJobs() const
+    {
+        const juce::ScopedLock sl(lock);
+        return pool != nullptr ? pool->getNumJobs() : 0;
+    }
+
+private:
+    int numThreads;
+    juce::CriticalSection lock;
+    std::unique_ptr<juce::ThreadPool> pool;
+};
+
+//==============================================================================
+// AUDIO FORMATS
+//==============================================================================
+// One set of registered formats for the whole process. Format objects keep no
+// per-reader state, so every instance and thread can create readers from it.
+struct SharedAudioFormats
+{
+    SharedAudioFormats() { manager.registerBasicFormats(); }
+    juce::AudioFormatManager manager;
+};
+
+//==============================================================================
+// SAMPLE SERVER
+//==============================================================================
+// An optional separate process that decodes samples into POSIX shared memory, so
+// sampler instances in several host processes play the same audio without each
+// holding a copy. Instances find the server through a control segment with a
+// lock-free request queue; the server answers with the name of a read-only
+// segment holding the decoded file, which instances map and play from directly.
+// Without a running server (or on Windows) everything decodes in-process.
+//
+// Sample segments hold a SharedSampleHeader followed by each channel, 64-byte
+// aligned with zeroed padding after it, the same layout as arena audio.
+class SharedMemorySegment
+{
+public:
+    ~SharedMemorySegment()
+    {
+       #if SAMPLER_USE_SHARED_MEMORY
+        if (locked)
+            munlock(data, size);
+        munmap(data, size);
+        if (owner)
+            shm_unlink(name.toRawUTF8());
+       #endif
+    }
+
+    // Read/write, unlinked again when this object goes. Replaces any stale
+    // segment of the same name left behind by a crashed server.
+    static std::shared_ptr<SharedMemorySegment> create(const juce::String& name, size_t bytes)
+    {
+       #if SAMPLER_USE_SHARED_MEMORY
+        shm_unlink(name.toRawUTF8());
+        int fd = shm_open(name.toRawUTF8(), O_CREAT | O_EXCL | O_RDWR, 0600);
+        if (fd < 0)
+            return nullptr;
+
+        if (ftruncate(fd, (off_t)bytes) != 0)
+        {
+            close(fd);
+            shm_unlink(name.toRawUTF8());
+            return nullptr;
+        }
+        return map(fd, name, bytes, true, true);
+       #else
+        juce::ignoreUnused(name, bytes);
+        return nullptr;
+       #endif
+    }
+
+    static std::shared_ptr<SharedMemorySegment> open(const juce::String& name, bool writable)
+    {
+       #if SAMPLER_USE_SHARED_MEMORY
+        int fd = shm_open(name.toRawUTF8(), writable ? O_RDWR : O_RDONLY, 0);
+        if (fd < 0)
+            return nullptr;
+
+        struct stat info;
+        if (fstat(fd, &info) != 0 || info.st_size <= 0)
+        {
+            close(fd);
+            return nullptr;
+        }
+        return map(fd, name, (size_t)info.st_size, writable, false);
+       #else
+        juce::ignoreUnused(name, writable);
+        return nullptr;
+       #endif
+    }
+
+    // Best effort, like SampleMemoryRegion; fails quietly when RLIMIT_MEMLOCK is too low
+    void lock()
+    {
+       #if SAMPLER_USE_SHARED_MEMORY
+        if (!locked)
+            locked = mlock(data, size) == 0;
+       #endif
+    }
+
+    void* getData() const { return data; }
+    size_t getSize() const { return size; }
+
+private:
+    SharedMemorySegment() = default;
+
+   #if SAMPLER_USE_SHARED_MEMORY
+    static std::shared_ptr<SharedMemorySegment> map(int fd, const juce::String& name, size_t bytes, bool writable, bool owner)
+    {
+        void* mapped = mmap(nullptr, bytes, PROT_READ | (writable ? PROT_WRITE : 0), MAP_SHARED, fd, 0);
+        close(fd);
+
+        if (mapped == MAP_FAILED)
+        {
+            if (owner)
+                shm_unlink(name.toRawUTF8());
+            return nullptr;
+        }
+
+        std::shared_ptr<SharedMemorySegment> segment(new SharedMemorySegment());
+        segment->name = name;
+        segment->data = mapped;
+        segment->size = bytes;
+        segment->owner = owner;
+        return segment;
+    }
+   #endif
+
+    juce::String name;
+    void* data = nullptr;
+    size_t size = 0;
+    bool owner = false;
+    bool locked = false;
+
+    JUCE_DECLARE_NON_COPYABLE(SharedMemorySegment)
+};
+
+struct SharedSampleHeader
+{
+    static constexpr juce::uint32 magicValue = 0x41535341;  // "ASSA"
+    static constexpr size_t dataOffset = SampleMemoryRegion::alignment;
+
+    juce::uint32 magic = magicValue;
+    juce::uint32 numChannels = 0;
+    juce::int64 numFrames = 0;
+    double sampleRate = 44100.0;
+    juce::uint64 channelStride = 0;  // Bytes from one channel to the next
+    juce::uint64 contentHash = 0;
+};
+
+// Lives at the start of the control segment. Requests travel through a bounded
+// multi-producer queue (each slot carries a sequence number), so instances in any
+// process can post without a lock; replies land in a slot picked by request ID.
+// Reply slots are seqlocks: the version is odd while the server rewrites one.
+struct SampleServerControl
+{
+    static constexpr juce::uint32 magicValue = 0x41535356;  // "ASSV"
+    static constexpr juce::uint32 queueSize = 64;
+    static constexpr juce::uint32 numReplies = 256;
+    static constexpr int maxPathBytes = 1024;
+    static constexpr int maxNameBytes = 32;  // macOS caps shared memory names at 31 characters
+    static constexpr juce::int64 heartbeatTimeoutMs = 2000;
+
+    static_assert(std::atomic<juce::uint32>::is_always_lock_free && std::atomic<juce::int64>::is_always_lock_free,
+                  "The queue is shared between processes, so its atomics must not hide a lock");
+    static_assert(sizeof(std::atomic<juce::uint32>) == sizeof(juce::uint32), "Futexes wait on the atomic's storage");
+
+    struct Request
+    {
+        std::atomic<juce::uint32> sequence{0};
+        juce::uint32 requestId = 0;
+        char path[maxPathBytes] = {};
+    };
+
+    struct Reply
+    {
+        std::atomic<juce::uint32> version{0};
+        std::atomic<juce::uint32> requestId{0};
+        juce::int32 succeeded = 0;
+        char segmentName[maxNameBytes] = {};
+    };
+
+    SampleServerControl()
+    {
+        for (juce::uint32 i = 0; i < queueSize; ++i)
+            requests[i].sequence.store(i, std::memory_order_relaxed);
+    }
+
+    // Any process. False when the queue is full.
+    bool post(juce::uint32 requestId, const juce::String& path)
+    {
+        auto position = enqueuePosition.load(std::memory_order_relaxed);
+        for (;;)
+        {
+            auto& slot = requests[position % queueSize];
+            auto difference = (juce::int32)(slot.sequence.load(std::memory_order_acquire) - position);
+
+            if (difference == 0)
+            {
+                if (enqueuePosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+                    break;
+            }
+            else if (difference < 0)
+            {
+                return false;
+            }
+            else
+            {
+                position = enqueuePosition.load(std::memory_order_relaxed);
+            }
+        }
+
+        auto& slot = requests[position % queueSize];
+        slot.requestId = requestId;
+        path.copyToUTF8(slot.path, (size_t)maxPathBytes);
+        slot.sequence.store(position + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Server only. Decode jobs for requests numReplies apart can race for a slot,
+    // so writers take it by moving the version from even to odd.
+    void reply(juce::uint32 requestId, const juce::String& segmentName)
+    {
+        auto& slot = replies[requestId % numReplies];
+        auto version = slot.version.load(std::memory_order_relaxed);
+
+        for (;;)
+        {
+            if ((version & 1) == 0 && slot.version.compare_exchange_weak(version, version + 1, std::memory_order_acquire))
+                break;
+
+            if ((version & 1) != 0)
+            {
+                juce::Thread::yield();
+                version = slot.version.load(std::memory_order_relaxed);
+            }
+        }
+
+        slot.requestId.store(requestId, std::memory_order_relaxed);
+        slot.succeeded = segmentName.isNotEmpty() ? 1 : 0;
+        segmentName.copyToUTF8(slot.segmentName, (size_t)maxNameBytes);
+        slot.version.store(version + 2, std::memory_order_release);
+        wake(slot.version);
+    }
+
+    // Any process: sleeps until word is no longer expected, a wake, or the timeout
+    static void waitWhileEqual(std::atomic<juce::uint32>& word, juce::uint32 expected, int timeoutMs)
+    {
+       #if SAMPLER_USE_FUTEX
+        // Not FUTEX_PRIVATE: waiters in other processes share the mapping
+        timespec timeout { timeoutMs / 1000, (long)(timeoutMs % 1000) * 1000000 };
+        syscall(SYS_futex, reinterpret_cast<juce::uint32*>(&word), FUTEX_WAIT, expected, &timeout, nullptr, 0);
+       #else
+        // No cross-process wait primitive that works in shared memory everywhere
+        for (int elapsed = 0; elapsed < timeoutMs && word.load(std::memory_order_acquire) == expected; ++elapsed)
+            juce::Thread::sleep(1);
+       #endif
+    }
+
+    static void wake(std::atomic<juce::uint32>& word)
+    {
+       #if SAMPLER_USE_FUTEX
+        syscall(SYS_futex, reinterpret_cast<juce::uint32*>(&word), FUTEX_WAKE, std::numeric_limits<int>::max(), nullptr, nullptr, 0);
+       #else
+        juce::ignoreUnused(word);
+       #endif
+    }
+
+    // Server only
+    bool take(juce::uint32& requestId, juce::String& path)
+    {
+        auto position = dequeuePosition.load(std::memory_order_relaxed);
+        auto& slot = requests[position % queueSize];
+        if ((juce::int32)(slot.sequence.load(std::memory_order_acquire) - (position + 1)) < 0)
+            return false;
+
+        requestId = slot.requestId;
+        path = juce::String::fromUTF8(slot.path);
+        slot.sequence.store(position + queueSize, std::memory_order_release);
+        dequeuePosition.store(position + 1, std::memory_order_relaxed);
+        return true;
+    }
+
+    juce::uint32 magic = magicValue;
+    std::atomic<juce::int64> heartbeatMs{0};  // The server's clock, so instances can tell it is alive
+    std::atomic<juce::uint32> nextRequestId{1};
+    std::atomic<juce::uint32> enqueuePosition{0};
+    std::atomic<juce::uint32> dequeuePosition{0};
+    Request requests[queueSize];
+    Reply replies[numReplies];
+};
+
+// The server side. Runs in its own process; see the main() at the end of this file.
+// One thread takes requests and keeps the heartbeat going; files decode on a pool,
+// so a big file neither blocks other requests nor looks like a dead server.
+class SampleServer : private juce::Thread
+{
+public:
+    static constexpr const char* controlName = "/advanced-sampler-server";
+
+    SampleServer()
+        : juce::Thread("Sample Server"),
+          decodePool(juce::ThreadPoolOptions().withThreadName("Sample Server Decode")
+                                              .withNumberOfThreads(juce::jmax(1, juce::SystemStats::getNumCpus())))
+    {
+    }
+
+    ~SampleServer() override
+    {
+        stop();
+    }
+
+    // False when another live server already owns the control segment
+    bool start()
+    {
+        if (isRunning())
+            return false;
+
+        control = SharedMemorySegment::create(controlName, sizeof(SampleServerControl));
+        if (control == nullptr)
+            return false;
+
+        new (control->getData()) SampleServerControl();
+        getControl().heartbeatMs = juce::Time::currentTimeMillis();
+        return startThread(juce::Thread::Priority::normal);
+    }
+
+    void stop()
+    {
+        stopThread(5000);
+        decodePool.removeAllJobs(true, 60000);  // Decodes can't be interrupted, so let them finish
+        control.reset();
+    }
+
+    // True when a live server, in this process or another, owns the control segment
+    static bool isRunning()
+    {
+        auto segment = SharedMemorySegment::open(controlName, false);
+        if (segment == nullptr || segment->getSize() < sizeof(SampleServerControl))
+            return false;
+
+        const auto& queue = *static_cast<const SampleServerControl*>(segment->getData());
+        return queue.magic == SampleServerControl::magicValue
+            && juce::Time::currentTimeMillis() - queue.heartbeatMs.load() <= SampleServerControl::heartbeatTimeoutMs;
+    }
+
+    int getNumSegments() const { return numSegments.load(); }
+    juce::int64 getSharedBytes() const { return sharedBytes.load(); }
+
+private:
+    SampleServerControl& getControl() { return *static_cast<SampleServerControl*>(control->getData()); }
+
+    void run() override
+    {
+        auto& queue = getControl();
+        while (!threadShouldExit())
+        {
+            queue.heartbeatMs = juce::Time::currentTimeMillis();
+
+            juce::uint32 requestId = 0;
+            juce::String path;
+            if (!queue.take(requestId, path))
+            {
+                wait(1);
+                continue;
+            }
+
+            decodePool.addJob([this, requestId, path]
+            {
+                getControl().reply(requestId, serve(juce::File(path)));
+            });
+        }
+    }
+
+    // A segment being decoded, or done; later requests for it wait on decoded
+    struct Entry
+    {
+        juce::WaitableEvent decoded { true };
+        std::shared_ptr<SharedMemorySegment> segment;
+    };
+
+    // Decode pool. Requests for a file already being decoded wait for that decode.
+    // A changed file gets a new segment and the old version is unlinked; instances
+    // that still map it keep it alive until they let go.
+    juce::String serve(const juce::File& file)
+    {
+        if (!file.existsAsFile())
+            return {};
+
+        auto path = file.getFullPathName();
+        auto key = path + "|" + juce::String(file.getLastModificationTime().toMilliseconds())
+                 + "|" + juce::String(file.getSize());
+        auto name = "/as-" + juce::String::toHexString(key.hashCode64());
+
+        std::shared_ptr<Entry> entry;
+        bool decodeHere = false;
+        {
+            const juce::ScopedLock sl(segmentsLock);
+            auto& slot = segments[name];
+            if (slot == nullptr)
+            {
+                slot = std::make_shared<Entry>();
+                decodeHere = true;
+            }
+            entry = slot;
+        }
+
+        if (decodeHere)
+        {
+            auto segment = decode(file, name);
+
+            const juce::ScopedLock sl(segmentsLock);
+            entry->segment = segment;
+            entry->decoded.signal();
+            if (segment == nullptr)
+            {
+                segments.erase(name);
+                return {};
+            }
+
+            sharedBytes += (juce::int64)segment->getSize();
+            auto& latest = latestByPath[path];
+            if (latest.isNotEmpty() && latest != name)
+                release(latest);
+            latest = name;
+            numSegments = (int)segments.size();
+            return name;
+        }
+
+        entry->decoded.wait();
+        const juce::ScopedLock sl(segmentsLock);
+        return entry->segment != nullptr ? name : juce::String();
+    }
+
+    // Called with segmentsLock held
+    void release(const juce::String& name)
+    {
+        auto found = segments.find(name);
+        if (found == segments.end())
+            return;
+
+        if (auto& segment = found->second->segment)
+            sharedBytes -= (juce::int64)segment->getSize();
+        segments.erase(found);  // Unlinks the segment once no request still holds it
+    }
+
+    std::shared_ptr<SharedMemorySegment> decode(const juce::File& file, const juce::String& name)
+    {
+        std::unique_ptr<juce::AudioFormatReader> reader(formats->manager.createReaderFor(file));
+        if (reader == nullptr || reader->numChannels == 0 || reader->lengthInSamples > std::numeric_limits<int>::max())
+            return nullptr;
+
+        auto numChannels = (int)reader->numChannels;
+        auto numFrames = (int)reader->lengthInSamples;
+        auto stride = SampleArena::getChannelStride(numFrames);
+
+        auto segment = SharedMemorySegment::create(name, SharedSampleHeader::dataOffset + stride * (size_t)numChannels);
+        if (segment == nullptr)
+            return nullptr;
+
+        auto* base = static_cast<char*>(segment->getData());
+        std::vector<float*> channels;
+        for (int ch = 0; ch < numChannels; ++ch)
+            channels.push_back(reinterpret_cast<float*>(base + SharedSampleHeader::dataOffset + stride * (size_t)ch));
+
+        juce::AudioBuffer<float> audio(channels.data(), numChannels, numFrames);
+        reader->read(&audio, 0, numFrames, 0, true, true);
+        segment->lock();
+
+        // Written last; instances only ever see segments the server has replied with
+        auto* header = new (base) SharedSampleHeader();
+        header->numChannels = (juce::uint32)numChannels;
+        header->numFrames = numFrames;
+        header->sampleRate = reader->sampleRate;
+        header->channelStride = stride;
+        header->contentHash = SampleContentHash::ofFile(file);  // Once per file, here rather than in every instance
+        return segment;
+    }
+
+    std::shared_ptr<SharedMemorySegment> control;
+    juce::ThreadPool decodePool;
+    juce::CriticalSection segmentsLock;
+    std::map<juce::String, std::shared_ptr<Entry>> segments;
+    std::map<juce::String, juce::String> latestByPath;  // Path to its current segment name
+    juce::SharedResourcePointer<SharedAudioFormats> formats;
+    std::atomic<int> numSegments{0};
+    std::atomic<juce::int64> sharedBytes{0};
+};
+
+// The instance side, shared by every instance in the process. Set the environment
+// variable ADVANCED_SAMPLER_SERVER to "off" to always decode in-process.
+class SampleServerClient
+{
+public:
+    static constexpr int replyTimeoutMs = 60000;  // Big multichannel files take a while to decode
+    static constexpr int heartbeatCheckMs = 250;
+    static constexpr juce::uint32 reconnectIntervalMs = 5000;
+
+    // Points the zone's audio at the server's copy of the file. False when no server
+    // is running or it couldn't decode the file; the caller then decodes it itself.
+    bool attach(const juce::File& file, SampleData& sample)
+    {
+        auto control = getControl();
+        if (control == nullptr)
+            return false;
+
+        auto& queue = *static_cast<SampleServerControl*>(control->getData());
+        auto requestId = queue.nextRequestId.fetch_add(1);
+        if (!queue.post(requestId, file.getFullPathName()))
+            return false;
+
+        auto& reply = queue.replies[requestId % SampleServerControl::numReplies];
+        auto startTime = juce::Time::getMillisecondCounter();
+        char segmentName[SampleServerControl::maxNameBytes];
+        bool succeeded = false;
+
+        for (;;)
+        {
+            auto version = reply.version.load(std::memory_order_acquire);
+            if ((version & 1) == 0 && reply.requestId.load(std::memory_order_relaxed) == requestId)
+            {
+                succeeded = reply.succeeded != 0;
+                std::memcpy(segmentName, reply.segmentName, sizeof(segmentName));
+                segmentName[sizeof(segmentName) - 1] = 0;
+
+                // Our reply is written once, so any rewrite since means a slow reader
+                // lost the slot to a request numReplies later
+                std::atomic_thread_fence(std::memory_order_acquire);
+                if (reply.version.load(std::memory_order_relaxed) == version)
+                    break;
+                return false;
+            }
+
+            if (juce::Time::getMillisecondCounter() - startTime > (juce::uint32)replyTimeoutMs
+                 || juce::Time::currentTimeMillis() - queue.heartbeatMs.load() > SampleServerControl::heartbeatTimeoutMs)
+                return false;
+
+            // Woken by the server's reply; the timeout only bounds the heartbeat check
+            SampleServerControl::waitWhileEqual(reply.version, version, heartbeatCheckMs);
+        }
+
+        if (!succeeded)
+            return false;
+
+        auto segment = openSegment(juce::String::fromUTF8(segmentName));
+        if (segment == nullptr || segment->getSize() < SharedSampleHeader::dataOffset)
+            return false;
+
+        const auto& header = *static_cast<const SharedSampleHeader*>(segment->getData());
+        if (header.magic != SharedSampleHeader::magicValue
+             || SharedSampleHeader::dataOffset + header.channelStride * header.numChannels > segment->getSize())
+            return false;
+
+        // The mapping is read-only. Zones are never written in place (edits copy), so
+        // the const_cast only satisfies AudioBuffer.
+        auto* base = static_cast<const char*>(segment->getData()) + SharedSampleHeader::dataOffset;
+        std::vector<float*> channels;
+        for (juce::uint32 ch = 0; ch < header.numChannels; ++ch)
+            channels.push_back(const_cast<float*>(reinterpret_cast<const float*>(base + header.channelStride * ch)));
+
+        sample.audioData.setDataToReferTo(channels.data(), (int)header.numChannels, (int)header.numFrames);
+        sample.sampleRate = header.sampleRate;
+        sample.contentHash = header.contentHash;
+        sample.interleavedStereo = nullptr;
+        sample.sharedAudio = std::move(segment);
+        return true;
+    }
+
+    bool isConnected()
+    {
+        return getControl() != nullptr;
+    }
+
+private:
+    std::shared_ptr<SharedMemorySegment> getControl()
+    {
+        const juce::ScopedLock sl(lock);
+
+        if (control != nullptr)
+        {
+            auto& queue = *static_cast<SampleServerControl*>(control->getData());
+            if (juce::Time::currentTimeMillis() - queue.heartbeatMs.load() <= SampleServerControl::heartbeatTimeoutMs)
+                return control;
+            control.reset();  // Server went away; a restarted one creates a fresh segment
+        }
+
+        auto now = juce::Time::getMillisecondCounter();
+        if (!enabled || (lastConnectAttempt != 0 && now - lastConnectAttempt < reconnectIntervalMs))
+            return nullptr;
+        lastConnectAttempt = now;
+
+        auto segment = SharedMemorySegment::open(SampleServer::controlName, true);
+        if (segment == nullptr || segment->getSize() < sizeof(SampleServerControl))
+            return nullptr;
+
+        auto& queue = *static_cast<SampleServerControl*>(segment->getData());
+        if (queue.magic != SampleServerControl::magicValue
+             || juce::Time::currentTimeMillis() - queue.heartbeatMs.load() > SampleServerControl::heartbeatTimeoutMs)
+            return nullptr;
+
+        control = std::move(segment);
+        return control;
+    }
+
+    // Zones playing the same file share one mapping
+    std::shared_ptr<SharedMemorySegment> openSegment(const juce::String& name)
+    {
+        const juce::ScopedLock sl(lock);
+        if (auto existing = mappedSegments[name].lock())
+            return existing;
+
+        auto segment = SharedMemorySegment::open(name, false);
+        mappedSegments[name] = segment;
+        return segment;
+    }
+
+    juce::CriticalSection lock;
+    std::shared_ptr<SharedMemorySegment> control;
+    std::map<juce::String, std::weak_ptr<SharedMemorySegment>> mappedSegments;
+    juce::uint32 lastConnectAttempt = 0;
+    bool enabled = SAMPLER_USE_SHARED_MEMORY
+                && juce::SystemStats::getEnvironmentVariable("ADVANCED_SAMPLER_SERVER", {}) != "off";
+};
+
+//==============================================================================
+// SAMPLE ENGINE
+//==============================================================================
+class SampleEngine
+{
+public:
+    SampleEngine(juce::AudioProcessorValueTreeState& vts) : valueTreeState(vts)
+    {
+        currentArena = createArena();
+    }
+    
+    void prepareToPlay(double, int) {}
+    
+    void loadSample(const juce::File& file, int rootNote = 60)
+    {
+        SampleData newSample;
+        if (decodeSample(file, rootNote, newSample, getCurrentArena()))
+            addSample(std::move(newSample));
+    }
+
+    // Decodes a file into a zone without touching the engine, so it is safe to
+    // call from background threads that prepare whole sample sets
+    bool decodeSample(const juce::File& file, int rootNote, SampleData& newSample,
+                      const std::shared_ptr<SampleArena>& arena)
+    {
+        // A running sample server shares its decoded copy instead
+        bool served = sampleServer->attach(file, newSample);
+        
+        std::unique_ptr<juce::AudioFormatReader> reader;
+        BlockFileInputStream* stream = nullptr;
+        if (!served)
+        {
+            auto input = std::make_unique<BlockFileInputStream>(file, *io->backend, io->options);
+            input->enableContentHash();
+            stream = input.get();
+            reader.reset(formats->manager.createReaderFor(std::move(input)));
+            
+            if (reader == nullptr)
+                return false;
+        }
+        
+        newSample.arena = arena;
+        newSample.name = arena->copyText(file.getFileNameWithoutExtension());
+        newSample.filePath = arena->copyText(file.getFullPathName());  // Store full path for reloading
+        newSample.fileSize = file.getSize();
+        
+        if (served)
+        {
+            newSample.rootNote = rootNote;  // attach() took the hash from the server
+        }
+        else
+        {
+            readZoneAudio(*reader, rootNote, newSample, *arena);
+            newSample.contentHash = stream->getContentHash();
+        }
+        return true;
+    }
+
+    // Decodes FLAC audio embedded in a saved zone. The zone keeps its original path
+    // and hash, so hot reload and relocation still see the file it came from.
+    bool decodeEmbeddedSample(const juce::MemoryBlock& flacData, const juce::ValueTree& sampleState,
+                              SampleData& newSample, const std::shared_ptr<SampleArena>& arena)
+    {
+        juce::FlacAudioFormat flac;
+        std::unique_ptr<juce::AudioFormatReader> reader(flac.createReaderFor(
+            new juce::MemoryInputStream(flacData, false), true));
+        
+        if (reader == nullptr || reader->lengthInSamples <= 0)
+            return false;
+        
+        newSample.arena = arena;
+        newSample.name = arena->copyText(sampleState.getProperty("name", "").toString());
+        newSample.filePath = arena->copyText(sampleState.getProperty("filePath", "").toString());
+        newSample.contentHash = SampleContentHash::fromString(sampleState.getProperty("contentHash", "").toString());
+        newSample.fileSize = (juce::int64)sampleState.getProperty("fileSize", 0);
+        readZoneAudio(*reader, sampleState.getProperty("rootNote", 60), newSample, *arena);
+        return true;
+    }
+
+    // The layout is picked per zone at load: only stereo zones are interleaved
+    bool usesInterleavedLayout(int numChannels) const { return memoryOptions.interleaveStereo && numChannels == 2; }
+
+    // An interleaved frame pair is 8 bytes, so two frames share every 16-byte SIMD load
+    static size_t getInterleavedBytes(int numFrames)
+    {
+        return SampleArena::getChannelStride(juce::jmax(0, numFrames) * 2);
+    }
+
+    static void interleaveStereo(const juce::AudioBuffer<float>& source, float* dest)
+    {
+        const float* left = source.getReadPointer(0);
+        const float* right = source.getReadPointer(1);
+
+        for (int i = 0; i < source.getNumSamples(); ++i)
+        {
+            dest[2 * i] = left[i];
+            dest[2 * i + 1] = right[i];
+        }
+    }
+
+    void addSample(SampleData&& newSample)
+    {
+        const juce::ScopedLock zl(zoneListLock);
+        {
+            const juce::SpinLock::ScopedLockType sl(renderLock);
+            samples.push_back(std::move(newSample));
+            ++sampleSetGeneration;
+        }
+        updateSampleMemoryBytes();
+    }
+
+    // Swaps in a complete sample set and its arena; the previous ones come back
+    // through the arguments so the caller can free them off the audio thread
+    void replaceAllSamples(std::vector<SampleData>& newSamples, std::shared_ptr<SampleArena>& newArena)
+    {
+        const juce::ScopedLock zl(zoneListLock);
+        {
+            const juce::SpinLock::ScopedLockType sl(renderLock);
+            samples.swap(newSamples);
+            currentArena.swap(newArena);
+            ++sampleSetGeneration;
+        }
+        updateSampleMemoryBytes();
+    }
+
+    // A fresh arena for building a sample set away from the engine
+    std::shared_ptr<SampleArena> createArena() const { return std::make_shared<SampleArena>(memoryOptions); }
+
+    // Arena and edited-zone audio as of the last zone change. Any thread, lock-free.
+    juce::int64 getSampleMemoryBytes() const { return sampleMemoryBytes.load(std::memory_order_relaxed); }
+
+    // The arena that samples added with loadSample are allocated from
+    std::shared_ptr<SampleArena> getCurrentArena()
+    {
+        const juce::SpinLock::ScopedLockType sl(renderLock);
+        return currentArena;
+    }
+
+    static juce::ValueTree createSampleState(const SampleData& sample)
+    {
+        juce::ValueTree sampleState("Sample");
+        sampleState.setProperty("filePath", sample.filePath.toString(), nullptr);  // Save file path for reloading
+        sampleState.setProperty("name", sample.name.toString(), nullptr);
+        sampleState.setProperty("contentHash", SampleContentHash::toString(sample.contentHash), nullptr);
+        sampleState.setProperty("fileSize", sample.fileSize, nullptr);
+        sampleState.setProperty("rootNote", sample.rootNote, nullptr);
+        sampleState.setProperty("lowestNote", sample.lowestNote, nullptr);
+        sampleState.setProperty("highestNote", sample.highestNote, nullptr);
+        sampleState.setProperty("lowestVelocity", sample.lowestVelocity, nullptr);
+        sampleState.setProperty("highestVelocity", sample.highestVelocity, nullptr);
+        sampleState.setProperty("loopStart", (double)sample.loopStart, nullptr);
+        sampleState.setProperty("loopEnd", (double)sample.loopEnd, nullptr);
+        sampleState.setProperty("loopEnabled", sample.loopEnabled, nullptr);
+        sampleState.setProperty("loopMode", sample.loopMode, nullptr);
+        return sampleState;
+    }
+
+    // Restores zone settings saved by createSampleState (the audio is decoded separately)
+    static void applySampleState(const juce::ValueTree& sampleState, SampleData& sample)
+    {
+        sample.lowestNote = sampleState.getProperty("lowestNote", 0);
+        sample.highestNote = sampleState.getProperty("highestNote", 127);
+        sample.lowestVelocity = sampleState.getProperty("lowestVelocity", 1);
+        sample.highestVelocity = sampleState.getProperty("highestVelocity", 127);
+        sample.loopStart = (float)(double)sampleState.getProperty("loopStart", 0.25);
+        sample.loopEnd = (float)(double)sampleState.getProperty("loopEnd", 0.75);
+        sample.loopEnabled = sampleState.getProperty("loopEnabled", false);
+        sample.loopMode = sampleState.getProperty("loopMode", 0);
+    }
+
+    void clearSamples()
+    {
+        std::vector<SampleData> oldSamples;
+        auto oldArena = createArena();  // Becomes the old arena after the swap
+        {
+            const juce::ScopedLock zl(zoneListLock);
+            {
+                const juce::SpinLock::ScopedLockType sl(renderLock);
+                oldSamples.swap(samples);
+                oldArena.swap(currentArena);
+                ++sampleSetGeneration;
+            }
+            updateSampleMemoryBytes();
+        }
+        // The old set and its arena are freed here in one go, outside the render lock
+    }
+
+    // Audio decoded into its own region, ready to be swapped into an existing zone
+    struct DecodedAudio
+    {
+        juce::AudioBuffer<float> audio;
+        const float* interleavedStereo = nullptr;
+        std::shared_ptr<SampleMemoryRegion> memory;
+        double sampleRate = 44100.0;
+        juce::uint64 contentHash = 0;
+        juce::int64 fileSize = 0;
+    };
+
+    // Safe to call from background threads
+    bool decodeAudio(const juce::File& file, DecodedAudio& decoded)
+    {
+        auto input = std::make_unique<BlockFileInputStream>(file, *io->backend, io->options);
+        input->enableContentHash();
+        auto* stream = input.get();
+        std::unique_ptr<juce::AudioFormatReader> reader(formats->manager.createReaderFor(std::move(input)));
+
+        if (reader == nullptr || reader->lengthInSamples <= 0)
+            return false;
+
+        float* interleaved = nullptr;
+        decoded.memory = allocateSampleAudio(decoded.audio, (int)reader->numChannels, (int)reader->lengthInSamples, &interleaved);
+        reader->read(&decoded.audio, 0, (int)reader->lengthInSamples, 0, true, true);
+
+        if (interleaved != nullptr)
+            interleaveStereo(decoded.audio, interleaved);
+
+        decoded.interleavedStereo = interleaved;
+        decoded.sampleRate = reader->sampleRate;
+        decoded.contentHash = stream->getContentHash();
+        decoded.fileSize = file.getSize();
+        return true;
+    }
+
+    DecodedAudio copyAudio(const SampleData& source) const
+    {
+        DecodedAudio copy;
+        float* interleaved = nullptr;
+        copy.memory = allocateSampleAudio(copy.audio, source.audioData.getNumChannels(), source.audioData.getNumSamples(), &interleaved);
+
+        for (int ch = 0; ch < source.audioData.getNumChannels(); ++ch)
+            copy.audio.copyFrom(ch, 0, source.audioData, ch, 0, source.audioData.getNumSamples());
+
+        if (interleaved != nullptr)
+            interleaveStereo(copy.audio, interleaved);
+
+        copy.interleavedStereo = interleaved;
+        copy.sampleRate = source.sampleRate;
+        copy.contentHash = source.contentHash;
+        copy.fileSize = source.fileSize;
+        return copy;
+    }
+
+    // Replaces a zone's audio and sample rate; the old audio comes back in decoded
+    void swapSampleAudio(SampleData& sample, DecodedAudio& decoded)
+    {
+        const juce::ScopedLock zl(zoneListLock);
+        {
+            const juce::SpinLock::ScopedLockType sl(renderLock);
+            std::swap(sample.audioData, decoded.audio);
+            std::swap(sample.interleavedStereo, decoded.interleavedStereo);
+            std::swap(sample.audioMemory, decoded.memory);
+            std::swap(sample.sampleRate, decoded.sampleRate);
+            sample.contentHash = decoded.contentHash;
+            sample.fileSize = decoded.fileSize;
+        }
+        updateSampleMemoryBytes();
+    }
+
+    // Swaps new audio into an existing zone between two audio blocks. The previous
+    // buffer comes back through newAudio so the caller frees it off the audio thread.
+    void swapSampleAudio(SampleData& sample, juce::AudioBuffer<float>& newAudio, const float*& newInterleaved,
+                         std::shared_ptr<SampleMemoryRegion>& newMemory)
+    {
+        const juce::ScopedLock zl(zoneListLock);
+        {
+            const juce::SpinLock::ScopedLockType sl(renderLock);
+            std::swap(sample.audioData, newAudio);
+            std::swap(sample.interleavedStereo, newInterleaved);
+            std::swap(sample.audioMemory, newMemory);
+        }
+        updateSampleMemoryBytes();
+    }
+
+    // Points buffer at a standalone region laid out like arena audio, for edits
+    // that replace a single zone's data. When the zone gets an interleaved copy,
+    // space for it follows the channels and is returned through interleaved.
+    // A spare region that fits without wasting more than half of it is reused,
+    // which skips the map, lock and prefault of a fresh one.
+    std::shared_ptr<SampleMemoryRegion> allocateSampleAudio(juce::AudioBuffer<float>& buffer, int numChannels, int numFrames,
+                                                            float** interleaved = nullptr,
+                                                            std::shared_ptr<SampleMemoryRegion> spare = nullptr) const
+    {
+        size_t channelStride = SampleArena::getChannelStride(numFrames);
+        size_t planarBytes = channelStride * (size_t)juce::jmax(1, numChannels);
+        bool withInterleaved = interleaved != nullptr && usesInterleavedLayout(numChannels);
+        size_t bytesNeeded = planarBytes + (withInterleaved ? getInterleavedBytes(numFrames) : 0);
+
+        bool spareFits = spare != nullptr && spare.use_count() == 1
+                      && spare->getSize() >= bytesNeeded && spare->getSize() / 2 <= bytesNeeded;
+        auto region = spareFits ? std::move(spare) : std::make_shared<SampleMemoryRegion>(bytesNeeded, memoryOptions);
+        auto* base = static_cast<char*>(region->getData());
+
+        std::vector<float*> channels;
+        for (int ch = 0; ch < numChannels; ++ch)
+            channels.push_back(reinterpret_cast<float*>(base + channelStride * (size_t)ch));
+
+        buffer.setDataToReferTo(channels.data(), numChannels, numFrames);
+
+        if (interleaved != nullptr)
+            *interleaved = withInterleaved ? reinterpret_cast<float*>(base + planarBytes) : nullptr;
+
+        return region;
+    }
+
+    // Applies to arenas and edits created after the call
+    void setMemoryOptions(const SampleMemoryOptions& options) { memoryOptions = options; }
+    const SampleMemoryOptions& getMemoryOptions() const { return memoryOptions; }
+
+    // Held by the audio thread while voices read sample data
+    const juce::SpinLock& getRenderLock() const { return renderLock; }
+    
+    // Held while zones are added, removed or get new audio (all on the message thread),
+    // so other threads can read them without blocking the audio thread
+    const juce::CriticalSection& getZoneListLock() const { return zoneListLock; }
+
+    // Bumped whenever zones are added or removed, so voices can drop stale pointers
+    juce::uint32 getSampleSetGeneration() const { return sampleSetGeneration.load(); }
+    
+    SampleData* getSampleForNote(int noteNumber, int velocity)
+    {
+        for (auto& sample : samples)
+        {
+            if (noteNumber >= sample.lowestNote && noteNumber <= sample.highestNote
+                && velocity >= sample.lowestVelocity && velocity <= sample.highestVelocity)
+                return &sample;
+        }
+        return samples.empty() ? nullptr : &samples[0];
+    }
+    
+    static constexpr int maxLayers = 16;
+    
+    // The zones covering a note, softest layer first, for crossfading between them.
+    // A zone repeating a velocity range already found is skipped, as it would be by
+    // getSampleForNote. Audio thread, under the render lock.
+    int getLayersForNote(int noteNumber, std::array<SampleData*, maxLayers>& layers)
+    {
+        int numLayers = 0;
+        for (auto& sample : samples)
+        {
+            if (noteNumber < sample.lowestNote || noteNumber > sample.highestNote
+                || sample.audioData.getNumSamples() == 0 || numLayers == maxLayers)
+                continue;
+            
+            auto sameRange = [&sample](const SampleData* other)
+            {
+                return other->lowestVelocity == sample.lowestVelocity && other->highestVelocity == sample.highestVelocity;
+            };
+            if (std::any_of(layers.begin(), layers.begin() + numLayers, sameRange))
+                continue;
+            
+            int i = numLayers++;
+            for (; i > 0 && getLayerCentre(*layers[(size_t)i - 1]) > getLayerCentre(sample); --i)
+                layers[(size_t)i] = layers[(size_t)i - 1];
+            layers[(size_t)i] = &sample;
+        }
+        return numLayers;
+    }
+    
+    // Where a layer sits on the 0-1 crossfade control
+    static float getLayerCentre(const SampleData& sample)
+    {
+        return (float)(sample.lowestVelocity + sample.highestVelocity) / 254.0f;
+    }
+    
+    const std::vector<SampleData>& getAllSamples() const { return samples; }
+    std::vector<SampleData>& getAllSamples() { return samples; }
+    juce::AudioFormatManager& getFormatManager() { return formats->manager; }
+    
+private:
+    // Called with zoneListLock held, which every change to the zones or arena takes
+    void updateSampleMemoryBytes()
+    {
+        auto bytes = (juce::int64)currentArena->getBytesReserved();
+        for (const auto& sample : samples)
+            if (sample.audioMemory != nullptr)
+                bytes += (juce::int64)sample.audioMemory->getSize();
+
+        sampleMemoryBytes.store(bytes, std::memory_order_relaxed);
+    }
+
+    void readZoneAudio(juce::AudioFormatReader& reader, int rootNote, SampleData& newSample, SampleArena& arena) const
+    {
+        newSample.sampleRate = reader.sampleRate;
+        newSample.rootNote = rootNote;
+        arena.allocateAudio(newSample.audioData, (int)reader.numChannels, (int)reader.lengthInSamples);
+        
+        reader.read(&newSample.audioData, 0, (int)reader.lengthInSamples, 0, true, true);
+
+        if (usesInterleavedLayout(newSample.audioData.getNumChannels()))
+        {
+            auto* interleaved = static_cast<float*>(arena.allocate(getInterleavedBytes(newSample.audioData.getNumSamples())));
+            interleaveStereo(newSample.audioData, interleaved);
+            newSample.interleavedStereo = interleaved;
+        }
+    }
+
+    juce::AudioProcessorValueTreeState& valueTreeState;
+    std::vector<SampleData> samples;
+    std::shared_ptr<SampleArena> currentArena;
+    juce::SharedResourcePointer<SharedAudioFormats> formats;
+    juce::SharedResourcePointer<SharedSampleIO> io;
+    juce::SharedResourcePointer<SampleServerClient> sampleServer;
+    juce::SpinLock renderLock;
+    juce::CriticalSection zoneListLock;
+    std::atomic<juce::uint32> sampleSetGeneration{0};
+    std::atomic<juce::int64> sampleMemoryBytes{0};
+    SampleMemoryOptions memoryOptions;
+};
+
+//==============================================================================
+// COPY-ON-WRITE SAMPLE BUFFERS
+//==============================================================================
+struct SampleChunk
+{
+    juce::AudioBuffer<float> audio;  // Never modified once shared
+};
+
+// A sample stored as a list of spans over immutable chunks. Edits build a new
+// span list that reuses every untouched chunk, so versions only own the audio
+// they actually changed.
+class ChunkedSampleBuffer
+{
+public:
+    static constexpr int chunkFrames = 1 << 16;
+
+    static ChunkedSampleBuffer fromAudioBuffer(const juce::AudioBuffer<float>& source)
+    {
+        ChunkedSampleBuffer result;
+        result.numChannels = source.getNumChannels();
+        result.appendCopy(source, 0, source.getNumSamples());
+        return result;
+    }
+
+    int getNumChannels() const { return numChannels; }
+    int getNumFrames() const { return numFrames; }
+
+    // Gathers frames [start, start + length) into dest, starting at dest frame 0
+    void copyTo(juce::AudioBuffer<float>& dest, int start, int length) const
+    {
+        int spanStart = 0;
+        for (const auto& span : spans)
+        {
+            int from = juce::jmax(start, spanStart);
+            int to = juce::jmin(start + length, spanStart + span.length);
+
+            if (from < to)
+                for (int ch = 0; ch < numChannels; ++ch)
+                    dest.copyFrom(ch, from - start, span.chunk->audio, ch,
+                                  span.offset + (from - spanStart), to - from);
+
+            spanStart += span.length;
+            if (spanStart >= start + length)
+                break;
+        }
+    }
+
+    void flatten(juce::AudioBuffer<float>& dest) const
+    {
+        dest.setSize(numChannels, numFrames, false, false, false);
+        copyTo(dest, 0, numFrames);
+    }
+
+    ChunkedSampleBuffer withTrim(int start, int end) const
+    {
+        ChunkedSampleBuffer result;
+        result.numChannels = numChannels;
+        result.appendShared(*this, start, end);
+        return result;
+    }
+
+    ChunkedSampleBuffer withRangeReplaced(int start, int end, const juce::AudioBuffer<float>& replacement) const
+    {
+        ChunkedSampleBuffer result;
+        result.numChannels = numChannels;
+        result.appendShared(*this, 0, start);
+        result.appendCopy(replacement, 0, replacement.getNumSamples());
+        result.appendShared(*this, end, numFrames);
+        return result;
+    }
+
+    template <typename Callback>
+    void forEachChunk(Callback&& callback) const
+    {
+        for (const auto& span : spans)
+            callback(span.chunk.get());
+    }
+
+private:
+    struct Span
+    {
+        std::shared_ptr<const SampleChunk> chunk;
+        int offset = 0;
+        int length = 0;
+    };
+
+    void appendCopy(const juce::AudioBuffer<float>& source, int start, int length)
+    {
+        for (int pos = 0; pos < length; pos += chunkFrames)
+        {
+            int n = juce::jmin(chunkFrames, length - pos);
+            auto chunk = std::make_shared<SampleChunk>();
+            chunk->audio.setSize(numChannels, n);
+
+            for (int ch = 0; ch < numChannels; ++ch)
+                chunk->audio.copyFrom(ch, 0, source, ch, start + pos, n);
+
+            spans.push_back({ std::move(chunk), 0, n });
+            numFrames += n;
+        }
+    }
+
+    void appendShared(const ChunkedSampleBuffer& source, int start, int end)
+    {
+        int spanStart = 0;
+        for (const auto& span : source.spans)
+        {
+            int from = juce::jmax(start, spanStart);
+            int to = juce::jmin(end, spanStart + span.length);
+
+            if (from < to)
+            {
+                spans.push_back({ span.chunk, span.offset + (from - spanStart), to - from });
+                numFrames += to - from;
+            }
+
+            spanStart += span.length;
+        }
+    }
+
+    int numChannels = 0;
+    int numFrames = 0;
+    std::vector<Span> spans;
+};
+
+struct SampleEdit
+{
+    enum class Type { Trim, Normalise, Reverse, FadeIn, FadeOut, Gain };
+
+    Type type = Type::Normalise;
+    int startFrame = 0;
+    int endFrame = 0;
+    float gainDecibels = 0.0f;
+
+    juce::String getDescription() const
+    {
+        switch (type)
+        {
+            case Type::Trim:      return "Trim";
+            case Type::Normalise: return "Normalise";
+            case Type::Reverse:   return "Reverse";
+            case Type::FadeIn:    return "Fade In";
+            case Type::FadeOut:   return "Fade Out";
+            case Type::Gain:      return "Gain " + juce::String(gainDecibels, 1) + " dB";
+        }
+        return {};
+    }
+
+    // Only the edited range is copied out, processed and stored as new chunks
+    ChunkedSampleBuffer applyTo(const ChunkedSampleBuffer& source) const
+    {
+        int start = juce::jlimit(0, source.getNumFrames(), startFrame);
+        int end = juce::jlimit(start, source.getNumFrames(), endFrame);
+
+        if (type == Type::Trim)
+            return source.withTrim(start, end);
+
+        int length = end - start;
+        juce::AudioBuffer<float> region(source.getNumChannels(), length);
+        source.copyTo(region, start, length);
+
+        switch (type)
+        {
+            case Type::Normalise:
+            {
+                float peak = region.getMagnitude(0, length);
+                if (peak > 0.0f)
+                    region.applyGain(1.0f / peak);
+                break;
+            }
+            case Type::Reverse: region.reverse(0, length); break;
+            case Type::FadeIn:  region.applyGainRamp(0, length, 0.0f, 1.0f); break;
+            case Type::FadeOut: region.applyGainRamp(0, length, 1.0f, 0.0f); break;
+            case Type::Gain:    region.applyGain(juce::Decibels::decibelsToGain(gainDecibels)); break;
+            case Type::Trim:    break;
+        }
+
+        return source.withRangeReplaced(start, end, region);
+    }
+};
+
+//==============================================================================
+// SAMPLE EDIT HISTORY
+//==============================================================================
+class SampleEditHistory
+{
+public:
+    struct Version
+    {
+        ChunkedSampleBuffer buffer;
+        juce::String description;
+        float loopStart = 0.25f;
+        float loopEnd = 0.75f;
+    };
+
+    // The original audio is filled in by setOriginal, on the edit thread
+    SampleEditHistory(float loopStart, float loopEnd)
+    {
+        versions.push_back({ {}, "Original", loopStart, loopEnd });
+    }
+
+    void setOriginal(ChunkedSampleBuffer buffer)
+    {
+        const juce::ScopedLock sl(lock);
+        versions.front().buffer = std::move(buffer);
+    }
+
+    Version getCurrent() const
+    {
+        const juce::ScopedLock sl(lock);
+        return versions[(size_t)current];
+    }
+
+    void push(Version version)
+    {
+        const juce::ScopedLock sl(lock);
+        versions.erase(versions.begin() + current + 1, versions.end());
+        versions.push_back(std::move(version));
+
+        if ((int)versions.size() > maxVersions)
+            versions.erase(versions.begin());
+
+        current = (int)versions.size() - 1;
+    }
+
+    bool undo(Version& result)
+    {
+        const juce::ScopedLock sl(lock);
+        if (current == 0)
+            return false;
+        result = versions[(size_t)--current];
+        return true;
+    }
+
+    bool redo(Version& result)
+    {
+        const juce::ScopedLock sl(lock);
+        if (current >= (int)versions.size() - 1)
+            return false;
+        result = versions[(size_t)++current];
+        return true;
+    }
+
+    bool canUndo() const { const juce::ScopedLock sl(lock); return current > 0; }
+    bool canRedo() const { const juce::ScopedLock sl(lock); return current < (int)versions.size() - 1; }
+
+    juce::String getUndoDescription() const
+    {
+        const juce::ScopedLock sl(lock);
+        return current > 0 ? versions[(size_t)current].description : juce::String();
+    }
+
+    // Audio actually held by the history; chunks shared between versions count once
+    size_t getMemoryUsageBytes() const
+    {
+        const juce::ScopedLock sl(lock);
+        std::set<const SampleChunk*> seen;
+        size_t bytes = 0;
+
+        for (const auto& version : versions)
+            version.buffer.forEachChunk([&](const SampleChunk* chunk) {
+                if (seen.insert(chunk).second)
+                    bytes += (size_t)chunk->audio.getNumChannels() * (size_t)chunk->audio.getNumSamples() * sizeof(float);
+            });
+
+        return bytes;
+    }
+
+private:
+    static constexpr int maxVersions = 64;
+
+    juce::CriticalSection lock;
+    std::vector<Version> versions;
+    int current = 0;
+};
+
+//==============================================================================
+// SAMPLE EDIT ENGINE
+//==============================================================================
+// Runs edits, undo and redo on a worker thread. Results are swapped into the
+// engine on the message thread so the waveform display never sees a freed buffer.
+class SampleEditEngine : private juce::AsyncUpdater
+{
+public:
+    SampleEditEngine(SampleEngine& engine) : sampleEngine(engine) {}
+
+    ~SampleEditEngine() override
+    {
+        editPool.removeAllJobs(true, 5000);
+        cancelPendingUpdate();
+    }
+
+    void applyEdit(int sampleIndex, const SampleEdit& edit)
+    {
+        auto history = getHistory(sampleIndex);
+        if (history == nullptr)
+            return;
+
+        auto& sample = sampleEngine.getAllSamples()[(size_t)sampleIndex];
+        float loopStart = sample.loopStart;
+        float loopEnd = sample.loopEnd;
+
+        editPool.addJob([this, history, edit, loopStart, loopEnd]
+        {
+            auto current = history->getCurrent();
+            SampleEditHistory::Version edited { edit.applyTo(current.buffer), edit.getDescription(), loopStart, loopEnd };
+
+            if (edit.type == SampleEdit::Type::Trim)
+            {
+                // Keep the loop on the same audio after the frames before it are removed
+                float oldLength = (float)current.buffer.getNumFrames();
+                float newLength = (float)juce::jmax(1, edited.buffer.getNumFrames());
+                edited.loopStart = juce::jlimit(0.0f, 1.0f, (loopStart * oldLength - (float)edit.startFrame) / newLength);
+                edited.loopEnd = juce::jlimit(0.0f, 1.0f, (loopEnd * oldLength - (float)edit.startFrame) / newLength);
+            }
+
+            history->push(edited);
+            publish(history, edited);
+        });
+    }
+
+    void undo(int sampleIndex) { step(sampleIndex, false); }
+    void redo(int sampleIndex) { step(sampleIndex, true); }
+
+    bool canUndo(int sampleIndex) const
+    {
+        auto* history = findHistory(sampleIndex);
+        return history != nullptr && history->canUndo();
+    }
+
+    bool canRedo(int sampleIndex) const
+    {
+        auto* history = findHistory(sampleIndex);
+        return history != nullptr && history->canRedo();
+    }
+
+    bool isBusy() const { return editPool.getNumJobs() > 0; }
+
+    std::function<void()> onEditApplied;
+
+private:
+    struct Result
+    {
+        std::shared_ptr<SampleEditHistory> history;
+        juce::AudioBuffer<float> audio;
+        const float* interleavedStereo = nullptr;
+        std::shared_ptr<SampleMemoryRegion> memory;
+        float loopStart = 0.0f;
+        float loopEnd = 1.0f;
+    };
+
+    SampleEditHistory* findHistory(int sampleIndex) const
+    {
+        const auto& samples = sampleEngine.getAllSamples();
+        if (!juce::isPositiveAndBelow(sampleIndex, (int)samples.size()))
+            return nullptr;
+        return samples[(size_t)sampleIndex].editHistory.get();
+    }
+
+    // The first edit of a zone queues a copy of its audio into the history ahead
+    // of the edit itself, so the message thread never copies a whole sample
+    std::shared_ptr<SampleEditHistory> getHistory(int sampleIndex)
+    {
+        auto& samples = sampleEngine.getAllSamples();
+        if (!juce::isPositiveAndBelow(sampleIndex, (int)samples.size()))
+            return nullptr;
+
+        auto& sample = samples[(size_t)sampleIndex];
+        if (sample.editHistory == nullptr)
+        {
+            auto history = std::make_shared<SampleEditHistory>(sample.loopStart, sample.loopEnd);
+
+            // A view of the zone's audio; the owners captured with it keep it mapped
+            // even if the zone is replaced before the job runs
+            juce::AudioBuffer<float> original(sample.audioData.getArrayOfWritePointers(),
+                                              sample.audioData.getNumChannels(), sample.audioData.getNumSamples());
+            editPool.addJob([history, original, arena = sample.arena, memory = sample.audioMemory, shared = sample.sharedAudio]
+            {
+                history->setOriginal(ChunkedSampleBuffer::fromAudioBuffer(original));
+            });
+
+            sample.editHistory = history;
+        }
+
+        return sample.editHistory;
+    }
+
+    void step(int sampleIndex, bool forward)
+    {
+        auto history = getHistory(sampleIndex);
+        if (history == nullptr)
+            return;
+
+        editPool.addJob([this, history, forward]
+        {
+            SampleEditHistory::Version version;
+            if (forward ? history->redo(version) : history->undo(version))
+                publish(history, version);
+        });
+    }
+
+    // Worker thread: render the version to a flat buffer and queue it for the swap.
+    // Voices need contiguous audio, so every edit, undo and redo costs one copy of
+    // the whole zone; the region the previous swap replaced is reused for it.
+    void publish(const std::shared_ptr<SampleEditHistory>& history, const SampleEditHistory::Version& version)
+    {
+        std::shared_ptr<SampleMemoryRegion> spare;
+        {
+            const juce::ScopedLock sl(resultLock);
+            spare = std::move(spareMemory);
+        }
+
+        Result result;
+        result.history = history;
+        result.loopStart = version.loopStart;
+        result.loopEnd = version.loopEnd;
+        float* interleaved = nullptr;
+        result.memory = sampleEngine.allocateSampleAudio(result.audio, version.buffer.getNumChannels(),
+                                                         version.buffer.getNumFrames(), &interleaved, std::move(spare));
+        version.buffer.copyTo(result.audio, 0, version.buffer.getNumFrames());
+
+        if (interleaved != nullptr)
+            SampleEngine::interleaveStereo(result.audio, interleaved);
+        result.interleavedStereo = interleaved;
+
+        {
+            const juce::ScopedLock sl(resultLock);
+            pendingResults.push_back(std::move(result));
+        }
+        triggerAsyncUpdate();
+    }
+
+    void handleAsyncUpdate() override
+    {
+        std::vector<Result> ready;
+        {
+            const juce::ScopedLock sl(resultLock);
+            ready.swap(pendingResults);
+        }
+
+        for (auto& result : ready)
+        {
+            for (auto& sample : sampleEngine.getAllSamples())
+            {
+                if (sample.editHistory == result.history)
+                {
+                    sampleEngine.swapSampleAudio(sample, result.audio, result.interleavedStereo, result.memory);
+                    sample.loopStart = result.loopStart;
+                    sample.loopEnd = result.loopEnd;
+                    break;
+                }
+            }
+
+            if (result.memory != nullptr)
+            {
+                const juce::ScopedLock sl(resultLock);
+                spareMemory = std::move(result.memory);  // The next publish renders into it
+            }
+        }
+        // Other replaced buffers are released here, on the message thread
+
+        if (onEditApplied)
+            onEditApplied();
+    }
+
+    SampleEngine& sampleEngine;
+    LazyThreadPool editPool { 1 };
+    juce::CriticalSection resultLock;
+    std::vector<Result> pendingResults;
+    std::shared_ptr<SampleMemoryRegion> spareMemory;
+};
+
+//==============================================================================
+// LOOP POINT FINDER
+//==============================================================================
+struct LoopCandidate
+{
+    int startFrame = 0;
+    int endFrame = 0;
+    float correlation = 0.0f;  // Normalised cross-correlation, 1.0 = seamless
+};
+
+// Searches rising zero crossings around the current loop points on a background
+// thread and ranks every start/end pair by the normalised cross-correlation of
+// the audio surrounding the two splice points.
+class LoopPointFinder : private juce::Thread, private juce::AsyncUpdater
+{
+public:
+    LoopPointFinder() : juce::Thread("Loop Point Finder") {}
+
+    ~LoopPointFinder() override
+    {
+        stopThread(2000);
+        cancelPendingUpdate();
+    }
+
+    // Replaces any search in progress. Only the audio around the two loop points
+    // is copied, so this is cheap to call from the message thread.
+    void findLoopPoints(const SampleData& sample)
+    {
+        stopThread(2000);
+
+        int length = sample.audioData.getNumSamples();
+        if (length < 4)
+            return;
+
+        request.window = juce::jlimit(256, 4096, juce::nextPowerOfTwo((int)(sample.sampleRate * 0.02)));
+        request.loopStart = (int)(sample.loopStart * length);
+        request.loopEnd = (int)(sample.loopEnd * length);
+        request.radius = juce::jlimit((int)(sample.sampleRate * 0.005), (int)(sample.sampleRate * 0.5),
+                                      (request.loopEnd - request.loopStart) / 10);
+        request.minLoopLength = request.window;
+
+        int margin = request.radius + request.window;
+        request.startRegion = Region::mixdown(sample.audioData, request.loopStart - margin, request.loopStart + margin);
+        request.endRegion = Region::mixdown(sample.audioData, request.loopEnd - margin, request.loopEnd + margin);
+
+        startThread(juce::Thread::Priority::low);
+    }
+
+    bool isSearching() const { return isThreadRunning(); }
+
+    // Best first; only touched on the message thread
+    const std::vector<LoopCandidate>& getResults() const { return results; }
+
+    std::function<void()> onResultsReady;
+
+    static int findNearestZeroCrossing(const float* data, int length, int frame, int maxDistance)
+    {
+        for (int distance = 0; distance <= maxDistance; ++distance)
+        {
+            for (int candidate : { frame - distance, frame + distance })
+                if (candidate > 0 && candidate < length && data[candidate - 1] < 0.0f && data[candidate] >= 0.0f)
+                    return candidate;
+        }
+        return frame;
+    }
+
+    // Eight independent accumulators let the compiler keep the sum in SIMD registers
+    static float dotProduct(const float* a, const float* b, int n)
+    {
+        float lanes[8] = {};
+        int i = 0;
+
+        for (; i + 8 <= n; i += 8)
+            for (int lane = 0; lane < 8; ++lane)
+                lanes[lane] += a[i + lane] * b[i + lane];
+
+        float sum = 0.0f;
+        for (float lane : lanes)
+            sum += lane;
+        for (; i < n; ++i)
+            sum += a[i] * b[i];
+
+        return sum;
+    }
+
+private:
+    static constexpr int maxStartCandidates = 48;
+    static constexpr int maxEndCandidates = 256;
+    static constexpr int maxResults = 8;
+
+    struct Region
+    {
+        std::vector<float> mono;
+        int firstFrame = 0;
+
+        static Region mixdown(const juce::AudioBuffer<float>& audio, int start, int end)
+        {
+            Region region;
+            region.firstFrame = juce::jmax(0, start);
+            end = juce::jmin(audio.getNumSamples(), end);
+            region.mono.assign((size_t)juce::jmax(0, end - region.firstFrame), 0.0f);
+            if (region.mono.empty())
+                return region;
+
+            float gain = 1.0f / (float)juce::jmax(1, audio.getNumChannels());
+            for (int ch = 0; ch < audio.getNumChannels(); ++ch)
+                juce::FloatVectorOperations::addWithMultiply(region.mono.data(), audio.getReadPointer(ch, region.firstFrame),
+                                                             gain, (int)region.mono.size());
+            return region;
+        }
+
+        bool containsWindow(int centre, int window) const
+        {
+            int localStart = centre - window / 2 - firstFrame;
+            return localStart >= 0 && localStart + window <= (int)mono.size();
+        }
+
+        const float* windowAt(int centre, int window) const
+        {
+            return mono.data() + (centre - window / 2 - firstFrame);
+        }
+    };
+
+    struct Request
+    {
+        Region startRegion, endRegion;
+        int loopStart = 0, loopEnd = 0;
+        int radius = 0, window = 0, minLoopLength = 0;
+    };
+
+    struct Candidate
+    {
+        int frame;
+        float energy;
+    };
+
+    static std::vector<Candidate> collectCandidates(const Region& region, int centre, int radius, int window, int maxCount)
+    {
+        std::vector<int> frames;
+        const float* data = region.mono.data();
+
+        for (int frame = centre - radius; frame <= centre + radius; ++frame)
+        {
+            int local = frame - region.firstFrame;
+            if (local > 0 && local < (int)region.mono.size() && data[local - 1] < 0.0f && data[local] >= 0.0f)
+                frames.push_back(frame);
+        }
+
+        // Silence or DC offset: fall back to an even grid
+        if (frames.size() < 4)
+            for (int frame = centre - radius; frame <= centre + radius; frame += juce::jmax(1, radius / 32))
+                frames.push_back(frame);
+
+        std::sort(frames.begin(), frames.end(), [centre](int a, int b) { return std::abs(a - centre) < std::abs(b - centre); });
+
+        std::vector<Candidate> candidates;
+        for (int frame : frames)
+        {
+            if ((int)candidates.size() >= maxCount)
+                break;
+            if (!region.containsWindow(frame, window))
+                continue;
+
+            const float* w = region.windowAt(frame, window);
+            candidates.push_back({ frame, dotProduct(w, w, window) });
+        }
+        return candidates;
+    }
+
+    void run() override
+    {
+        const int window = request.window;
+        auto starts = collectCandidates(request.startRegion, request.loopStart, request.radius, window, maxStartCandidates);
+        auto ends = collectCandidates(request.endRegion, request.loopEnd, request.radius, window, maxEndCandidates);
+
+        std::vector<LoopCandidate> scored;
+        scored.reserve(starts.size() * ends.size());
+
+        for (const auto& start : starts)
+        {
+            if (threadShouldExit())
+                return;
+
+            const float* a = request.startRegion.windowAt(start.frame, window);
+
+            for (const auto& end : ends)
+            {
+                if (end.frame - start.frame < request.minLoopLength)
+                    continue;
+
+                const float* b = request.endRegion.windowAt(end.frame, window);
+                float denominator = std::sqrt(start.energy * end.energy);
+                float correlation = denominator > 1.0e-9f ? dotProduct(a, b, window) / denominator : 0.0f;
+                scored.push_back({ start.frame, end.frame, correlation });
+            }
+        }
+
+        std::sort(scored.begin(), scored.end(),
+                  [](const LoopCandidate& x, const LoopCandidate& y) { return x.correlation > y.correlation; });
+
+        // Keep the ranking diverse instead of returning near-identical neighbours
+        std::vector<LoopCandidate> ranked;
+        int minSpacing = window / 4;
+        for (const auto& candidate : scored)
+        {
+            bool isDuplicate = std::any_of(ranked.begin(), ranked.end(), [&](const LoopCandidate& other) {
+                return std::abs(other.startFrame - candidate.startFrame) < minSpacing
+                    && std::abs(other.endFrame - candidate.endFrame) < minSpacing;
+            });
+
+            if (!isDuplicate)
+                ranked.push_back(candidate);
+            if ((int)ranked.size() >= maxResults)
+                break;
+        }
+
+        {
+            const juce::ScopedLock sl(resultLock);
+            pendingResults = std::move(ranked);
+        }
+        triggerAsyncUpdate();
+    }
+
+    void handleAsyncUpdate() override
+    {
+        {
+            const juce::ScopedLock sl(resultLock);
+            results = std::move(pendingResults);
+            pendingResults.clear();
+        }
+
+        if (onResultsReady)
+            onResultsReady();
+    }
+
+    Request request;
+    juce::CriticalSection resultLock;
+    std::vector<LoopCandidate> pendingResults;
+    std::vector<LoopCandidate> results;
+};
+
+//==============================================================================
+// SAMPLE LIBRARY INDEX
+//==============================================================================
+struct LibraryEntry
+{
+    juce::String path;
+    juce::int64 fileSize = 0;
+    juce::int64 modificationTime = 0;  // Milliseconds since epoch
+    juce::uint64 contentHash = 0;
+    juce::String formatName;
+    juce::int64 lengthInSamples = 0;
+    double sampleRate = 0.0;
+    int numChannels = 0;
+    float pitchHz = 0.0f;  // 0 when no stable pitch was found
+    std::array<juce::uint8, 64> peaks {};
+    std::string searchKey;  // Lower-case file and folder name
+
+    double getLengthSeconds() const { return sampleRate > 0.0 ? (double)lengthInSamples / sampleRate : 0.0; }
+
+    int getMidiNote() const
+    {
+        return pitchHz > 0.0f ? juce::roundToInt(69.0f + 12.0f * std::log2(pitchHz / 440.0f)) : -1;
+    }
+};
+
+// Persistent metadata for every audio file under the chosen library folders.
+// Searches run against an in-memory token index, so they never touch the disk.
+// Entries are immutable once added and shared with search results.
+class SampleLibraryIndex
+{
+public:
+    static constexpr int fileVersion = 2;
+
+    using EntryPtr = std::shared_ptr<const LibraryEntry>;
+
+    juce::StringArray getRoots() const
+    {
+        const juce::ScopedReadLock sl(lock);
+        return roots;
+    }
+
+    void addRoot(const juce::File& folder)
+    {
+        const juce::ScopedWriteLock sl(lock);
+        roots.addIfNotAlreadyThere(folder.getFullPathName());
+        ++revision;
+    }
+
+    void removeRoot(const juce::String& folder)
+    {
+        const juce::ScopedWriteLock sl(lock);
+        roots.removeString(folder);
+        ++revision;
+    }
+
+    // True when the stored entry matches the file's size and modification time
+    bool isUpToDate(const juce::String& path, juce::int64 fileSize, juce::int64 modificationTime) const
+    {
+        const juce::ScopedReadLock sl(lock);
+        auto it = indexByPath.find(path.toStdString());
+        return it != indexByPath.end()
+            && entries[it->second]->fileSize == fileSize
+            && entries[it->second]->modificationTime == modificationTime;
+    }
+
+    void addOrUpdate(LibraryEntry entry)
+    {
+        entry.searchKey = makeSearchKey(entry.path);
+        auto key = entry.path.toStdString();
+        auto shared = std::make_shared<const LibraryEntry>(std::move(entry));
+
+        const juce::ScopedWriteLock sl(lock);
+        auto it = indexByPath.find(key);
+
+        if (it != indexByPath.end())
+        {
+            auto range = indexByHash.equal_range(entries[it->second]->contentHash);
+            for (auto hashIt = range.first; hashIt != range.second; ++hashIt)
+            {
+                if (hashIt->second == it->second)
+                {
+                    indexByHash.erase(hashIt);
+                    break;
+                }
+            }
+
+            // Same path, so the same search key and tokens
+            indexByHash.emplace(shared->contentHash, it->second);
+            entries[it->second] = std::move(shared);
+        }
+        else
+        {
+            auto id = entries.size();
+            indexByPath[key] = id;
+            indexByHash.emplace(shared->contentHash, id);
+            addTokens(shared->searchKey, id);
+            entries.push_back(std::move(shared));
+        }
+        ++revision;
+    }
+
+    // Drops entries for files that no longer exist under any root
+    void retainOnly(const std::unordered_set<std::string>& existingPaths)
+    {
+        const juce::ScopedWriteLock sl(lock);
+        auto removed = std::remove_if(entries.begin(), entries.end(), [&](const EntryPtr& entry) {
+            return existingPaths.count(entry->path.toStdString()) == 0;
+        });
+
+        if (removed != entries.end())
+        {
+            entries.erase(removed, entries.end());
+            rebuildIndexes();
+            ++revision;
+        }
+    }
+
+    // Every whitespace-separated term must start a word of the file or folder name.
+    // Each term is looked up as a prefix in the token index and the id lists are
+    // intersected, so the cost follows the matches rather than the library size.
+    std::vector<EntryPtr> search(const juce::String& query, int maxResults) const
+    {
+        std::vector<std::string> terms;
+        forEachToken(query.toLowerCase().toStdString(), [&](std::string term) { terms.push_back(std::move(term)); });
+
+        std::vector<EntryPtr> results;
+        const juce::ScopedReadLock sl(lock);
+
+        if (terms.empty())
+        {
+            auto numResults = juce::jmin(entries.size(), (size_t)juce::jmax(0, maxResults));
+            results.assign(entries.begin(), entries.begin() + (std::ptrdiff_t)numResults);
+            return results;
+        }
+
+        std::vector<size_t> matches;
+        for (size_t i = 0; i < terms.size(); ++i)
+        {
+            auto termMatches = findPrefix(terms[i]);
+            if (i == 0)
+            {
+                matches = std::move(termMatches);
+            }
+            else
+            {
+                std::vector<size_t> both;
+                std::set_intersection(matches.begin(), matches.end(), termMatches.begin(), termMatches.end(),
+                                      std::back_inserter(both));
+                matches = std::move(both);
+            }
+
+            if (matches.empty())
+                break;
+        }
+
+        for (auto id : matches)
+        {
+            if ((int)results.size() >= maxResults)
+                break;
+            results.push_back(entries[id]);
+        }
+        return results;
+    }
+
+    // Hash lookup for relocating moved files; size guards against collisions
+    bool findByContent(juce::uint64 contentHash, juce::int64 fileSize, LibraryEntry& result) const
+    {
+        const juce::ScopedReadLock sl(lock);
+        auto range = indexByHash.equal_range(contentHash);
+
+        for (auto it = range.first; it != range.second; ++it)
+        {
+            const auto& entry = *entries[it->second];
+            if ((fileSize == 0 || entry.fileSize == fileSize) && juce::File(entry.path).existsAsFile())
+            {
+                result = entry;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // For references saved before content hashes were recorded
+    bool findByFileName(const juce::String& fileName, LibraryEntry& result) const
+    {
+        const juce::ScopedReadLock sl(lock);
+        for (const auto& entry : entries)
+        {
+            if (juce::File(entry->path).getFileName() == fileName && juce::File(entry->path).existsAsFile())
+            {
+                result = *entry;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool findEntry(const juce::String& path, LibraryEntry& result) const
+    {
+        const juce::ScopedReadLock sl(lock);
+        auto it = indexByPath.find(path.toStdString());
+        if (it == indexByPath.end())
+            return false;
+        result = *entries[it->second];
+        return true;
+    }
+
+    int getNumEntries() const
+    {
+        const juce::ScopedReadLock sl(lock);
+        return (int)entries.size();
+    }
+
+    // Incremented on every change so views know when to refresh
+    int getRevision() const { return revision.load(); }
+
+    bool save(const juce::File& file) const
+    {
+        juce::MemoryOutputStream out;
+        {
+            const juce::ScopedReadLock sl(lock);
+            out.writeInt(fileVersion);
+            out.writeInt(roots.size());
+            for (const auto& root : roots)
+                out.writeString(root);
+
+            out.writeInt((int)entries.size());
+            for (const auto& entry : entries)
+            {
+                out.writeString(entry->path);
+                out.writeInt64(entry->fileSize);
+                out.writeInt64(entry->modificationTime);
+                out.writeInt64((juce::int64)entry->contentHash);
+                out.writeString(entry->formatName);
+                out.writeInt64(entry->lengthInSamples);
+                out.writeDouble(entry->sampleRate);
+                out.writeInt(entry->numChannels);
+                out.writeFloat(entry->pitchHz);
+                out.write(entry->peaks.data(), entry->peaks.size());
+            }
+        }
+
+        file.getParentDirectory().createDirectory();
+        return file.replaceWithData(out.getData(), out.getDataSize());
+    }
+
+    bool load(const juce::File& file)
+    {
+        juce::MemoryBlock data;
+        if (!file.loadFileAsData(data))
+            return false;
+
+        juce::MemoryInputStream in(data, false);
+        auto version = in.readInt();
+        if (version < 1 || version > fileVersion)
+            return false;
+
+        juce::StringArray loadedRoots;
+        for (int i = in.readInt(); i > 0 && !in.isExhausted(); --i)
+            loadedRoots.add(in.readString());
+
+        // Version 1 entries have no content hash. Keep the roots and drop the
+        // entries; the library rescans a rootful, empty index when it opens.
+        std::vector<EntryPtr> loaded;
+        if (version == fileVersion)
+        {
+            auto numEntries = in.readInt();
+            if (numEntries < 0 || numEntries > in.getNumBytesRemaining() / minEntryBytes)
+                return false;
+            loaded.reserve((size_t)numEntries);
+
+            for (int i = 0; i < numEntries; ++i)
+            {
+                LibraryEntry entry;
+                entry.path = in.readString();
+                entry.fileSize = in.readInt64();
+                entry.modificationTime = in.readInt64();
+                entry.contentHash = (juce::uint64)in.readInt64();
+                entry.formatName = in.readString();
+                entry.lengthInSamples = in.readInt64();
+                entry.sampleRate = in.readDouble();
+                entry.numChannels = in.readInt();
+                entry.pitchHz = in.readFloat();
+                if (in.read(entry.peaks.data(), (int)entry.peaks.size()) != (int)entry.peaks.size())
+                    return false;
+                entry.searchKey = makeSearchKey(entry.path);
+                loaded.push_back(std::make_shared<const LibraryEntry>(std::move(entry)));
+            }
+        }
+
+        const juce::ScopedWriteLock sl(lock);
+        roots = loadedRoots;
+        entries = std::move(loaded);
+        rebuildIndexes();
+        ++revision;
+        return true;
+    }
+
+private:
+    // Two empty strings, the fixed-size fields and the peaks
+    static constexpr juce::int64 minEntryBytes = 2 + 8 * 5 + 4 * 2 + (juce::int64)sizeof(LibraryEntry::peaks);
+
+    static std::string makeSearchKey(const juce::String& path)
+    {
+        juce::File file(path);
+        return (file.getParentDirectory().getFileName() + "/" + file.getFileName()).toLowerCase().toStdString();
+    }
+
+    // Words are runs of letters and digits; bytes above 0x7f count as letters so
+    // UTF-8 names stay whole
+    template <typename Callback>
+    static void forEachToken(const std::string& text, Callback&& callback)
+    {
+        size_t start = 0;
+        for (size_t i = 0; i <= text.size(); ++i)
+        {
+            auto c = i < text.size() ? (unsigned char)text[i] : (unsigned char)' ';
+            if (c >= 0x80 || std::isalnum(c))
+                continue;
+
+            if (i > start)
+                callback(text.substr(start, i - start));
+            start = i + 1;
+        }
+    }
+
+    void addTokens(const std::string& searchKey, size_t id)
+    {
+        forEachToken(searchKey, [&](const std::string& token)
+        {
+            // Ids only ever grow while adding, so each list stays sorted
+            auto& ids = entriesByToken[token];
+            if (ids.empty() || ids.back() != id)
+                ids.push_back(id);
+        });
+    }
+
+    // Sorted, unique ids of every entry with a token starting with prefix
+    std::vector<size_t> findPrefix(const std::string& prefix) const
+    {
+        std::vector<size_t> ids;
+        for (auto it = entriesByToken.lower_bound(prefix);
+             it != entriesByToken.end() && it->first.compare(0, prefix.size(), prefix) == 0; ++it)
+            ids.insert(ids.end(), it->second.begin(), it->second.end());
+
+        std::sort(ids.begin(), ids.end());
+        ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+        return ids;
+    }
+
+    void rebuildIndexes()
+    {
+        indexByPath.clear();
+        indexByHash.clear();
+        entriesByToken.clear();
+        for (size_t i = 0; i < entries.size(); ++i)
+        {
+            indexByPath[entries[i]->path.toStdString()] = i;
+            indexByHash.emplace(entries[i]->contentHash, i);
+            addTokens(entries[i]->searchKey, i);
+        }
+    }
+
+    mutable juce::ReadWriteLock lock;
+    juce::StringArray roots;
+    std::vector<EntryPtr> entries;
+    std::unordered_map<std::string, size_t> indexByPath;
+    std::unordered_multimap<juce::uint64, size_t> indexByHash;
+    std::map<std::string, std::vector<size_t>> entriesByToken;  // Sorted, for prefix lookups
+    std::atomic<int> revision{0};
+};
+
+//==============================================================================
+// SAMPLE LIBRARY SCANNER
+//==============================================================================
+// Walks the library roots on a background thread and analyses new or modified
+// files on a pool of worker threads. Unchanged files (same size and mtime) are
+// skipped, so rescans of a large library only pay for what changed.
+class SampleLibraryScanner : private juce::Thread
+{
+public:
+    static constexpr const char* audioFileWildcard = "*.wav;*.aif;*.aiff;*.flac;*.mp3;*.ogg";
+
+    SampleLibraryScanner(SampleLibraryIndex& idx, juce::AudioFormatManager& fm, const juce::File& indexFileToUse)
+        : juce::Thread("Sample Library Scanner"),
+          index(idx), formatManager(fm), indexFile(indexFileToUse),
+          analysisPool(juce::jmax(1, juce::SystemStats::getNumCpus() - 1))
+    {
+    }
+
+    ~SampleLibraryScanner() override
+    {
+        stopThread(10000);
+    }
+
+    void startScan()
+    {
+        if (!isThreadRunning())
+            startThread(juce::Thread::Priority::background);
+    }
+
+    bool isScanning() const { return isThreadRunning(); }
+    int getNumFilesFound() const { return filesFound.load(); }
+    int getNumFilesToAnalyse() const { return filesToAnalyse.load(); }
+    int getNumFilesAnalysed() const { return filesAnalysed.load(); }
+
+    // Leaves contentHash to the caller, which hashes the stream the reader used
+    static LibraryEntry analyseFile(juce::AudioFormatReader& reader, const juce::File& file)
+    {
+        LibraryEntry entry;
+        entry.path = file.getFullPathName();
+        entry.fileSize = file.getSize();
+        entry.modificationTime = file.getLastModificationTime().toMilliseconds();
+        entry.formatName = reader.getFormatName();
+        entry.lengthInSamples = reader.lengthInSamples;
+        entry.sampleRate = reader.sampleRate;
+        entry.numChannels = (int)reader.numChannels;
+
+        // Peak overview: one max-level read per bin
+        auto numBins = (juce::int64)entry.peaks.size();
+        juce::Range<float> levels[2];
+        for (juce::int64 bin = 0; bin < numBins && reader.lengthInSamples > 0; ++bin)
+        {
+            auto binStart = bin * reader.lengthInSamples / numBins;
+            auto binEnd = (bin + 1) * reader.lengthInSamples / numBins;
+            int channelsToRead = juce::jlimit(1, 2, (int)reader.numChannels);
+            reader.readMaxLevels(binStart, juce::jmax((juce::int64)1, binEnd - binStart), levels, channelsToRead);
+
+            float peak = 0.0f;
+            for (int ch = 0; ch < channelsToRead; ++ch)
+                peak = juce::jmax(peak, levels[ch].getEnd(), -levels[ch].getStart());
+            entry.peaks[(size_t)bin] = (juce::uint8)juce::jlimit(0, 255, juce::roundToInt(peak * 255.0f));
+        }
+
+        entry.pitchHz = detectPitch(reader);
+        return entry;
+    }
+
+    // Normalised autocorrelation over a short window taken after the attack.
+    // Returns 0 for unpitched material.
+    static float detectPitch(juce::AudioFormatReader& reader)
+    {
+        constexpr int windowSize = 4096;
+        if (reader.sampleRate <= 0.0 || reader.lengthInSamples < windowSize)
+            return 0.0f;
+
+        auto start = juce::jmin(reader.lengthInSamples - windowSize, (juce::int64)(reader.sampleRate * 0.1));
+        juce::AudioBuffer<float> window(1, windowSize);
+        reader.read(&window, 0, windowSize, start, true, false);
+
+        const float* x = window.getReadPointer(0);
+        float energy = LoopPointFinder::dotProduct(x, x, windowSize);
+        if (energy < 1.0e-6f)
+            return 0.0f;
+
+        int minLag = juce::jmax(2, (int)(reader.sampleRate / 2000.0));
+        int maxLag = juce::jmin(windowSize / 2, (int)(reader.sampleRate / 40.0));
+
+        // Running energies keep the search at one dot product per lag
+        std::vector<double> energyPrefix((size_t)windowSize + 1, 0.0);
+        for (int i = 0; i < windowSize; ++i)
+            energyPrefix[(size_t)i + 1] = energyPrefix[(size_t)i] + (double)x[i] * x[i];
+
+        std::vector<float> correlation((size_t)(maxLag + 2), 0.0f);
+        for (int lag = minLag; lag <= maxLag + 1; ++lag)
+        {
+            int n = windowSize - lag;
+            double e1 = energyPrefix[(size_t)n];
+            double e2 = energyPrefix[(size_t)windowSize] - energyPrefix[(size_t)lag];
+            float denominator = (float)std::sqrt(e1 * e2);
+            correlation[(size_t)lag] = denominator > 0.0f ? LoopPointFinder::dotProduct(x, x + lag, n) / denominator : 0.0f;
+        }
+
+        float best = *std::max_element(correlation.begin() + minLag, correlation.end());
+        if (best < 0.6f)
+            return 0.0f;
+
+        // First local maximum close to the best peak avoids octave errors
+        for (int lag = minLag + 1; lag <= maxLag; ++lag)
+        {
+            float c = correlation[(size_t)lag];
+            if (c >= 0.9f * best && c >= correlation[(size_t)lag - 1] && c >= correlation[(size_t)lag + 1])
+            {
+                // Parabolic interpolation around the peak
+                float left = correlation[(size_t)lag - 1], right = correlation[(size_t)lag + 1];
+                float curvature = left - 2.0f * c + right;
+                float offset = curvature != 0.0f ? 0.5f * (left - right) / curvature : 0.0f;
+                return (float)(reader.sampleRate / ((double)lag + offset));
+            }
+        }
+        return 0.0f;
+    }
+
+private:
+    void run() override
+    {
+        filesFound = 0;
+        filesToAnalyse = 0;
+        filesAnalysed = 0;
+
+        std::vector<juce::File> pending;
+        std::unordered_set<std::string> existingPaths;
+
+        for (const auto& root : index.getRoots())
+        {
+            for (const auto& entry : juce::RangedDirectoryIterator(juce::File(root), true, audioFileWildcard, juce::File::findFiles))
+            {
+                if (threadShouldExit())
+                    return;
+
+                auto path = entry.getFile().getFullPathName();
+                existingPaths.insert(path.toStdString());
+                ++filesFound;
+
+                if (!index.isUpToDate(path, entry.getFileSize(), entry.getModificationTime().toMilliseconds()))
+                    pending.push_back(entry.getFile());
+            }
+        }
+
+        index.retainOnly(existingPaths);
+        filesToAnalyse = (int)pending.size();
+
+        std::atomic<size_t> nextFile{0};
+        for (int worker = 0; worker < analysisPool.getNumThreads(); ++worker)
+        {
+            analysisPool.addJob([this, &pending, &nextFile]
+            {
+                for (size_t i = nextFile++; i < pending.size() && !threadShouldExit(); i = nextFile++)
+                {
+                    auto input = std::make_unique<BlockFileInputStream>(pending[i], *io->backend, io->options);
+                    input->enableContentHash();
+                    auto* stream = input.get();
+                    std::unique_ptr<juce::AudioFormatReader> reader(formatManager.createReaderFor(std::move(input)));
+
+                    if (reader != nullptr)
+                    {
+                        auto entry = analyseFile(*reader, pending[i]);
+                        entry.contentHash = stream->getContentHash();  // Reads only what analysis skipped
+                        index.addOrUpdate(std::move(entry));
+                    }
+                    ++filesAnalysed;
+                }
+            });
+        }
+
+        while (analysisPool.getNumJobs() > 0)
+            wait(50);
+
+        if (!threadShouldExit())
+            index.save(indexFile);
+    }
+
+    SampleLibraryIndex& index;
+    juce::AudioFormatManager& formatManager;
+    juce::File indexFile;
+    juce::SharedResourcePointer<SharedSampleIO> io;
+    juce::ThreadPool analysisPool;
+    std::atomic<int> filesFound{0}, filesToAnalyse{0}, filesAnalysed{0};
+};
+
+//==============================================================================
+// SAMPLE LIBRARY
+//==============================================================================
+// One index and scanner shared by every plugin instance in the process.
+// Created on first use, so instances that never open the browser pay nothing.
+class SampleLibrary
+{
+public:
+    SampleLibrary() : scanner(index, formats->manager, getIndexFile())
+    {
+        // An index from an older version comes back with its roots but no entries
+        if (index.load(getIndexFile()) && index.getNumEntries() == 0 && !index.getRoots().isEmpty())
+            scanner.startScan();
+    }
+
+    static juce::File getIndexFile()
+    {
+        return juce::File::getSpecialLocation(juce::File::userApplicationDataDirectory)
+            .getChildFile("AdvancedSampler").getChildFile("LibraryIndex.bin");
+    }
+
+    void addRoot(const juce::File& folder)
+    {
+        index.addRoot(folder);
+        index.save(getIndexFile());
+        scanner.startScan();
+    }
+
+    SampleLibraryIndex& getIndex() { return index; }
+    SampleLibraryScanner& getScanner() { return scanner; }
+
+private:
+    juce::SharedResourcePointer<SharedAudioFormats> formats;
+    SampleLibraryIndex index;
+    SampleLibraryScanner scanner;
+};
+
+//==============================================================================
+// SAMPLE RELOCATOR
+//==============================================================================
+// Finds sample files that are no longer at their saved path, using the library
+// index rather than searching the disk: first by content hash and size, then,
+// for references saved without a hash, by file name. Not thread-safe; each
+// thread that restores samples uses its own relocator.
+class SampleRelocator
+{
+public:
+    // The saved path when it still exists, otherwise the relocated file, or an
+    // invalid File when the sample can't be found
+    juce::File resolve(const juce::ValueTree& sampleState)
+    {
+        juce::File file(sampleState.getProperty("filePath").toString());
+        if (file.existsAsFile())
+            return file;
+
+        auto hash = SampleContentHash::fromString(sampleState.getProperty("contentHash").toString());
+        auto size = (juce::int64)sampleState.getProperty("fileSize", 0);
+        if (!library.has_value())
+            library.emplace();  // Only projects with missing files pay for loading the index
+
+        auto& index = (*library)->getIndex();
+        LibraryEntry entry;
+
+        bool found = hash != 0 ? index.findByContent(hash, size, entry)
+                               : index.findByFileName(file.getFileName(), entry);
+
+        if (!found)
+            return {};
+
+        DBG("Relocated " + file.getFullPathName() + " to " + entry.path);
+        return juce::File(entry.path);
+    }
+
+private:
+    std::optional<juce::SharedResourcePointer<SampleLibrary>> library;
+};
+
+//==============================================================================
+// SAMPLE STREAMING THREAD
+//==============================================================================
+// Background disk I/O shared by every instance in the process. Streaming readers
+// register with it and have their read-ahead buffers refilled off the audio thread.
+// Each cycle also submits the file read-ahead of every stream as one batch.
+class SampleStreamingThread : public juce::TimeSliceThread,
+                              private juce::TimeSliceClient
+{
+public:
+    SampleStreamingThread() : juce::TimeSliceThread("Sample Streaming")
+    {
+        addTimeSliceClient(this);
+        startThread(juce::Thread::Priority::high);
+    }
+
+    ~SampleStreamingThread() override
+    {
+        stopThread(2000);
+    }
+
+    // The stream must only be read on this thread once read-ahead is enabled
+    std::unique_ptr<BlockFileInputStream> createStream(const juce::File& file)
+    {
+        return std::make_unique<BlockFileInputStream>(file, *io->backend, io->options);
+    }
+
+    SampleReadAheadQueue& getReadAheadQueue() { return readAheadQueue; }
+    const SampleIOBackend& getBackend() const { return *io->backend; }
+
+private:
+    int useTimeSlice() override
+    {
+        return readAheadQueue.service() > 0 ? 1 : 10;
+    }
+
+    juce::SharedResourcePointer<SharedSampleIO> io;
+    SampleReadAheadQueue readAheadQueue { *io->backend };
+};
+
+//==============================================================================
+// PREVIEW VOICE
+//==============================================================================
+// Auditions a file straight from disk without decoding it up front. The reader is
+// created on the message thread and handed to the audio thread under a spin lock
+// that the audio thread only ever try-locks.
+class PreviewVoice
+{
+public:
+    static constexpr int readAheadSamples = 65536;
+    static constexpr double maxPitchRatio = 8.0;
+
+    void prepareToPlay(double sampleRate, int samplesPerBlock)
+    {
+        outputSampleRate = sampleRate;
+        scratch.setSize(2, (int)(samplesPerBlock * maxPitchRatio) + 4);
+    }
+
+    // Message thread
+    void play(const juce::File& file, juce::AudioFormatManager& formats, SampleStreamingThread& streamingThread)
+    {
+        std::unique_ptr<Stream> newStream;
+        auto input = streamingThread.createStream(file);
+        auto* blockStream = input.get();
+
+        if (auto* reader = formats.createReaderFor(std::move(input)))
+        {
+            // The header has been parsed here, so from now on only the streaming thread reads
+            blockStream->enableReadAhead(streamingThread.getReadAheadQueue());
+            newStream = std::make_unique<Stream>();
+            newStream->sourceSampleRate = reader->sampleRate;
+            newStream->lengthInSamples = reader->lengthInSamples;
+            newStream->numChannels = (int)juce::jmin(2u, reader->numChannels);
+            newStream->reader = std::make_unique<juce::BufferingAudioReader>(reader, streamingThread, readAheadSamples);
+            newStream->reader->setReadTimeout(0);
+        }
+
+        {
+            const juce::SpinLock::ScopedLockType sl(streamLock);
+            std::swap(stream, newStream);
+            position = 0.0;
+            fadeOutRemaining = -1;
+            playing = stream != nullptr;
+        }
+        // The previous stream is destroyed here, off the audio thread
+    }
+
+    void stop()
+    {
+        if (playing.load())
+            fadeOutRemaining = juce::jmax(1, (int)(outputSampleRate * 0.01));
+    }
+
+    bool isPlaying() const { return playing.load(); }
+    int getNumUnderruns() const { return underruns.load(); }
+
+    // Audio thread: adds the preview on top of the output
+    void renderNextBlock(juce::AudioBuffer<float>& output, int startSample, int numSamples)
+    {
+        if (!playing.load())
+            return;
+
+        const juce::SpinLock::ScopedTryLockType sl(streamLock);
+        if (!sl.isLocked() || stream == nullptr)
+            return;
+
+        double ratio = juce::jmin(maxPitchRatio, stream->sourceSampleRate / outputSampleRate);
+        auto firstFrame = (juce::int64)position;
+        int framesNeeded = juce::jmin(scratch.getNumSamples(), (int)std::ceil(numSamples * ratio) + 2);
+
+        if (!stream->reader->read(scratch.getArrayOfWritePointers(), stream->numChannels, firstFrame, framesNeeded))
+            ++underruns;  // Missing frames come back as silence
+
+        const float* left = scratch.getReadPointer(0);
+        const float* right = scratch.getReadPointer(stream->numChannels > 1 ? 1 : 0);
+        int fadeLength = juce::jmax(1, (int)(outputSampleRate * 0.01));
+
+        for (int i = 0; i < numSamples; ++i)
+        {
+            double local = position - (double)firstFrame;
+            int index = (int)local;
+            if ((juce::int64)position + 1 >= stream->lengthInSamples)
+            {
+                playing = false;
+                break;
+            }
+            if (index + 1 >= framesNeeded)
+                break;  // Host block larger than prepared for
+
+            float fraction = (float)(local - index);
+            float gain = previewGain;
+            if (fadeOutRemaining >= 0)
+            {
+                if (fadeOutRemaining == 0)
+                {
+                    playing = false;
+                    break;
+                }
+                gain *= (float)fadeOutRemaining-- / (float)fadeLength;
+            }
+
+            float l = left[index] + fraction * (left[index + 1] - left[index]);
+            float r = right[index] + fraction * (right[index + 1] - right[index]);
+
+            output.addSample(0, startSample + i, l * gain);
+            if (output.getNumChannels() > 1)
+                output.addSample(1, startSample + i, r * gain);
+
+            position += ratio;
+        }
+    }
+
+private:
+    struct Stream
+    {
+        std::unique_ptr<juce::BufferingAudioReader> reader;
+        double sourceSampleRate = 44100.0;
+        juce::int64 lengthInSamples = 0;
+        int numChannels = 1;
+    };
+
+    static constexpr float previewGain = 0.5f;
+
+    juce::SpinLock streamLock;
+    std::unique_ptr<Stream> stream;
+    juce::AudioBuffer<float> scratch;
+    double outputSampleRate = 44100.0;
+    double position = 0.0;
+    std::atomic<int> fadeOutRemaining{-1};
+    std::atomic<bool> playing{false};
+    std::atomic<int> underruns{0};
+};
+
+//==============================================================================
+// PRESET LIBRARY
+//==============================================================================
+struct PresetInfo
+{
+    juce::File file;
+    juce::String name;
+    juce::String author;
+    juce::StringArray tags;
+    juce::StringArray sampleNames;
+    std::string searchKey;  // Lower-case name, author, tags and sample names
+};
+
+// Metadata index over every preset in the user preset folder, shared by all
+// instances. The folder is indexed once in the background; saving a preset
+// updates the index directly, so searches never parse preset files.
+class PresetLibrary : private juce::Thread
+{
+public:
+    static constexpr const char* fileExtension = ".aspreset";
+
+    PresetLibrary() : juce::Thread("Preset Indexer")
+    {
+        startThread(juce::Thread::Priority::low);
+    }
+
+    ~PresetLibrary() override
+    {
+        stopThread(2000);
+    }
+
+    static juce::File getPresetFolder()
+    {
+        return juce::File::getSpecialLocation(juce::File::userApplicationDataDirectory)
+            .getChildFile("AdvancedSampler").getChildFile("Presets");
+    }
+
+    // Program numbers follow the alphabetical preset order
+    int getNumPresets() const
+    {
+        const juce::ScopedLock sl(lock);
+        return (int)presets.size();
+    }
+
+    bool getPreset(int index, PresetInfo& result) const
+    {
+        const juce::ScopedLock sl(lock);
+        if (!juce::isPositiveAndBelow(index, (int)presets.size()))
+            return false;
+        result = presets[(size_t)index];
+        return true;
+    }
+
+    int indexOf(const juce::File& file) const
+    {
+        const juce::ScopedLock sl(lock);
+        for (size_t i = 0; i < presets.size(); ++i)
+            if (presets[i].file == file)
+                return (int)i;
+        return -1;
+    }
+
+    // Returns program indices of presets matching every term of the query
+    std::vector<int> search(const juce::String& query) const
+    {
+        std::vector<std::string> terms;
+        for (const auto& term : juce::StringArray::fromTokens(query.toLowerCase(), true))
+            if (term.isNotEmpty())
+                terms.push_back(term.toStdString());
+
+        std::vector<int> matches;
+        const juce::ScopedLock sl(lock);
+        for (size_t i = 0; i < presets.size(); ++i)
+        {
+            if (std::all_of(terms.begin(), terms.end(), [&](const std::string& term) {
+                    return presets[i].searchKey.find(term) != std::string::npos; }))
+                matches.push_back((int)i);
+        }
+        return matches;
+    }
+
+    int getRevision() const { return revision.load(); }
+
+    // Offline renders wait for the folder scan, so program numbers resolve the same
+    // way on every run. False on timeout.
+    bool waitUntilIndexed(int timeoutMs) const { return waitForThreadToExit(timeoutMs); }
+
+    juce::File savePreset(juce::ValueTree state, const juce::String& name, const juce::String& author, const juce::String& tags)
+    {
+        state.setProperty("presetName", name, nullptr);
+        state.setProperty("presetAuthor", author, nullptr);
+        state.setProperty("presetTags", tags, nullptr);
+
+        auto file = getPresetFolder().getChildFile(juce::File::createLegalFileName(name) + fileExtension);
+        file.getParentDirectory().createDirectory();
+
+        std::unique_ptr<juce::XmlElement> xml(state.createXml());
+        if (xml == nullptr || !xml->writeTo(file))
+            return {};
+
+        PresetInfo info;
+        if (readPresetInfo(file, info))
+        {
+            const juce::ScopedLock sl(lock);
+            presets.erase(std::remove_if(presets.begin(), presets.end(),
+                                         [&](const PresetInfo& p) { return p.file == file; }), presets.end());
+            presets.push_back(std::move(info));
+            sortPresets();
+            ++revision;
+        }
+        return file;
+    }
+
+    static bool readPresetInfo(const juce::File& file, PresetInfo& info)
+    {
+        auto xml = juce::parseXML(file);
+        if (xml == nullptr || !xml->hasTagName("PluginState"))
+            return false;
+
+        info.file = file;
+        info.name = xml->getStringAttribute("presetName", file.getFileNameWithoutExtension());
+        info.author = xml->getStringAttribute("presetAuthor");
+        info.tags = juce::StringArray::fromTokens(xml->getStringAttribute("presetTags"), ",", "");
+        info.tags.trim();
+        info.tags.removeEmptyStrings();
+
+        if (auto* samples = xml->getChildByName("SampleData"))
+            for (auto* sample : samples->getChildIterator())
+                info.sampleNames.add(sample->getStringAttribute("name"));
+
+        info.searchKey = (info.name + " " + info.author + " " + info.tags.joinIntoString(" ") + " "
+                          + info.sampleNames.joinIntoString(" ")).toLowerCase().toStdString();
+        return true;
+    }
+
+private:
+    void run() override
+    {
+        std::vector<PresetInfo> found;
+        for (const auto& entry : juce::RangedDirectoryIterator(getPresetFolder(), true,
+                                                               juce::String("*") + fileExtension, juce::File::findFiles))
+        {
+            if (threadShouldExit())
+                return;
+
+            PresetInfo info;
+            if (readPresetInfo(entry.getFile(), info))
+                found.push_back(std::move(info));
+        }
+
+        const juce::ScopedLock sl(lock);
+        presets = std::move(found);
+        sortPresets();
+        ++revision;
+    }
+
+    void sortPresets()
+    {
+        std::sort(presets.begin(), presets.end(), [](const PresetInfo& a, const PresetInfo& b) {
+            return a.name.compareNatural(b.name) < 0;
+        });
+    }
+
+    juce::CriticalSection lock;
+    std::vector<PresetInfo> presets;
+    std::atomic<int> revision{0};
+};
+
+//==============================================================================
+// PROGRAM SWITCHER
+//==============================================================================
+// Prepares the next program (decoded samples and resolved parameter values) on
+// a background thread. Once the audio thread has faded the old program out, the
+// message thread swaps the zones, like any other zone change, frees the previous
+// set and tells the audio thread to fade back in. Non-realtime renders load and
+// swap on the render thread instead, so their output doesn't depend on timing.
+class ProgramSwitcher : private juce::AsyncUpdater
+{
+public:
+    struct PreparedProgram
+    {
+        int programIndex = -1;
+        std::vector<SampleData> samples;
+        std::shared_ptr<SampleArena> arena;
+        std::vector<std::pair<juce::RangedAudioParameter*, float>> parameterValues;
+        bool frozen = false;  // Made by PatchFreezer
+        std::optional<juce::String> script;  // Unset for presets saved before scripting
+    };
+
+    ProgramSwitcher(SampleEngine& engine, juce::AudioProcessorValueTreeState& vts)
+        : sampleEngine(engine), valueTreeState(vts)
+    {
+    }
+
+    ~ProgramSwitcher() override
+    {
+        cancelPendingUpdate();
+        loaderPool.removeAllJobs(true, 10000);
+        delete pending.exchange(nullptr);
+    }
+
+    // Message thread. A newer request supersedes one still loading.
+    void requestProgram(int programIndex, const juce::File& presetFile)
+    {
+        auto requestId = ++latestRequest;
+
+        loaderPool.addJob([this, programIndex, presetFile, requestId]
+        {
+            auto program = prepare(programIndex, presetFile, requestId);
+            if (program != nullptr && requestId == latestRequest.load())
+                delete pending.exchange(program.release());
+        });
+    }
+
+    // Non-realtime rendering: decodes the program on the calling thread, so it is
+    // ready at the same point on every run. Replaces any program still loading.
+    void loadNow(int programIndex, const juce::File& presetFile)
+    {
+        auto requestId = ++latestRequest;
+        auto program = prepare(programIndex, presetFile, requestId);
+        delete pending.exchange(program.release());
+    }
+
+    // Audio thread: MIDI program changes are forwarded to the message thread
+    void requestProgramFromMidi(int programIndex)
+    {
+        midiProgramRequest = programIndex;
+        triggerAsyncUpdate();
+    }
+
+    // False after a cancelled swap until the message thread has run again
+    bool hasReadyProgram() const { return pending.load() != nullptr && !waitingForMessageThread.load(); }
+
+    // Audio thread: the old program is silent, so the zones can be swapped
+    void requestSwap()
+    {
+        swapRequested = true;
+        triggerAsyncUpdate();
+    }
+
+    // Audio thread: true if the message thread hadn't started the swap yet. The
+    // program stays ready and is retried once the message thread responds.
+    bool cancelSwap()
+    {
+        if (!swapRequested.exchange(false))
+            return false;
+
+        waitingForMessageThread = true;
+        triggerAsyncUpdate();
+        return true;
+    }
+
+    // Audio thread: true once after each swap requested with requestSwap
+    bool takeSwapDone() { return swapDone.exchange(false); }
+
+    // Non-realtime rendering: swaps in the ready program on the calling thread
+    void swapNow() { apply(std::unique_ptr<PreparedProgram>(pending.exchange(nullptr))); }
+
+    std::function<void(int)> onMidiProgramChange;
+    std::function<void(const PreparedProgram&)> onProgramSwapped;  // Message thread, after the zones are in
+
+private:
+    std::unique_ptr<PreparedProgram> prepare(int programIndex, const juce::File& presetFile, int requestId)
+    {
+        auto xml = juce::parseXML(presetFile);
+        if (xml == nullptr)
+            return nullptr;
+
+        auto state = juce::ValueTree::fromXml(*xml);
+        auto program = std::make_unique<PreparedProgram>();
+        program->programIndex = programIndex;
+        program->arena = sampleEngine.createArena();
+        program->frozen = state.getProperty("frozen", false);
+        if (state.hasProperty("script"))
+            program->script = state["script"].toString();
+
+        for (const auto& paramState : state.getChildWithName("Parameters"))
+        {
+            if (auto* parameter = valueTreeState.getParameter(paramState.getProperty("id").toString()))
+                program->parameterValues.emplace_back(parameter,
+                    parameter->convertTo0to1((float)paramState.getProperty("value")));
+        }
+
+        for (const auto& sampleState : state.getChildWithName("SampleData"))
+        {
+            if (requestId != latestRequest.load())
+                return nullptr;  // Superseded while decoding
+
+            auto file = relocator.resolve(sampleState);
+            SampleData sample;
+            if (file.existsAsFile() && sampleEngine.decodeSample(file, sampleState.getProperty("rootNote", 60), sample, program->arena))
+            {
+                SampleEngine::applySampleState(sampleState, sample);
+                program->samples.push_back(std::move(sample));
+            }
+        }
+        return program;
+    }
+
+    void handleAsyncUpdate() override
+    {
+        waitingForMessageThread = false;
+
+        int requested = midiProgramRequest.exchange(-1);
+        if (requested >= 0 && onMidiProgramChange)
+            onMidiProgramChange(requested);
+
+        if (swapRequested.exchange(false))
+        {
+            apply(std::unique_ptr<PreparedProgram>(pending.exchange(nullptr)));
+            swapDone = true;
+        }
+    }
+
+    void apply(std::unique_ptr<PreparedProgram> program)
+    {
+        if (program == nullptr)
+            return;
+
+        sampleEngine.replaceAllSamples(program->samples, program->arena);
+
+        for (auto& [parameter, value] : program->parameterValues)
+            parameter->setValueNotifyingHost(value);
+
+        if (onProgramSwapped)
+            onProgramSwapped(*program);
+        // program now holds the previous sample set, freed here
+    }
+
+    SampleEngine& sampleEngine;
+    juce::AudioProcessorValueTreeState& valueTreeState;
+    SampleRelocator relocator;  // Only used on the loader thread
+    LazyThreadPool loaderPool { 1 };
+    std::atomic<int> latestRequest{0};
+    std::atomic<PreparedProgram*> pending{nullptr};
+    std::atomic<int> midiProgramRequest{-1};
+    std::atomic<bool> swapRequested{false};
+    std::atomic<bool> swapDone{false};
+    std::atomic<bool> waitingForMessageThread{false};
+};
+
+//==============================================================================
+// SAMPLE FILE WATCHER
+//==============================================================================
+// Notices when files behind the current zones are rewritten by another app.
+// Linux watches the containing folders with inotify, which also catches editors
+// that save through a temporary file and rename; other platforms poll the
+// modification times.
+class SampleFileWatcher : public juce::Thread
+{
+public:
+    SampleFileWatcher() : juce::Thread("Sample File Watcher") {}
+
+    ~SampleFileWatcher() override
+    {
+        stopThread(2000);
+    }
+
+    // The thread starts with the first non-empty list, so instances without samples don't run one
+    void setWatchedFiles(const juce::StringArray& paths)
+    {
+        {
+            const juce::ScopedLock sl(lock);
+            watchedFiles = paths;
+            watchListChanged = true;
+        }
+
+        if (!paths.isEmpty() && !isThreadRunning())
+            startThread(juce::Thread::Priority::low);
+    }
+
+    // Paths reported since the last call, with the time of their latest change
+    std::map<juce::String, juce::uint32> takeChanges()
+    {
+        const juce::ScopedLock sl(lock);
+        return std::exchange(changes, {});
+    }
+
+private:
+    void markChanged(const juce::String& path)
+    {
+        const juce::ScopedLock sl(lock);
+        if (watchedFiles.contains(path))
+            changes[path] = juce::Time::getMillisecondCounter();
+    }
+
+   #if JUCE_LINUX
+    void run() override
+    {
+        int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (fd < 0)
+            return;
+
+        std::map<int, juce::String> watches;  // Descriptor -> folder
+
+        while (!threadShouldExit())
+        {
+            if (watchListChanged.exchange(false))
+                updateWatches(fd, watches);
+
+            pollfd pfd { fd, POLLIN, 0 };
+            if (poll(&pfd, 1, 200) <= 0)
+                continue;
+
+            alignas(inotify_event) char buffer[4096];
+            ssize_t length;
+            while ((length = ::read(fd, buffer, sizeof(buffer))) > 0)
+            {
+                for (ssize_t offset = 0; offset < length;)
+                {
+                    auto* event = reinterpret_cast<const inotify_event*>(buffer + offset);
+                    auto folder = watches.find(event->wd);
+
+                    if (event->len > 0 && folder != watches.end())
+                        markChanged(juce::File(folder->second).getChildFile(juce::String::fromUTF8(event->name)).getFullPathName());
+
+                    offset += (ssize_t)sizeof(inotify_event) + event->len;
+                }
+            }
+        }
+
+        for (auto& watch : watches)
+            inotify_rm_watch(fd, watch.first);
+        ::close(fd);
+    }
+
+    void updateWatches(int fd, std::map<int, juce::String>& watches)
+    {
+        juce::StringArray folders;
+        {
+            const juce::ScopedLock sl(lock);
+            for (auto& path : watchedFiles)
+                folders.addIfNotAlreadyThere(juce::File(path).getParentDirectory().getFullPathName());
+        }
+
+        for (auto it = watches.begin(); it != watches.end();)
+        {
+            if (folders.contains(it->second))
+            {
+                folders.removeString(it->second);
+                ++it;
+            }
+            else
+            {
+                inotify_rm_watch(fd, it->first);
+                it = watches.erase(it);
+            }
+        }
+
+        for (auto& folder : folders)
+        {
+            int wd = inotify_add_watch(fd, folder.toRawUTF8(), IN_CLOSE_WRITE | IN_MOVED_TO);
+            if (wd >= 0)
+                watches[wd] = folder;
+        }
+    }
+   #else
+    void run() override
+    {
+        std::map<juce::String, juce::Time> lastModified;
+
+        while (!threadShouldExit())
+        {
+            juce::StringArray paths;
+            {
+                const juce::ScopedLock sl(lock);
+                paths = watchedFiles;
+                watchListChanged = false;
+            }
+
+            for (auto& path : paths)
+            {
+                auto modified = juce::File(path).getLastModificationTime();
+                auto known = lastModified.find(path);
+
+                if (known == lastModified.end())
+                    lastModified[path] = modified;
+                else if (known->second != modified)
+                {
+                    known->second = modified;
+                    markChanged(path);
+                }
+            }
+
+            wait(500);
+        }
+    }
+   #endif
+
+    juce::CriticalSection lock;
+    juce::StringArray watchedFiles;
+    std::map<juce::String, juce::uint32> changes;
+    std::atomic<bool> watchListChanged{false};
+};
+
+//==============================================================================
+// SAMPLE HOT RELOADER
+//==============================================================================
+// Re-decodes zones whose files changed on disk and swaps the new audio into just
+// those zones, leaving mapping, loop settings and every other zone untouched.
+class SampleHotReloader : private juce::Timer,
+                          private juce::AsyncUpdater
+{
+public:
+    static constexpr juce::uint32 settleTimeMs = 300;  // Let the other app finish writing
+
+    explicit SampleHotReloader(SampleEngine& engine) : sampleEngine(engine) {}
+
+    void start()
+    {
+        if (!isTimerRunning())
+            startTimer(100);
+    }
+
+    ~SampleHotReloader() override
+    {
+        reloadPool.removeAllJobs(true, 5000);
+    }
+
+private:
+    struct Result
+    {
+        juce::String path;
+        SampleEngine::DecodedAudio decoded;
+    };
+
+    void timerCallback() override
+    {
+        // Follow the instrument as zones come and go
+        auto generation = sampleEngine.getSampleSetGeneration();
+        if (generation != watchedGeneration)
+        {
+            watchedGeneration = generation;
+            juce::StringArray paths;
+            for (const auto& sample : sampleEngine.getAllSamples())
+                paths.addIfNotAlreadyThere(sample.filePath.toString());
+            watcher.setWatchedFiles(paths);
+        }
+
+        for (auto& [path, time] : watcher.takeChanges())
+            settling[path] = time;
+
+        auto now = juce::Time::getMillisecondCounter();
+        for (auto it = settling.begin(); it != settling.end();)
+        {
+            if (now - it->second < settleTimeMs)
+            {
+                ++it;
+                continue;
+            }
+
+            auto path = it->first;
+            it = settling.erase(it);
+
+            reloadPool.addJob([this, path]
+            {
+                Result result;
+                result.path = path;
+                if (!sampleEngine.decodeAudio(juce::File(path), result.decoded))
+                    return;  // Still being written, or no longer audio; the next save retries
+
+                {
+                    const juce::ScopedLock sl(resultLock);
+                    pendingResults.push_back(std::move(result));
+                }
+                triggerAsyncUpdate();
+            });
+        }
+    }
+
+    void handleAsyncUpdate() override
+    {
+        std::vector<Result> ready;
+        {
+            const juce::ScopedLock sl(resultLock);
+            ready.swap(pendingResults);
+        }
+
+        for (auto& result : ready)
+        {
+            const SampleData* reloaded = nullptr;
+            for (auto& sample : sampleEngine.getAllSamples())
+            {
+                if (sample.filePath.toString() != result.path)
+                    continue;
+
+                // Each zone owns its audio, so further zones on the same file get a copy
+                auto decoded = reloaded == nullptr ? std::move(result.decoded) : sampleEngine.copyAudio(*reloaded);
+
+                sample.editHistory.reset();  // Undo steps refer to the old audio
+                sampleEngine.swapSampleAudio(sample, decoded);
+                reloaded = &sample;
+            }
+
+            DBG("Hot reloaded " + result.path);
+        }
+    }
+
+    SampleEngine& sampleEngine;
+    SampleFileWatcher watcher;
+    juce::uint32 watchedGeneration = (juce::uint32)-1;
+    std::map<juce::String, juce::uint32> settling;
+    LazyThreadPool reloadPool { 1 };
+    juce::CriticalSection resultLock;
+    std::vector<Result> pendingResults;
+};
+
+//==============================================================================
+// EMBEDDED SAMPLE AUDIO
+//==============================================================================
+// FLAC copies of the zones' audio, saved inside the plugin state so a session
+// opens on machines that don't have the sample files. While embedding is on,
+// zones are compressed in the background and cached per audio buffer, so a save
+// only has to encode zones whose audio changed since the last pass.
+class EmbeddedAudioCache : private juce::Timer
+{
+public:
+    static constexpr int bitsPerSample = 24;
+    static constexpr int maxChannels = 8;  // FLAC limit; wider zones are saved as file references only
+
+    explicit EmbeddedAudioCache(SampleEngine& engine) : sampleEngine(engine) {}
+
+    ~EmbeddedAudioCache() override
+    {
+        encodePool.removeAllJobs(true, 10000);
+    }
+
+    // Message thread
+    void setEnabled(bool shouldEmbed)
+    {
+        enabled = shouldEmbed;
+
+        if (shouldEmbed)
+        {
+            startTimer(1000);
+            timerCallback();
+        }
+        else
+        {
+            stopTimer();
+            const juce::ScopedLock sl(lock);
+            entries.clear();  // Queued jobs keep their entry alive and finish harmlessly
+        }
+    }
+
+    bool isEnabled() const { return enabled; }
+
+    // FLAC data for a zone, empty if it can't be embedded. A zone the background
+    // pass hasn't reached yet is encoded on the calling thread instead of waiting.
+    // Audio peaking above 0 dBFS would clip in integer FLAC, so those zones are
+    // saved as file references only.
+    juce::MemoryBlock getEncoded(const SampleData& sample)
+    {
+        auto entry = findOrCreate(sample);
+        if (entry == nullptr)
+            return {};
+
+        encodeIfUnclaimed(*entry);
+        entry->done.wait();
+        return entry->flac;
+    }
+
+    // Runs decodeZone for every index on a temporary pool, with the calling thread
+    // taking zones too, and returns once all of them are done
+    static void decodeInParallel(int numZones, const std::function<void(int)>& decodeZone)
+    {
+        int numThreads = juce::jmin(numZones, juce::SystemStats::getNumCpus());
+        std::atomic<int> nextZone{0};
+        auto work = [&]
+        {
+            for (int i = nextZone++; i < numZones; i = nextZone++)
+                decodeZone(i);
+        };
+
+        if (numThreads <= 1)
+        {
+            work();
+            return;
+        }
+
+        std::atomic<int> workersLeft{numThreads - 1};
+        juce::WaitableEvent finished;
+        juce::ThreadPool pool(numThreads - 1);
+
+        for (int t = 1; t < numThreads; ++t)
+        {
+            pool.addJob([&]
+            {
+                work();
+                if (--workersLeft == 0)
+                    finished.signal();
+            });
+        }
+
+        work();
+        finished.wait();
+    }
+
+private:
+    struct Entry
+    {
+        std::vector<const float*> channels;
+        int numSamples = 0;
+        double sampleRate = 44100.0;
+        std::shared_ptr<void> keepAlive;  // The audio's owner, so its address can't be reused while cached
+        std::atomic<bool> claimed{false};
+        juce::WaitableEvent done { true };
+        juce::MemoryBlock flac;
+    };
+
+    static bool matches(const Entry& entry, const SampleData& sample)
+    {
+        return sample.audioData.getNumChannels() == (int)entry.channels.size()
+            && sample.audioData.getNumSamples() == entry.numSamples
+            && sample.audioData.getReadPointer(0) == entry.channels[0]
+            && sample.sampleRate == entry.sampleRate;
+    }
+
+    std::shared_ptr<Entry> findOrCreate(const SampleData& sample)
+    {
+        int numChannels = sample.audioData.getNumChannels();
+        if (numChannels == 0 || numChannels > maxChannels || sample.audioData.getNumSamples() == 0)
+            return nullptr;
+
+        const juce::ScopedLock sl(lock);
+        for (auto& entry : entries)
+            if (matches(*entry, sample))
+                return entry;
+
+        auto entry = std::make_shared<Entry>();
+        for (int ch = 0; ch < numChannels; ++ch)
+            entry->channels.push_back(sample.audioData.getReadPointer(ch));
+
+        entry->numSamples = sample.audioData.getNumSamples();
+        entry->sampleRate = sample.sampleRate;
+        entry->keepAlive = sample.sharedAudio != nullptr ? std::shared_ptr<void>(sample.sharedAudio)
+                         : sample.audioMemory != nullptr ? std::shared_ptr<void>(sample.audioMemory)
+                                                         : std::shared_ptr<void>(sample.arena);
+        entries.push_back(entry);
+        encodePool.addJob([entry] { encodeIfUnclaimed(*entry); });
+        return entry;
+    }
+
+    // Whichever thread gets to an entry first encodes it; the other one skips or waits
+    static void encodeIfUnclaimed(Entry& entry)
+    {
+        if (entry.claimed.exchange(true))
+            return;
+
+        if (exceedsFullScale(entry))
+        {
+            entry.done.signal();
+            return;
+        }
+
+        juce::FlacAudioFormat flac;
+        auto* stream = new juce::MemoryOutputStream(entry.flac, false);
+        std::unique_ptr<juce::AudioFormatWriter> writer(flac.createWriterFor(stream, entry.sampleRate,
+                                                                             (unsigned int)entry.channels.size(),
+                                                                             bitsPerSample, {}, 5));
+        bool written = false;
+        if (writer == nullptr)
+            delete stream;  // Not taken over by a writer that failed to open
+        else
+            written = writer->writeFromFloatArrays(entry.channels.data(), (int)entry.channels.size(), entry.numSamples);
+
+        writer.reset();  // Flushes the last frames and the stream info block
+        if (!written)
+            entry.flac.reset();
+
+        entry.done.signal();
+    }
+
+    static bool exceedsFullScale(const Entry& entry)
+    {
+        for (auto* channel : entry.channels)
+        {
+            auto range = juce::FloatVectorOperations::findMinAndMax(channel, entry.numSamples);
+            if (range.getStart() < -1.0f || range.getEnd() > 1.0f)
+                return true;
+        }
+        return false;
+    }
+
+    void timerCallback() override
+    {
+        // Queue encodes for new audio, and let go of audio no zone refers to any more
+        const auto& samples = sampleEngine.getAllSamples();
+        for (const auto& sample : samples)
+            findOrCreate(sample);
+
+        const juce::ScopedLock sl(lock);
+        entries.erase(std::remove_if(entries.begin(), entries.end(), [&samples](const auto& entry)
+        {
+            return std::none_of(samples.begin(), samples.end(), [&entry](const SampleData& sample)
+            {
+                return matches(*entry, sample);
+            });
+        }), entries.end());
+    }
+
+    SampleEngine& sampleEngine;
+    std::atomic<bool> enabled{false};
+    juce::CriticalSection lock;
+    std::vector<std::shared_ptr<Entry>> entries;
+    LazyThreadPool encodePool { 1 };
+};
+
+//==============================================================================
+// OUTPUT METER
+//==============================================================================
+// Peak, RMS and 4x oversampled true-peak for every output channel, measured at
+// the end of processBlock. The audio thread only publishes through atomics; the
+// editor takes the peaks since its last look and applies hold and decay itself.
+class OutputMeter
+{
+public:
+    static constexpr int maxChannels = 16;  // Third-order ambisonics
+    static constexpr int oversampling = 4;
+    static constexpr int tapsPerPhase = 12;  // 48 taps, the same length as the ITU-R BS.1770 filter
+    static constexpr double rmsTimeSeconds = 0.3;
+
+    OutputMeter() { designInterpolator(); }
+
+    void prepare(double sampleRate)
+    {
+        rmsTimeSamples = (float)(rmsTimeSeconds * sampleRate);
+        for (auto& channel : channels)
+        {
+            std::fill(std::begin(channel.window), std::end(channel.window), 0.0f);
+            channel.meanSquare = 0.0f;
+            channel.peak = 0.0f;
+            channel.truePeak = 0.0f;
+            channel.rms = 0.0f;
+        }
+    }
+
+    void setTruePeakEnabled(bool shouldMeasure) { truePeakEnabled = shouldMeasure; }
+    bool isTruePeakEnabled() const { return truePeakEnabled.load(); }
+
+    // Audio thread
+    void process(const juce::AudioBuffer<float>& buffer)
+    {
+        int numChannels = juce::jmin(buffer.getNumChannels(), maxChannels);
+        int numSamples = buffer.getNumSamples();
+        if (numSamples == 0)
+            return;
+
+        float smoothing = 1.0f - std::exp(-(float)numSamples / rmsTimeSamples);
+        bool measureTruePeak = truePeakEnabled.load(std::memory_order_relaxed);
+
+        for (int ch = 0; ch < numChannels; ++ch)
+        {
+            auto& channel = channels[(size_t)ch];
+            const float* data = buffer.getReadPointer(ch);
+
+            float peak = 0.0f, sumSquares = 0.0f;
+            measure(data, numSamples, peak, sumSquares);
+
+            channel.meanSquare += (sumSquares / (float)numSamples - channel.meanSquare) * smoothing;
+            channel.rms.store(std::sqrt(channel.meanSquare), std::memory_order_relaxed);
+            storeMax(channel.peak, peak);
+
+            if (measureTruePeak)
+                storeMax(channel.truePeak, juce::jmax(peak, interpolatePeak(channel, data, numSamples)));
+        }
+
+        numActiveChannels.store(numChannels, std::memory_order_relaxed);
+    }
+
+    // Message thread: the highest levels since the previous call
+    float takePeak(int channel) { return channels[(size_t)channel].peak.exchange(0.0f); }
+    float takeTruePeak(int channel) { return channels[(size_t)channel].truePeak.exchange(0.0f); }
+    float getRMS(int channel) const { return channels[(size_t)channel].rms.load(std::memory_order_relaxed); }
+    int getNumChannels() const { return numActiveChannels.load(std::memory_order_relaxed); }
+
+private:
+    using SIMD = juce::dsp::SIMDRegister<float>;
+
+    // Phases share a register, padded with silent lanes to whole registers
+    static constexpr int numPhaseGroups = (oversampling + (int)SIMD::size() - 1) / (int)SIMD::size();
+    static constexpr int chunkSize = 64;
+
+    struct Channel
+    {
+        // The last tapsPerPhase - 1 samples followed by the chunk being filtered,
+        // so every filter window is contiguous
+        float window[tapsPerPhase - 1 + chunkSize] = {};
+        float meanSquare = 0.0f;
+        std::atomic<float> peak{0.0f};
+        std::atomic<float> truePeak{0.0f};
+        std::atomic<float> rms{0.0f};
+    };
+
+    // Largest magnitude and sum of squares in one vectorised pass
+    static void measure(const float* data, int numSamples, float& peak, float& sumSquares)
+    {
+        using SIMD = juce::dsp::SIMDRegister<float>;
+
+        const float* aligned = SIMD::getNextSIMDAlignedPtr(const_cast<float*>(data));
+        int head = juce::jmin(numSamples, (int)(aligned - data));
+        int numVectors = (numSamples - head) / (int)SIMD::size();
+        int tail = head + numVectors * (int)SIMD::size();
+
+        for (int i = 0; i < head; ++i)
+        {
+            peak = juce::jmax(peak, std::abs(data[i]));
+            sumSquares += data[i] * data[i];
+        }
+
+        auto vectorPeak = SIMD::expand(0.0f);
+        auto vectorSquares = SIMD::expand(0.0f);
+        for (int v = 0; v < numVectors; ++v)
+        {
+            auto x = SIMD::fromRawArray(aligned + v * (int)SIMD::size());
+            vectorPeak = SIMD::max(vectorPeak, SIMD::abs(x));
+            vectorSquares += x * x;
+        }
+
+        for (size_t i = 0; i < SIMD::size(); ++i)
+            peak = juce::jmax(peak, vectorPeak.get(i));
+        sumSquares += vectorSquares.sum();
+
+        for (int i = tail; i < numSamples; ++i)
+        {
+            peak = juce::jmax(peak, std::abs(data[i]));
+            sumSquares += data[i] * data[i];
+        }
+    }
+
+    // Largest magnitude of the 4x upsampled signal, through a polyphase FIR. All
+    // phases are computed together: each tap is one broadcast multiply-add.
+    float interpolatePeak(Channel& channel, const float* data, int numSamples) const
+    {
+        auto vectorPeak = SIMD::expand(0.0f);
+
+        for (int start = 0; start < numSamples; start += chunkSize)
+        {
+            int numInChunk = juce::jmin(chunkSize, numSamples - start);
+            std::copy(data + start, data + start + numInChunk, channel.window + tapsPerPhase - 1);
+
+            for (int i = 0; i < numInChunk; ++i)
+            {
+                const float* x = channel.window + i;  // Oldest first
+
+                for (int group = 0; group < numPhaseGroups; ++group)
+                {
+                    auto sum = SIMD::expand(0.0f);
+                    for (int k = 0; k < tapsPerPhase; ++k)
+                        sum += coefficients[group][k] * x[k];
+                    vectorPeak = SIMD::max(vectorPeak, SIMD::abs(sum));
+                }
+            }
+
+            std::copy(channel.window + numInChunk, channel.window + numInChunk + tapsPerPhase - 1, channel.window);
+        }
+
+        float peak = 0.0f;
+        for (size_t i = 0; i < SIMD::size(); ++i)
+            peak = juce::jmax(peak, vectorPeak.get(i));
+        return peak;
+    }
+
+    // Blackman-windowed sinc at the original Nyquist, split into phases with unity DC gain.
+    // Not the BS.1770 coefficient table, so readings can differ slightly from a
+    // BS.1770 meter on content near Nyquist.
+    void designInterpolator()
+    {
+        constexpr int numTaps = tapsPerPhase * oversampling;
+        const double centre = (numTaps - 1) * 0.5;
+
+        for (auto& group : coefficients)
+            for (auto& tap : group)
+                tap = SIMD::expand(0.0f);
+
+        for (int phase = 0; phase < oversampling; ++phase)
+        {
+            double taps[tapsPerPhase];
+            double total = 0.0;
+            for (int k = 0; k < tapsPerPhase; ++k)
+            {
+                int n = (tapsPerPhase - 1 - k) * oversampling + phase;
+                double x = (n - centre) / oversampling;
+                double sinc = x == 0.0 ? 1.0 : std::sin(juce::MathConstants<double>::pi * x) / (juce::MathConstants<double>::pi * x);
+                double w = 2.0 * juce::MathConstants<double>::pi * n / (numTaps - 1);
+                double window = 0.42 - 0.5 * std::cos(w) + 0.08 * std::cos(2.0 * w);
+                taps[k] = sinc * window;
+                total += taps[k];
+            }
+
+            auto lane = (size_t)phase % SIMD::size();
+            for (int k = 0; k < tapsPerPhase; ++k)
+                coefficients[phase / (int)SIMD::size()][k].set(lane, (float)(taps[k] / total));
+        }
+    }
+
+    static void storeMax(std::atomic<float>& target, float value)
+    {
+        float current = target.load(std::memory_order_relaxed);
+        while (value > current && !target.compare_exchange_weak(current, value, std::memory_order_relaxed)) {}
+    }
+
+    std::array<Channel, maxChannels> channels;
+    SIMD coefficients[numPhaseGroups][tapsPerPhase];
+    float rmsTimeSamples = 44100.0f * (float)rmsTimeSeconds;
+    std::atomic<bool> truePeakEnabled{true};
+    std::atomic<int> numActiveChannels{0};
+};
+
+//==============================================================================
+// STEREO TO AMBISONICS
+//==============================================================================
+// On an ambisonic output, mono and stereo zones render into a stereo bed that is
+// encoded as two sources at +/-30 degrees azimuth (ACN order, SN3D). Only the
+// first-order channels are written; higher orders come from zones recorded in
+// ambisonics, which still play 1:1.
+class StereoAmbisonicEncoder
+{
+public:
+    void prepare(const juce::AudioChannelSet& layout, int samplesPerBlock)
+    {
+        enabled = layout.getAmbisonicOrder() >= 1;
+        bed.setSize(2, enabled ? samplesPerBlock : 0);
+        bed.clear();
+    }
+
+    // Audio thread, once per block. A host block larger than prepared for plays
+    // the bed's sources on W and Y unencoded rather than overrunning it.
+    void beginBlock(int numSamples)
+    {
+        active = enabled && numSamples <= bed.getNumSamples();
+    }
+
+    // Where mono and stereo sources render this block, or nullptr for the output itself
+    juce::AudioBuffer<float>* getBed() { return active ? &bed : nullptr; }
+
+    // Adds the bed into W, Y and X and clears it for the next sources
+    void encodeInto(juce::AudioBuffer<float>& output, int numSamples)
+    {
+        if (!active || output.getNumChannels() < 4)
+            return;
+
+        const float* left = bed.getReadPointer(0);
+        const float* right = bed.getReadPointer(1);
+        float* w = output.getWritePointer(0);
+        float* y = output.getWritePointer(1);
+        float* x = output.getWritePointer(3);
+
+        for (int i = 0; i < numSamples; ++i)
+        {
+            float sum = left[i] + right[i];
+            w[i] += sum;
+            y[i] += sideGain * (left[i] - right[i]);
+            x[i] += frontGain * sum;
+        }
+
+        bed.clear(0, numSamples);
+    }
+
+private:
+    static constexpr float sideGain = 0.5f;          // sin(30 degrees)
+    static constexpr float frontGain = 0.8660254f;   // cos(30 degrees)
+
+    juce::AudioBuffer<float> bed;
+    bool enabled = false;
+    bool active = false;
+};
+
+//==============================================================================
+// PERFORMANCE METRICS
+//==============================================================================
+// Counters one instance updates from its audio thread. Block times go into a
+// histogram with four buckets per octave, from 1 us up to about a second.
+struct InstanceMetrics
+{
+    static constexpr int numBuckets = 80;
+
+    // Audio thread
+    void recordBlock(double seconds, double budgetSeconds)
+    {
+        double micros = seconds * 1.0e6;
+        int bucket = juce::jlimit(0, numBuckets - 1, (int)(4.0 * std::log2(1.0 + micros)));
+        blockTimeHistogram[(size_t)bucket].fetch_add(1, std::memory_order_relaxed);
+        blocks.fetch_add(1, std::memory_order_relaxed);
+
+        if (seconds > budgetSeconds)
+            overruns.fetch_add(1, std::memory_order_relaxed);
+
+        auto roundedMicros = (juce::uint32)micros;
+        auto currentMax = maxBlockMicros.load(std::memory_order_relaxed);
+        while (roundedMicros > currentMax && !maxBlockMicros.compare_exchange_weak(currentMax, roundedMicros, std::memory_order_relaxed)) {}
+    }
+
+    static double getBucketLimitMicros(int bucket) { return std::exp2((bucket + 1) / 4.0) - 1.0; }
+
+    int id = 0;
+    std::array<std::atomic<juce::uint32>, numBuckets> blockTimeHistogram {};
+    std::atomic<juce::uint64> blocks{0};
+    std::atomic<juce::uint64> overruns{0};
+    std::atomic<juce::uint32> maxBlockMicros{0};
+    std::atomic<int> activeVoices{0};
+    std::atomic<int> previewUnderruns{0};  // Browser audition reads that missed the disk
+    std::atomic<juce::int64> sampleMemoryBytes{0};
+};
+
+//==============================================================================
+// LOCAL SOCKETS
+//==============================================================================
+// Listening Unix domain sockets for the metrics exporter and the render daemon.
+// Default paths live in a directory only the current user can enter, sockets are
+// made owner-only, and a path a live process still answers on is never taken over.
+struct LocalSocket
+{
+   #if JUCE_LINUX || JUCE_BSD || JUCE_MAC || JUCE_ANDROID
+    // $XDG_RUNTIME_DIR when set, otherwise a private folder in the temp directory.
+    // Invalid if that folder exists but someone else owns or can enter it.
+    static juce::File getRuntimeDirectory()
+    {
+        auto runtime = juce::SystemStats::getEnvironmentVariable("XDG_RUNTIME_DIR", {});
+        if (juce::File::isAbsolutePath(runtime))
+            return juce::File(runtime);
+
+        auto folder = juce::File::getSpecialLocation(juce::File::tempDirectory)
+                          .getChildFile("advanced-sampler-" + juce::String((int)::getuid()));
+        ::mkdir(folder.getFullPathName().toRawUTF8(), 0700);
+
+        struct stat info {};
+        if (::lstat(folder.getFullPathName().toRawUTF8(), &info) != 0 || !S_ISDIR(info.st_mode)
+             || info.st_uid != ::getuid() || (info.st_mode & 077) != 0)
+            return {};
+        return folder;
+    }
+
+    // True when something accepts connections on the path
+    static bool isAnswering(const juce::String& path)
+    {
+        sockaddr_un address {};
+        if (!makeAddress(path, address))
+            return false;
+
+        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0)
+            return false;
+
+        bool answered = connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == 0;
+        ::close(fd);
+        return answered;
+    }
+
+    // The listening descriptor, or -1 when the path is in use or can't be bound.
+    // Only a stale socket is removed first, never a regular file.
+    static int listenOn(const juce::String& path, int backlog)
+    {
+        sockaddr_un address {};
+        if (!makeAddress(path, address) || isAnswering(path))
+            return -1;
+
+        struct stat info {};
+        if (::lstat(address.sun_path, &info) == 0 && S_ISSOCK(info.st_mode))
+            ::unlink(address.sun_path);  // Left behind by a process that crashed
+
+        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0)
+            return -1;
+
+        if (bind(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0
+             || ::chmod(address.sun_path, 0600) != 0 || listen(fd, backlog) != 0)
+        {
+            ::close(fd);
+            return -1;
+        }
+        return fd;
+    }
+
+private:
+    static bool makeAddress(const juce::String& path, sockaddr_un& address)
+    {
+        address.sun_family = AF_UNIX;
+        if (path.isEmpty() || path.getNumBytesAsUTF8() >= sizeof(address.sun_path))
+            return false;
+        path.copyToUTF8(address.sun_path, sizeof(address.sun_path));
+        return true;
+    }
+   #endif
+};
+
+//==============================================================================
+// METRICS EXPORTER
+//==============================================================================
+// Serves the metrics of every instance in the process as plain text on a Unix
+// domain socket: each connection gets one snapshot and is closed, so
+//     socat - UNIX-CONNECT:$XDG_RUNTIME_DIR/advanced-sampler-<pid>.sock
+// is enough to scrape it. Lines follow the Prometheus text format, with process
+// totals followed by one labelled set per instance. Set ADVANCED_SAMPLER_METRICS
+// to another socket path, or to "off" to disable it.
+class MetricsExporter : private juce::Thread
+{
+public:
+    MetricsExporter() : juce::Thread("Sampler Metrics")
+    {
+        socketPath = chooseSocketPath();
+       #if JUCE_LINUX || JUCE_BSD || JUCE_MAC || JUCE_ANDROID
+        if (socketPath.isNotEmpty())
+            startThread(juce::Thread::Priority::low);
+       #endif
+    }
+
+    ~MetricsExporter() override
+    {
+        stopThread(2000);
+    }
+
+    void addInstance(InstanceMetrics& metrics)
+    {
+        const juce::ScopedLock sl(lock);
+        metrics.id = ++lastInstanceId;
+        instances.push_back(&metrics);
+    }
+
+    // Waits for any snapshot that is reading this instance
+    void removeInstance(InstanceMetrics& metrics)
+    {
+        const juce::ScopedLock sl(lock);
+        instances.erase(std::remove(instances.begin(), instances.end(), &metrics), instances.end());
+    }
+
+    juce::String getSocketPath() const { return socketPath; }
+
+    juce::String createSnapshot() const
+    {
+        const juce::ScopedLock sl(lock);
+
+        std::array<juce::uint64, InstanceMetrics::numBuckets> totalHistogram {};
+        juce::uint64 totalBlocks = 0, totalOverruns = 0;
+        juce::uint32 maxMicros = 0;
+        int totalVoices = 0, totalUnderruns = 0;
+        juce::int64 totalMemory = 0;
+        juce::String perInstance;
+
+        for (auto* metrics : instances)
+        {
+            std::array<juce::uint64, InstanceMetrics::numBuckets> histogram {};
+            for (size_t i = 0; i < histogram.size(); ++i)
+            {
+                histogram[i] = metrics->blockTimeHistogram[i].load(std::memory_order_relaxed);
+                totalHistogram[i] += histogram[i];
+            }
+
+            auto blocks = metrics->blocks.load(std::memory_order_relaxed);
+            auto overruns = metrics->overruns.load(std::memory_order_relaxed);
+            auto micros = metrics->maxBlockMicros.load(std::memory_order_relaxed);
+            auto voices = metrics->activeVoices.load(std::memory_order_relaxed);
+            auto underruns = metrics->previewUnderruns.load(std::memory_order_relaxed);
+            auto memory = metrics->sampleMemoryBytes.load(std::memory_order_relaxed);
+
+            totalBlocks += blocks;
+            totalOverruns += overruns;
+            maxMicros = juce::jmax(maxMicros, micros);
+            totalVoices += voices;
+            totalUnderruns += underruns;
+            totalMemory += memory;
+
+            juce::String label = "{instance=\"" + juce::String(metrics->id) + "\"}";
+            perInstance << "sampler_blocks_total" << label << " " << (juce::int64)blocks << "\n"
+                        << "sampler_block_overruns_total" << label << " " << (juce::int64)overruns << "\n"
+                        << "sampler_block_time_max_us" << label << " " << (int)micros << "\n"
+                        << "sampler_active_voices" << label << " " << voices << "\n"
+                        << "sampler_preview_underruns_total" << label << " " << underruns << "\n"
+                        << "sampler_sample_memory_bytes" << label << " " << memory << "\n";
+            appendPercentiles(perInstance, "{instance=\"" + juce::String(metrics->id) + "\",", histogram);
+        }
+
+        const auto& memoryStats = SampleMemoryRegion::getStats();
+        juce::String text;
+        text << "sampler_instances " << (int)instances.size() << "\n"
+             << "sampler_blocks_total " << (juce::int64)totalBlocks << "\n"
+             << "sampler_block_overruns_total " << (juce::int64)totalOverruns << "\n"
+             << "sampler_block_time_max_us " << (int)maxMicros << "\n"
+             << "sampler_active_voices " << totalVoices << "\n"
+             << "sampler_preview_underruns_total " << totalUnderruns << "\n"
+             << "sampler_sample_memory_bytes " << totalMemory << "\n"
+             << "sampler_process_sample_memory_bytes " << memoryStats.allocatedBytes.load() << "\n"
+             << "sampler_process_locked_memory_bytes " << memoryStats.lockedBytes.load() << "\n";
+        appendPercentiles(text, "{", totalHistogram);
+        return text + perInstance;
+    }
+
+private:
+    static juce::String chooseSocketPath()
+    {
+       #if JUCE_LINUX || JUCE_BSD || JUCE_MAC || JUCE_ANDROID
+        auto configured = juce::SystemStats::getEnvironmentVariable("ADVANCED_SAMPLER_METRICS", {});
+        if (configured == "off")
+            return {};
+        if (configured.isNotEmpty())
+            return configured;
+
+        auto folder = LocalSocket::getRuntimeDirectory();
+        if (folder == juce::File())
+            return {};  // Nowhere private to put it
+        return folder.getChildFile("advanced-sampler-" + juce::String((int)::getpid()) + ".sock").getFullPathName();
+       #else
+        return {};  // No Unix domain sockets
+       #endif
+    }
+
+    // Quantiles read as the upper edge of the bucket they fall in
+    static void appendPercentiles(juce::String& text, const juce::String& labelStart,
+                                  const std::array<juce::uint64, InstanceMetrics::numBuckets>& histogram)
+    {
+        juce::uint64 count = 0;
+        for (auto n : histogram)
+            count += n;
+
+        if (count == 0)
+            return;
+
+        for (double quantile : { 0.5, 0.9, 0.99, 0.999 })
+        {
+            auto target = (juce::uint64)std::ceil(quantile * (double)count);
+            juce::uint64 seen = 0;
+            int bucket = 0;
+            for (; bucket < InstanceMetrics::numBuckets - 1; ++bucket)
+            {
+                seen += histogram[(size_t)bucket];
+                if (seen >= target)
+                    break;
+            }
+
+            text << "sampler_block_time_us" << labelStart << "quantile=\"" << juce::String(quantile) << "\"} "
+                 << juce::String(InstanceMetrics::getBucketLimitMicros(bucket), 1) << "\n";
+        }
+    }
+
+    void run() override
+    {
+       #if JUCE_LINUX || JUCE_BSD || JUCE_MAC || JUCE_ANDROID
+        int listenFd = LocalSocket::listenOn(socketPath, 8);
+        if (listenFd < 0)
+        {
+            DBG("Could not open metrics socket " + socketPath);
+            return;
+        }
+
+        while (!threadShouldExit())
+        {
+            pollfd fds { listenFd, POLLIN, 0 };
+            if (poll(&fds, 1, 250) <= 0)
+                continue;
+
+            int clientFd = accept(listenFd, nullptr, nullptr);
+            if (clientFd < 0)
+                continue;
+
+           #ifdef SO_NOSIGPIPE
+            int noSigPipe = 1;
+            setsockopt(clientFd, SOL_SOCKET, SO_NOSIGPIPE, &noSigPipe, sizeof(noSigPipe));
+           #endif
+
+            auto snapshot = createSnapshot().toStdString();
+            size_t sent = 0;
+            while (sent < snapshot.size())
+            {
+               #ifdef MSG_NOSIGNAL
+                auto result = send(clientFd, snapshot.data() + sent, snapshot.size() - sent, MSG_NOSIGNAL);
+               #else
+                auto result = send(clientFd, snapshot.data() + sent, snapshot.size() - sent, 0);
+               #endif
+                if (result <= 0)
+                    break;  // The client went away
+                sent += (size_t)result;
+            }
+            ::close(clientFd);
+        }
+
+        ::close(listenFd);
+        ::unlink(socketPath.toRawUTF8());
+       #endif
+    }
+
+    juce::String socketPath;
+    juce::CriticalSection lock;
+    std::vector<InstanceMetrics*> instances;
+    int lastInstanceId = 0;
+};
+
+//==============================================================================
+// SESSION CAPTURE
+//==============================================================================
+// Records everything that drives the processor (block sizes, MIDI, parameter
+// values and sample-set changes) so a passage can be replayed headless with the
+// same workload. The audio thread packs each block into one record in a
+// lock-free ring, and a background thread appends the records to the file.
+//
+// File layout, little endian:
+//   "ASCP", version, sample rate, output layout, max block size, LFO seed,
+//   parameter IDs, initial plugin state, then records:
+//   'B' generation, block size, changed parameters (index, normalised value), MIDI events
+//   'S' generation, zone state for that sample-set generation
+class SessionCapture : private juce::Thread,
+                       private juce::Timer
+{
+public:
+    static constexpr int ringBytes = 4 * 1024 * 1024;
+    static constexpr int maxRecordBytes = 256 * 1024;
+    static constexpr juce::uint32 fileVersion = 1;
+
+    struct Header
+    {
+        double sampleRate = 44100.0;
+        juce::String outputLayout;
+        int maxBlockSize = 512;
+        juce::uint32 seed = 1;
+    };
+
+    SessionCapture() : juce::Thread("Session Capture"), fifo(ringBytes) {}
+
+    ~SessionCapture() override
+    {
+        stop();
+    }
+
+    // Message thread. The zone callbacks are used whenever the sample set changes.
+    bool start(const juce::File& file, const Header& header, const juce::MemoryBlock& initialState,
+               const juce::Array<juce::AudioProcessorParameter*>& parametersToWatch,
+               std::function<juce::uint32()> getGeneration, std::function<juce::MemoryBlock()> createSampleSet)
+    {
+        stop();
+
+        file.deleteFile();
+        auto newStream = std::make_unique<juce::FileOutputStream>(file);
+        if (!newStream->openedOk())
+            return false;
+
+        newStream->write("ASCP", 4);
+        newStream->writeInt((int)fileVersion);
+        newStream->writeDouble(header.sampleRate);
+        newStream->writeString(header.outputLayout);
+        newStream->writeInt(header.maxBlockSize);
+        newStream->writeInt((int)header.seed);
+
+        parameters = parametersToWatch;
+        lastValues.clear();
+        newStream->writeInt(parameters.size());
+        for (auto* parameter : parameters)
+        {
+            auto* withID = dynamic_cast<juce::AudioProcessorParameterWithID*>(parameter);
+            newStream->writeString(withID != nullptr ? withID->paramID : juce::String());
+            lastValues.push_back(parameter->getValue());
+        }
+
+        newStream->writeInt((int)initialState.getSize());
+        newStream->write(initialState.getData(), initialState.getSize());
+
+        // Allocated on first use, so instances that never capture don't carry the ring
+        ring.resize((size_t)ringBytes);
+        record.resize((size_t)maxRecordBytes);
+
+        stream = std::move(newStream);
+        generationSource = std::move(getGeneration);
+        sampleSetSource = std::move(createSampleSet);
+        lastGeneration = generationSource();
+        fifo.reset();
+        overflowed = false;
+        resetPending = true;
+        active = true;
+
+        startThread(juce::Thread::Priority::low);
+        startTimerHz(20);
+        return true;
+    }
+
+    // Message thread
+    void stop()
+    {
+        stopTimer();
+        active = false;
+        while (audioThreadWriting.load())
+            juce::Thread::yield();
+
+        stopThread(2000);
+        stream.reset();
+    }
+
+    bool isActive() const { return active.load(); }
+
+    // True once the ring ran full; the file stops at the last complete block
+    bool hasOverflowed() const { return overflowed.load(); }
+
+    // Audio thread: true for the first block of a capture, which starts from a reset processor
+    bool takeResetRequest() { return resetPending.exchange(false); }
+
+    // Audio thread
+    void writeBlock(int numSamples, const juce::MidiBuffer& midi, juce::uint32 generation)
+    {
+        audioThreadWriting = true;
+        if (active.load() && !overflowed.load(std::memory_order_relaxed))
+        {
+            size_t size = 0;
+            bool fits = put(size, 'B') && put(size, generation) && put(size, (juce::int32)numSamples);
+
+            // Changed parameters, with their count written in front once known
+            size_t countPosition = size;
+            juce::uint16 numChanges = 0;
+            fits = fits && put(size, numChanges);
+            for (size_t i = 0; fits && i < lastValues.size(); ++i)
+            {
+                float value = parameters[(int)i]->getValue();
+                if (value != lastValues[i])
+                {
+                    lastValues[i] = value;
+                    fits = put(size, (juce::uint16)i) && put(size, value);
+                    ++numChanges;
+                }
+            }
+            std::memcpy(record.data() + countPosition, &numChanges, sizeof(numChanges));
+
+            fits = fits && put(size, (juce::int32)midi.getNumEvents());
+            for (const auto metadata : midi)
+            {
+                fits = fits && put(size, (juce::int32)metadata.samplePosition) && put(size, (juce::uint16)metadata.numBytes)
+                     && putBytes(size, metadata.data, (size_t)metadata.numBytes);
+            }
+
+            if (!fits || fifo.getFreeSpace() < (int)size)
+            {
+                overflowed = true;
+            }
+            else
+            {
+                const auto scope = fifo.write((int)size);
+                std::memcpy(ring.data() + scope.startIndex1, record.data(), (size_t)scope.blockSize1);
+                std::memcpy(ring.data() + scope.startIndex2, record.data() + scope.blockSize1, (size_t)scope.blockSize2);
+            }
+        }
+        audioThreadWriting = false;
+    }
+
+private:
+    template <typename Value>
+    bool put(size_t& size, Value value)
+    {
+        return putBytes(size, &value, sizeof(value));
+    }
+
+    bool putBytes(size_t& size, const void* data, size_t numBytes)
+    {
+        if (size + numBytes > record.size())
+            return false;
+        std::memcpy(record.data() + size, data, numBytes);
+        size += numBytes;
+        return true;
+    }
+
+    void run() override
+    {
+        while (!threadShouldExit())
+        {
+            wait(20);
+            drain();
+        }
+        drain();
+    }
+
+    // The audio thread commits whole records, so everything ready ends on a record boundary
+    void drain()
+    {
+        if (int ready = fifo.getNumReady(); ready > 0)
+        {
+            const auto scope = fifo.read(ready);
+            stream->write(ring.data() + scope.startIndex1, (size_t)scope.blockSize1);
+            stream->write(ring.data() + scope.startIndex2, (size_t)scope.blockSize2);
+        }
+
+        std::vector<std::pair<juce::uint32, juce::MemoryBlock>> sampleSets;
+        {
+            const juce::ScopedLock sl(sampleSetLock);
+            sampleSets.swap(pendingSampleSets);
+        }
+
+        for (auto& [generation, zones] : sampleSets)
+        {
+            stream->writeByte('S');
+            stream->writeInt((int)generation);
+            stream->writeInt((int)zones.getSize());
+            stream->write(zones.getData(), zones.getSize());
+        }
+        stream->flush();
+    }
+
+    // Captures the zones each time the sample set changes. Replay applies them when
+    // it reaches the first block recorded with the new generation.
+    void timerCallback() override
+    {
+        auto generation = generationSource();
+        if (generation == lastGeneration)
+            return;
+
+        lastGeneration = generation;
+        auto zones = sampleSetSource();
+        const juce::ScopedLock sl(sampleSetLock);
+        pendingSampleSets.emplace_back(generation, std::move(zones));
+    }
+
+    juce::AbstractFifo fifo;
+    std::vector<char> ring;
+    std::vector<char> record;  // Audio thread scratch for one block
+    juce::Array<juce::AudioProcessorParameter*> parameters;
+    std::vector<float> lastValues;
+    std::unique_ptr<juce::FileOutputStream> stream;
+    std::function<juce::uint32()> generationSource;
+    std::function<juce::MemoryBlock()> sampleSetSource;
+    juce::uint32 lastGeneration = 0;
+    juce::CriticalSection sampleSetLock;
+    std::vector<std::pair<juce::uint32, juce::MemoryBlock>> pendingSampleSets;
+    std::atomic<bool> active{false};
+    std::atomic<bool> overflowed{false};
+    std::atomic<bool> resetPending{false};
+    std::atomic<bool> audioThreadWriting{false};
+};
+
+//==============================================================================
+// EVENT SCRIPTING
+//==============================================================================
+// Articulation logic (keyswitches, legato, humanisation) written as a script and
+// run on the audio thread ahead of the voices. Scripts compile on the message
+// thread to bytecode for a small stack machine. The audio thread only ever runs
+// finished programs, with fixed-size stacks and variables, no allocation, and an
+// instruction budget per event. For example:
+//
+//     var keyswitch = 0
+//
+//     on note
+//         if note < 24
+//             keyswitch = note
+//             ignore
+//         end
+//         velocity = clamp(velocity + random(-6, 6), 1, 127)
+//     end
+//
+// Handlers are note, release, cc and timer. Events show up as note, velocity and
+// channel (note and release) or cc, value and channel (cc), all assignable.
+// Statements: assignment, if / else / end, ignore (drop the event), play <note>,
+// <velocity>, stop <note>, and timer <ms> (0 stops the timer). Functions: random(lo, hi),
+// abs, min, max, clamp(x, lo, hi), held(note), heldcount(). Operators: + - * / %
+// == != < <= > >= and or not, with parentheses. Numbers are floats; variables are
+// global and keep their values between events.
+struct ScriptProgram
+{
+    enum class Op : juce::uint8
+    {
+        push, load, store, loadEvent, storeEvent,
+        add, subtract, multiply, divide, modulo, negate,
+        equal, notEqual, less, lessEqual, greater, greaterEqual, logicalAnd, logicalOr, logicalNot,
+        jump, jumpIfFalse, call, ignore, play, stop, setTimer, end
+    };
+
+    enum Handler { onNote, onRelease, onController, onTimer, numHandlers };
+    enum EventValue { note, velocity, channel, controller, value, numEventValues };
+    enum Function { random, absolute, minimum, maximum, clamp, held, heldCount, numFunctions };
+
+    struct Instruction
+    {
+        Op op = Op::end;
+        int arg = 0;
+        float value = 0.0f;
+    };
+
+    static constexpr int maxVariables = 64;
+
+    std::vector<Instruction> code;
+    std::array<int, numHandlers> entryPoints { -1, -1, -1, -1 };
+    std::array<float, maxVariables> initialValues {};
+};
+
+class ScriptCompiler
+{
+public:
+    // Message thread. On failure the result names the line.
+    static juce::Result compile(const juce::String& source, ScriptProgram& program)
+    {
+        ScriptCompiler compiler(source, program);
+        if (compiler.parseScript())
+            return juce::Result::ok();
+        return juce::Result::fail("Line " + juce::String(compiler.errorLine) + ": " + compiler.error);
+    }
+
+private:
+    using Op = ScriptProgram::Op;
+
+    struct Token
+    {
+        enum Type { number, name, symbol, newline, end } type = end;
+        juce::String text;
+        float value = 0.0f;
+        int line = 1;
+    };
+
+    ScriptCompiler(const juce::String& source, ScriptProgram& programToFill) : program(programToFill)
+    {
+        tokenise(source);
+    }
+
+    void tokenise(const juce::String& source)
+    {
+        int line = 1;
+        auto p = source.getCharPointer();
+
+        while (!p.isEmpty())
+        {
+            auto c = *p;
+            if (c == '\n')
+            {
+                tokens.push_back({ Token::newline, "\n", 0.0f, line++ });
+                ++p;
+            }
+            else if (c == '#')
+            {
+                while (!p.isEmpty() && *p != '\n')
+                    ++p;  // Comment to the end of the line
+            }
+            else if (juce::CharacterFunctions::isWhitespace(c))
+            {
+                ++p;
+            }
+            else if (juce::CharacterFunctions::isDigit(c) || (c == '.' && juce::CharacterFunctions::isDigit(p[1])))
+            {
+                juce::String text;
+                while (juce::CharacterFunctions::isDigit(*p) || *p == '.')
+                    text += *p++;
+                tokens.push_back({ Token::number, text, text.getFloatValue(), line });
+            }
+            else if (juce::CharacterFunctions::isLetter(c) || c == '_')
+            {
+                juce::String text;
+                while (juce::CharacterFunctions::isLetterOrDigit(*p) || *p == '_')
+                    text += *p++;
+                tokens.push_back({ Token::name, text, 0.0f, line });
+            }
+            else
+            {
+                juce::String text;
+                text += *p++;
+                if ((c == '=' || c == '!' || c == '<' || c == '>') && *p == '=')
+                    text += *p++;
+                tokens.push_back({ Token::symbol, text, 0.0f, line });
+            }
+        }
+        tokens.push_back({ Token::newline, "\n", 0.0f, line });
+        tokens.push_back({ Token::end, {}, 0.0f, line });
+    }
+
+    const Token& peek() const { return tokens[position]; }
+    const Token& next() { return tokens[juce::jmin(position++, tokens.size() - 1)]; }
+    bool isAt(const char* text) const { return peek().type != Token::number && peek().text == text; }
+
+    bool accept(const char* text)
+    {
+        if (!isAt(text))
+            return false;
+        next();
+        return true;
+    }
+
+    bool fail(const juce::String& message)
+    {
+        if (error.isEmpty())
+        {
+            error = message;
+            errorLine = peek().line;
+        }
+        return false;
+    }
+
+    bool expect(const char* text)
+    {
+        return accept(text) || fail("Expected '" + juce::String(text) + "'");
+    }
+
+    bool expectEndOfLine()
+    {
+        if (peek().type != Token::newline)
+            return fail("Unexpected '" + peek().text + "'");
+        skipNewlines();
+        return true;
+    }
+
+    void skipNewlines()
+    {
+        while (peek().type == Token::newline)
+            next();
+    }
+
+    int emit(Op op, int arg = 0, float value = 0.0f)
+    {
+        program.code.push_back({ op, arg, value });
+        return (int)program.code.size() - 1;
+    }
+
+    bool parseScript()
+    {
+        skipNewlines();
+        while (peek().type != Token::end)
+        {
+            if (accept("var"))
+            {
+                if (!parseVariable())
+                    return false;
+            }
+            else if (accept("on"))
+            {
+                if (!parseHandler())
+                    return false;
+            }
+            else
+            {
+                return fail("Expected 'var' or 'on'");
+            }
+            skipNewlines();
+        }
+        return true;
+    }
+
+    bool parseVariable()
+    {
+        if (peek().type != Token::name)
+            return fail("Expected a variable name");
+
+        auto name = next().text;
+        if (variables.contains(name) || getEventValue(name) >= 0 || getFunction(name) >= 0 || isKeyword(name))
+            return fail("'" + name + "' is already taken");
+        if (variables.size() >= ScriptProgram::maxVariables)
+            return fail("Too many variables");
+
+        float initialValue = 0.0f;
+        if (accept("="))
+        {
+            bool negative = accept("-");
+            if (peek().type != Token::number)
+                return fail("Variables start from a number");
+            initialValue = negative ? -next().value : next().value;
+        }
+
+        program.initialValues[(size_t)variables.size()] = initialValue;
+        variables.add(name);
+        return expectEndOfLine();
+    }
+
+    bool parseHandler()
+    {
+        static const char* names[] = { "note", "release", "cc", "timer" };
+        auto name = next().text;
+        for (int handler = 0; handler < ScriptProgram::numHandlers; ++handler)
+        {
+            if (name != names[handler])
+                continue;
+
+            if (program.entryPoints[(size_t)handler] >= 0)
+                return fail("Handler '" + name + "' appears twice");
+
+            program.entryPoints[(size_t)handler] = (int)program.code.size();
+            if (!expectEndOfLine() || !parseBlock() || !expect("end"))
+                return false;
+
+            emit(Op::end);
+            return expectEndOfLine();
+        }
+        return fail("Unknown handler '" + name + "'");
+    }
+
+    // Statements up to (not including) 'end' or 'else'
+    bool parseBlock()
+    {
+        while (!isAt("end") && !isAt("else"))
+        {
+            if (peek().type == Token::end)
+                return fail("Missing 'end'");
+            if (!parseStatement())
+                return false;
+        }
+        return true;
+    }
+
+    bool parseStatement()
+    {
+        if (accept("if"))
+        {
+            if (!parseExpression() || !expectEndOfLine())
+                return false;
+
+            int skipThen = emit(Op::jumpIfFalse);
+            if (!parseNested([this] { return parseBlock(); }))
+                return false;
+
+            if (accept("else"))
+            {
+                int skipElse = emit(Op::jump);
+                program.code[(size_t)skipThen].arg = (int)program.code.size();
+                if (!expectEndOfLine() || !parseNested([this] { return parseBlock(); }))
+                    return false;
+                program.code[(size_t)skipElse].arg = (int)program.code.size();
+            }
+            else
+            {
+                program.code[(size_t)skipThen].arg = (int)program.code.size();
+            }
+            return expect("end") && expectEndOfLine();
+        }
+
+        if (accept("ignore"))
+        {
+            emit(Op::ignore);
+            return expectEndOfLine();
+        }
+
+        if (accept("play"))
+        {
+            if (!parseExpression() || !expect(",") || !parseExpression())
+                return false;
+            emit(Op::play);
+            return expectEndOfLine();
+        }
+
+        if (accept("stop") || accept("timer"))
+        {
+            bool isStop = tokens[position - 1].text == "stop";
+            if (!parseExpression())
+                return false;
+            emit(isStop ? Op::stop : Op::setTimer);
+            return expectEndOfLine();
+        }
+
+        if (peek().type != Token::name)
+            return fail("Expected a statement");
+
+        auto name = next().text;
+        if (!expect("=") || !parseExpression())
+            return false;
+
+        if (auto eventValue = getEventValue(name); eventValue >= 0)
+            emit(Op::storeEvent, eventValue);
+        else if (variables.contains(name))
+            emit(Op::store, variables.indexOf(name));
+        else
+            return fail("Unknown name '" + name + "'");
+
+        return expectEndOfLine();
+    }
+
+    bool parseExpression() { return parseNested([this] { return parseBinary(0); }); }
+
+    // Everything that can contain itself goes through here, so a hostile script
+    // fails to compile rather than exhausting the stack
+    template <typename Parse>
+    bool parseNested(Parse&& parse)
+    {
+        if (depth >= maxNestingDepth)
+            return fail("Nested too deeply");
+
+        ++depth;
+        bool parsed = parse();
+        --depth;
+        return parsed;
+    }
+
+    // Loosest binding first
+    bool parseBinary(int level)
+    {
+        struct Operator { const char* text; Op op; };
+        static const std::vector<std::vector<Operator>> levels {
+            { { "or", Op::logicalOr } },
+            { { "and", Op::logicalAnd } },
+            { { "==", Op::equal }, { "!=", Op::notEqual }, { "<", Op::less }, { "<=", Op::lessEqual },
+              { ">", Op::greater }, { ">=", Op::greaterEqual } },
+            { { "+", Op::add }, { "-", Op::subtract } },
+            { { "*", Op::multiply }, { "/", Op::divide }, { "%", Op::modulo } }
+        };
+
+        if (level == (int)levels.size())
+            return parseUnary();
+
+        if (!parseBinary(level + 1))
+            return false;
+
+        for (;;)
+        {
+            auto match = std::find_if(levels[(size_t)level].begin(), levels[(size_t)level].end(),
+                                      [this](const Operator& o) { return isAt(o.text); });
+            if (match == levels[(size_t)level].end())
+                return true;
+
+            next();
+            if (!parseBinary(level + 1))
+                return false;
+            emit(match->op);
+        }
+    }
+
+    bool parseUnary()
+    {
+        if (accept("-"))
+        {
+            if (!parseNested([this] { return parseUnary(); }))
+                return false;
+            emit(Op::negate);
+            return true;
+        }
+
+        if (accept("not"))
+        {
+            if (!parseNested([this] { return parseUnary(); }))
+                return false;
+            emit(Op::logicalNot);
+            return true;
+        }
+
+        return parsePrimary();
+    }
+
+    bool parsePrimary()
+    {
+        if (peek().type == Token::number)
+        {
+            emit(Op::push, 0, next().value);
+            return true;
+        }
+
+        if (accept("("))
+            return parseExpression() && expect(")");
+
+        if (peek().type != Token::name)
+            return fail("Expected a value");
+
+        auto name = next().text;
+        if (auto function = getFunction(name); function >= 0)
+        {
+            static const int arity[] = { 2, 1, 2, 2, 3, 1, 0 };
+            if (!expect("("))
+                return false;
+
+            for (int i = 0; i < arity[function]; ++i)
+                if ((i > 0 && !expect(",")) || !parseExpression())
+                    return false;
+
+            emit(Op::call, function);
+            return expect(")");
+        }
+
+        if (auto eventValue = getEventValue(name); eventValue >= 0)
+            emit(Op::loadEvent, eventValue);
+        else if (variables.contains(name))
+            emit(Op::load, variables.indexOf(name));
+        else
+            return fail("Unknown name '" + name + "'");
+        return true;
+    }
+
+    static int getEventValue(const juce::String& name)
+    {
+        static const juce::StringArray names { "note", "velocity", "channel", "cc", "value" };
+        return names.indexOf(name);
+    }
+
+    static int getFunction(const juce::String& name)
+    {
+        static const juce::StringArray names { "random", "abs", "min", "max", "clamp", "held", "heldcount" };
+        return names.indexOf(name);
+    }
+
+    static bool isKeyword(const juce::String& name)
+    {
+        static const juce::StringArray keywords { "var", "on", "end", "if", "else", "ignore", "play", "stop",
+                                                  "timer", "and", "or", "not" };
+        return keywords.contains(name);
+    }
+
+    static constexpr int maxNestingDepth = 32;  // Also keeps expressions well inside the VM stack
+
+    ScriptProgram& program;
+    std::vector<Token> tokens;
+    size_t position = 0;
+    int depth = 0;
+    juce::StringArray variables;
+    juce::String error;
+    int errorLine = 0;
+};
+
+// Runs the compiled script over each block's MIDI on the audio thread. Without a
+// script, MIDI passes straight through untouched.
+class ScriptEngine
+{
+public:
+    static constexpr int maxInstructionsPerEvent = 4096;
+    static constexpr int stackSize = 64;
+    static constexpr int maxEventsPerBlock = 512;  // Keeps the output buffer from ever reallocating
+
+    ScriptEngine()
+    {
+        resetPlayedNotes();
+    }
+
+    ~ScriptEngine()
+    {
+        delete current;
+        delete pending.exchange(nullptr);
+        collectGarbage();
+    }
+
+    // Message thread. An empty script removes the current one.
+    juce::Result setScript(const juce::String& newSource)
+    {
+        collectGarbage();
+
+        // An empty program tells the audio thread to drop the script
+        auto program = std::make_unique<ScriptProgram>();
+        if (newSource.trim().isNotEmpty())
+        {
+            auto result = ScriptCompiler::compile(newSource, *program);
+            if (result.failed())
+                return result;
+        }
+
+        source = newSource;
+        delete pending.exchange(program.release());  // Never seen by the audio thread if still pending
+        return juce::Result::ok();
+    }
+
+    const juce::String& getScript() const { return source; }
+    int getBudgetOverruns() const { return budgetOverruns.load(); }
+
+    void prepareToPlay(double newSampleRate)
+    {
+        sampleRate = newSampleRate;
+        output.ensureSize((size_t)maxEventsPerBlock * 16);
+    }
+
+    // Audio thread
+    void reset(juce::uint32 seed)
+    {
+        randomState = seed != 0 ? seed : 1;
+        timerInterval = 0;
+        heldNotes.fill(false);
+        numHeld = 0;
+        resetPlayedNotes();
+        if (current != nullptr)
+            variables = current->initialValues;
+    }
+
+    // Audio thread. Returns the buffer the voices should render from.
+    juce::MidiBuffer& process(juce::MidiBuffer& midi, int numSamples)
+    {
+        takePendingProgram();
+        if (current == nullptr)
+            return midi;
+
+        output.clear();
+        numOutputEvents = 0;
+
+        for (const auto metadata : midi)
+        {
+            runTimers(metadata.samplePosition);
+            handleEvent(metadata.getMessage(), metadata.samplePosition);
+        }
+        runTimers(numSamples);
+        samplesUntilTimer -= numSamples;
+        return output;
+    }
+
+private:
+    using Op = ScriptProgram::Op;
+
+    struct Event
+    {
+        std::array<float, ScriptProgram::numEventValues> values {};
+        bool ignored = false;
+        int position = 0;
+    };
+
+    void takePendingProgram()
+    {
+        if (pending.load(std::memory_order_relaxed) == nullptr)
+            return;
+
+        auto* next = pending.exchange(nullptr);
+        retire(current);
+        current = next;
+        if (current->code.empty())
+        {
+            retire(current);
+            current = nullptr;
+        }
+
+        // Held notes keep their mapping so their releases still land
+        timerInterval = 0;
+        if (current != nullptr)
+            variables = current->initialValues;
+    }
+
+    void retire(ScriptProgram* program)
+    {
+        if (program == nullptr)
+            return;
+
+        const auto scope = retiredFifo.write(1);
+        if (scope.blockSize1 > 0)
+            retired[(size_t)scope.startIndex1] = program;
+        else
+            jassertfalse;  // Scripts replaced faster than the message thread collects them
+    }
+
+    void resetPlayedNotes()
+    {
+        for (size_t key = 0; key < playedNotes.size(); ++key)
+            playedNotes[key] = (juce::int8)key;
+    }
+
+    void collectGarbage()
+    {
+        const auto scope = retiredFifo.read(retiredFifo.getNumReady());
+        for (int i = 0; i < scope.blockSize1; ++i)
+            delete retired[(size_t)(scope.startIndex1 + i)];
+        for (int i = 0; i < scope.blockSize2; ++i)
+            delete retired[(size_t)(scope.startIndex2 + i)];
+    }
+
+    // Timer ticks that fall before position (samplesUntilTimer counts from the block start)
+    void runTimers(int position)
+    {
+        while (timerInterval > 0 && samplesUntilTimer < position)
+        {
+            Event event;
+            event.position = juce::jmax(0, samplesUntilTimer);
+            samplesUntilTimer += timerInterval;
+            run(ScriptProgram::onTimer, event);
+        }
+    }
+
+    void handleEvent(const juce::MidiMessage& message, int position)
+    {
+        Event event;
+        event.position = position;
+        event.values[ScriptProgram::channel] = (float)message.getChannel();
+
+        if (message.isNoteOn())
+        {
+            int key = message.getNoteNumber();
+            if (!heldNotes[(size_t)key])
+                ++numHeld;
+            heldNotes[(size_t)key] = true;
+
+            event.values[ScriptProgram::note] = (float)key;
+            event.values[ScriptProgram::velocity] = (float)message.getVelocity();
+            bool handled = run(ScriptProgram::onNote, event);
+
+            int note = toMidi(event.values[ScriptProgram::note]);
+            int velocity = toMidi(event.values[ScriptProgram::velocity]);
+            if (handled && (event.ignored || velocity == 0))
+            {
+                playedNotes[(size_t)key] = -1;
+                return;
+            }
+
+            if (!handled)
+            {
+                note = key;
+                velocity = message.getVelocity();
+            }
+
+            playedNotes[(size_t)key] = (juce::int8)note;  // So the release finds a transposed note
+            addOutput(juce::MidiMessage::noteOn(toChannel(event), note, (juce::uint8)velocity), position);
+        }
+        else if (message.isNoteOff())
+        {
+            int key = message.getNoteNumber();
+            if (heldNotes[(size_t)key])
+                --numHeld;
+            heldNotes[(size_t)key] = false;
+
+            event.values[ScriptProgram::note] = (float)key;
+            event.values[ScriptProgram::velocity] = (float)message.getVelocity();
+            bool handled = run(ScriptProgram::onRelease, event);
+            if (handled && event.ignored)
+                return;
+
+            int played = playedNotes[(size_t)key];
+            playedNotes[(size_t)key] = (juce::int8)key;
+
+            int note = toMidi(event.values[ScriptProgram::note]);
+            if (note == key)
+                note = played;  // Unchanged by the script: release what the note-on played
+            if (note >= 0)
+                addOutput(juce::MidiMessage::noteOff(toChannel(event), note, (juce::uint8)toMidi(event.values[ScriptProgram::velocity])), position);
+        }
+        else if (message.isController())
+        {
+            event.values[ScriptProgram::controller] = (float)message.getControllerNumber();
+            event.values[ScriptProgram::value] = (float)message.getControllerValue();
+            bool handled = run(ScriptProgram::onController, event);
+            if (!handled)
+                addOutput(message, position);
+            else if (!event.ignored)
+                addOutput(juce::MidiMessage::controllerEvent(toChannel(event), toMidi(event.values[ScriptProgram::controller]),
+                                                             toMidi(event.values[ScriptProgram::value])), position);
+        }
+        else
+        {
+            addOutput(message, position);
+        }
+    }
+
+    // False when there is no handler, or it ran over its budget (the event then passes unchanged)
+    bool run(int handler, Event& event)
+    {
+        int pc = current->entryPoints[(size_t)handler];
+        if (pc < 0)
+            return false;
+
+        const auto* code = current->code.data();
+        std::array<float, stackSize> stack;
+        int sp = 0;
+
+        for (int budget = maxInstructionsPerEvent; --budget >= 0;)
+        {
+            const auto& instruction = code[pc++];
+
+            // Every op pops at most three and pushes at most one
+            if (sp >= stackSize - 1)
+                break;
+
+            switch (instruction.op)
+            {
+                case Op::push:          stack[(size_t)sp++] = instruction.value; break;
+                case Op::load:          stack[(size_t)sp++] = variables[(size_t)instruction.arg]; break;
+                case Op::store:         variables[(size_t)instruction.arg] = stack[(size_t)--sp]; break;
+                case Op::loadEvent:     stack[(size_t)sp++] = event.values[(size_t)instruction.arg]; break;
+                case Op::storeEvent:    event.values[(size_t)instruction.arg] = stack[(size_t)--sp]; break;
+                case Op::negate:        stack[(size_t)sp - 1] = -stack[(size_t)sp - 1]; break;
+                case Op::logicalNot:    stack[(size_t)sp - 1] = stack[(size_t)sp - 1] == 0.0f ? 1.0f : 0.0f; break;
+                case Op::jump:          pc = instruction.arg; break;
+                case Op::jumpIfFalse:   if (stack[(size_t)--sp] == 0.0f) pc = instruction.arg; break;
+                case Op::call:          sp = call(instruction.arg, stack.data(), sp); break;
+                case Op::ignore:        event.ignored = true; break;
+                case Op::setTimer:
+                {
+                    float ms = stack[(size_t)--sp];
+                    timerInterval = ms > 0.0f ? (int)(juce::jmax(1.0f, ms) * 0.001 * sampleRate) : 0;
+                    samplesUntilTimer = event.position + timerInterval;
+                    break;
+                }
+                case Op::play:
+                {
+                    sp -= 2;
+                    addOutput(juce::MidiMessage::noteOn(toChannel(event), toMidi(stack[(size_t)sp]),
+                                                        (juce::uint8)juce::jmax(1, toMidi(stack[(size_t)sp + 1]))), event.position);
+                    break;
+                }
+                case Op::stop:
+                    addOutput(juce::MidiMessage::noteOff(toChannel(event), toMidi(stack[(size_t)--sp])), event.position);
+                    break;
+                case Op::end:
+                    return true;
+                default:
+                {
+                    float b = stack[(size_t)--sp];
+                    float& a = stack[(size_t)sp - 1];
+                    a = binary(instruction.op, a, b);
+                    break;
+                }
+            }
+        }
+
+        ++budgetOverruns;
+        return false;
+    }
+
+    static float binary(Op op, float a, float b)
+    {
+        switch (op)
+        {
+            case Op::add:           return a + b;
+            case Op::subtract:      return a - b;
+            case Op::multiply:      return a * b;
+            case Op::divide:        return b != 0.0f ? a / b : 0.0f;
+            case Op::modulo:        return b != 0.0f ? std::fmod(a, b) : 0.0f;
+            case Op::equal:         return a == b ? 1.0f : 0.0f;
+            case Op::notEqual:      return a != b ? 1.0f : 0.0f;
+            case Op::less:          return a < b ? 1.0f : 0.0f;
+            case Op::lessEqual:     return a <= b ? 1.0f : 0.0f;
+            case Op::greater:       return a > b ? 1.0f : 0.0f;
+            case Op::greaterEqual:  return a >= b ? 1.0f : 0.0f;
+            case Op::logicalAnd:    return a != 0.0f && b != 0.0f ? 1.0f : 0.0f;
+            case Op::logicalOr:     return a != 0.0f || b != 0.0f ? 1.0f : 0.0f;
+            default:                return 0.0f;
+        }
+    }
+
+    // Pops the arguments and pushes the result; returns the new stack pointer
+    int call(int function, float* stack, int sp)
+    {
+        switch (function)
+        {
+            case ScriptProgram::random:
+            {
+                randomState ^= randomState << 13;
+                randomState ^= randomState >> 17;
+                randomState ^= randomState << 5;
+                float lo = stack[sp - 2], hi = stack[sp - 1];
+                stack[sp - 2] = lo + (hi - lo) * (float)(randomState >> 8) * (1.0f / 16777216.0f);
+                return sp - 1;
+            }
+            case ScriptProgram::absolute:   stack[sp - 1] = std::abs(stack[sp - 1]); return sp;
+            case ScriptProgram::minimum:    stack[sp - 2] = juce::jmin(stack[sp - 2], stack[sp - 1]); return sp - 1;
+            case ScriptProgram::maximum:    stack[sp - 2] = juce::jmax(stack[sp - 2], stack[sp - 1]); return sp - 1;
+            case ScriptProgram::clamp:      stack[sp - 3] = juce::jlimit(stack[sp - 2], juce::jmax(stack[sp - 2], stack[sp - 1]), stack[sp - 3]); return sp - 2;
+            case ScriptProgram::held:
+            {
+                int note = toMidi(stack[sp - 1]);
+                stack[sp - 1] = heldNotes[(size_t)note] ? 1.0f : 0.0f;
+                return sp;
+            }
+            case ScriptProgram::heldCount:  stack[sp] = (float)numHeld; return sp + 1;
+            default:                        return sp;
+        }
+    }
+
+    static int toMidi(float value) { return juce::jlimit(0, 127, juce::roundToInt(value)); }
+    static int toChannel(const Event& event) { return juce::jlimit(1, 16, juce::roundToInt(event.values[ScriptProgram::channel])); }
+
+    void addOutput(const juce::MidiMessage& message, int position)
+    {
+        if (numOutputEvents++ < maxEventsPerBlock)
+            output.addEvent(message, position);
+    }
+
+    static constexpr int maxRetired = 16;
+
+    // Message thread
+    juce::String source;
+    std::atomic<ScriptProgram*> pending{nullptr};
+    juce::AbstractFifo retiredFifo { maxRetired };
+    std::array<ScriptProgram*, maxRetired> retired {};
+
+    // Audio thread
+    ScriptProgram* current = nullptr;
+    std::array<float, ScriptProgram::maxVariables> variables {};
+    juce::MidiBuffer output;
+    int numOutputEvents = 0;
+    double sampleRate = 44100.0;
+    int timerInterval = 0;  // Samples, 0 when stopped
+    int samplesUntilTimer = 0;
+    juce::uint32 randomState = 1;
+    std::array<bool, 128> heldNotes {};
+    int numHeld = 0;
+    std::array<juce::int8, 128> playedNotes {};
+    std::atomic<int> budgetOverruns{0};
+};
+
+//==============================================================================
+// FORWARD DECLARATIONS
+//==============================================================================
+class AdvancedSamplerProcessor;
+class PatchFreezer;
+
+//==============================================================================
+// SAMPLER VOICE
+//==============================================================================
+class AdvancedSamplerSound : public juce::SynthesiserSound
+{
+public:
+    bool appliesToNote(int) override { return true; }
+    bool appliesToChannel(int) override { return true; }
+};
+
+class AdvancedSamplerVoice : public juce::SynthesiserVoice
+{
+public:
+    AdvancedSamplerVoice(SampleEngine& sampleEng, ModulationMatrix& modMatrix, AdvancedSamplerProcessor& proc, int index);
+    
+    void setValueTreeState(juce::AudioProcessorValueTreeState* vts)
+    {
+        valueTreeState = vts;
+        layerCrossfadeParam = vts != nullptr ? vts->getRawParameterValue("layer_crossfade") : nullptr;
+        interpolationParam = vts != nullptr ? vts->getRawParameterValue("interpolation") : nullptr;
+    }
+    bool canPlaySound(juce::SynthesiserSound* sound) override
+    {
+        return dynamic_cast<AdvancedSamplerSound*>(sound) != nullptr;
+    }
+    
+    void updateADSRParams()
+    {
+        if (valueTreeState != nullptr)
+        {
+            adsrParams.attack = *valueTreeState->getRawParameterValue("env_attack");
+            adsrParams.decay = *valueTreeState->getRawParameterValue("env_decay");
+            adsrParams.sustain = *valueTreeState->getRawParameterValue("env_sustain");
+            adsrParams.release = *valueTreeState->getRawParameterValue("env_release");
+            adsr.setParameters(adsrParams);
+        }
+    }
+    
+    void startNote(int midiNoteNumber, float vel, juce::SynthesiserSound*, int) override;
+    void stopNote(float, bool allowTailOff) override
+    {
+        adsr.noteOff();
+        if (!allowTailOff)
+            clearCurrentNote();
+    }
+    
+    void pitchWheelMoved(int newValue) override
+    {
+        float pitchBend = (newValue - 8192) / 8192.0f * 2.0f;
+        modulationMatrix.setSourceValue(ModulationSource::PitchBend, pitchBend / 12.0f);
+    }
+    
+    void controllerMoved(int controllerNumber, int newValue) override
+    {
+        float normalizedValue = newValue / 127.0f;
+        
+        if (controllerNumber == 1)
+            modulationMatrix.setSourceValue(ModulationSource::ModWheel, normalizedValue);
+    }
+    float getCurrentPlaybackPosition() const { return normalizedPosition; }
+    void reset();  // Silences the voice at once, without a release tail
+    void renderNextBlock(juce::AudioBuffer<float>& outputBuffer, int startSample, int numSamples) override;
+    
+private:
+    // Render kernels are instantiated for every combination of these, so the
+    // per-sample loop carries no branches on zone or engine settings
+    enum class KernelLoop { none, forward, backward, pingPong };
+    enum class KernelChannels
+    {
+        mono, planarStereo, interleavedStereo,
+        quad, surround51, surround714, ambisonic3,  // 4, 6, 12 and 16 channels, mapped 1:1 to outputs
+        multichannel                                // Any other count, min(zone, output) channels
+    };
+    enum class KernelInterpolation { linear, cubic };
+    enum class KernelLayers { single, crossfade };  // Crossfade reads two adjacent layers in the same pass
+    
+    static constexpr size_t numKernelLoops = 4;
+    static constexpr size_t numKernelChannels = 8;
+    static constexpr size_t numKernelInterpolations = 2;
+    static constexpr size_t numKernelLayers = 2;
+    static constexpr size_t numKernels = numKernelLoops * numKernelChannels * numKernelInterpolations * numKernelLayers;
+    
+    using RenderKernel = void (AdvancedSamplerVoice::*)(juce::AudioBuffer<float>&, int, int);
+    
+    static constexpr int maxKernelChannels = 64;
+    
+    // One layer's audio as a kernel reads it
+    struct KernelSource
+    {
+        std::array<const float*, maxKernelChannels> ins;  // N-channel kernels
+        const float* left = nullptr;
+        const float* right = nullptr;
+        int length = 0;
+        int loopStart = 0;
+        int loopEnd = 0;
+    };
+    
+    // Compile-time channel count for the N-channel kernels: 0 when only known at
+    // render time, -1 for the mono and stereo kernels
+    static constexpr int getFixedChannelCount(KernelChannels channels)
+    {
+        switch (channels)
+        {
+            case KernelChannels::quad:          return 4;
+            case KernelChannels::surround51:    return 6;
+            case KernelChannels::surround714:   return 12;
+            case KernelChannels::ambisonic3:    return 16;
+            case KernelChannels::multichannel:  return 0;
+            default:                            return -1;
+        }
+    }
+    
+    template <KernelLoop loop, KernelChannels channels, KernelInterpolation interpolation, KernelLayers layering>
+    void renderKernel(juce::AudioBuffer<float>& outputBuffer, int startSample, int numSamples);
+    
+    template <size_t... indices>
+    static std::array<RenderKernel, numKernels> makeKernelTable(std::index_sequence<indices...>)
+    {
+        return {{ &AdvancedSamplerVoice::renderKernel<
+                      static_cast<KernelLoop>(indices / (numKernelChannels * numKernelInterpolations * numKernelLayers)),
+                      static_cast<KernelChannels>((indices / (numKernelInterpolations * numKernelLayers)) % numKernelChannels),
+                      static_cast<KernelInterpolation>((indices / numKernelLayers) % numKernelInterpolations),
+                      static_cast<KernelLayers>(indices % numKernelLayers)>... }};
+    }
+    
+    template <KernelChannels channels>
+    static void getKernelSource(const SampleData& zone, int numChannels, KernelSource& source)
+    {
+        source.length = zone.audioData.getNumSamples();
+        source.loopStart = (int)(zone.loopStart * source.length);
+        source.loopEnd = (int)(zone.loopEnd * source.length);
+        
+        if constexpr (getFixedChannelCount(channels) >= 0)
+        {
+            for (int ch = 0; ch < numChannels; ++ch)
+                source.ins[(size_t)ch] = zone.audioData.getReadPointer(ch);
+        }
+        else if constexpr (channels == KernelChannels::interleavedStereo)
+        {
+            source.left = zone.interleavedStereo;
+            source.right = source.left + 1;
+        }
+        else
+        {
+            source.left = zone.audioData.getReadPointer(0);
+            source.right = channels == KernelChannels::planarStereo ? zone.audioData.getReadPointer(1) : source.left;
+        }
+    }
+    
+    // Moves a play position on by one output sample; true once it has run off the end
+    template <KernelLoop loop>
+    static bool advancePosition(double& position, bool& forward, double increment, const KernelSource& source)
+    {
+        if constexpr (loop == KernelLoop::none)
+        {
+            position += increment;
+            return position >= source.length;
+        }
+        else if (position < source.loopStart)
+        {
+            position += increment;
+            return position >= source.length;
+        }
+        else if constexpr (loop == KernelLoop::forward)
+        {
+            position += increment;
+            if (position >= source.loopEnd)
+                position = source.loopStart + (position - source.loopEnd);
+        }
+        else if constexpr (loop == KernelLoop::backward)
+        {
+            position -= increment;
+            if (position <= source.loopStart)
+                position = source.loopEnd - (source.loopStart - position);
+        }
+        else
+        {
+            if (forward)
+            {
+                position += increment;
+                if (position >= source.loopEnd)
+                {
+                    position = source.loopEnd - (position - source.loopEnd);
+                    forward = false;
+                }
+            }
+            else
+            {
+                position -= increment;
+                if (position <= source.loopStart)
+                {
+                    position = source.loopStart + (source.loopStart - position);
+                    forward = true;
+                }
+            }
+        }
+        return false;
+    }
+    
+    // Reads one channel at a fractional frame; stride is 2 for interleaved data.
+    // Zone buffers carry zeroed padding, so reading past the last frame is safe.
+    template <KernelInterpolation interpolation>
+    static float interpolate(const float* data, int index, int stride, float fraction)
+    {
+        const float* p = data + index * stride;
+        
+        if constexpr (interpolation == KernelInterpolation::linear)
+        {
+            return p[0] + (p[stride] - p[0]) * fraction;
+        }
+        else
+        {
+            // 4-point, 3rd-order Hermite
+            float xm1 = index > 0 ? p[-stride] : p[0];
+            float x0 = p[0], x1 = p[stride], x2 = p[2 * stride];
+            float c1 = 0.5f * (x1 - xm1);
+            float c2 = xm1 - 2.5f * x0 + 2.0f * x1 - 0.5f * x2;
+            float c3 = 0.5f * (x2 - xm1) + 1.5f * (x0 - x1);
+            return ((c3 * fraction + c2) * fraction + c1) * fraction + x0;
+        }
+    }
+    
+    static KernelChannels getKernelChannels(const SampleData& zone, int numOutputs)
+    {
+        const int numZoneChannels = zone.audioData.getNumChannels();
+        if (numZoneChannels <= 2)
+            return zone.interleavedStereo != nullptr ? KernelChannels::interleavedStereo
+                 : numZoneChannels == 2 ? KernelChannels::planarStereo
+                 : KernelChannels::mono;
+        
+        for (auto fixed : { KernelChannels::quad, KernelChannels::surround51,
+                            KernelChannels::surround714, KernelChannels::ambisonic3 })
+            if (numZoneChannels == getFixedChannelCount(fixed) && numOutputs >= numZoneChannels)
+                return fixed;
+        
+        return KernelChannels::multichannel;
+    }
+    
+    static KernelLoop getKernelLoop(const SampleData& zone)
+    {
+        return !zone.loopEnabled ? KernelLoop::none
+             : zone.loopMode == 1 ? KernelLoop::backward
+             : zone.loopMode == 2 ? KernelLoop::pingPong
+             : KernelLoop::forward;
+    }
+    
+    size_t getKernelIndex(int numOutputChannels) const
+    {
+        auto loop = getKernelLoop(*currentSample);
+        auto channels = getKernelChannels(*currentSample, numOutputChannels);
+        
+        // Layers laid out or looped differently can't share a kernel; the lower one then plays alone
+        auto layering = upperSample != nullptr && getKernelChannels(*upperSample, numOutputChannels) == channels
+                                               && getKernelLoop(*upperSample) == loop
+                      ? KernelLayers::crossfade : KernelLayers::single;
+        
+        return (((size_t)loop * numKernelChannels + (size_t)channels) * numKernelInterpolations
+                + (size_t)interpolationMode) * numKernelLayers + (size_t)layering;
+    }
+    
+    void selectKernel(int numOutputChannels)
+    {
+        static const auto kernels = makeKernelTable(std::make_index_sequence<numKernels>());
+        kernelIndex = getKernelIndex(numOutputChannels);
+        kernel = kernels[kernelIndex];
+    }
+    
+    double getPositionIncrement(const SampleData& zone) const
+    {
+        double pitchRatio = std::pow(2.0, (noteNumber - zone.rootNote) / 12.0);
+        return pitchRatio * zone.sampleRate / getSampleRate();
+    }
+    
+    float getLayerControlValue() const
+    {
+        return layerControl == LayerControl::modWheel ? modulationMatrix.getSourceValue(ModulationSource::ModWheel) : velocity;
+    }
+    
+    // Lower layer of the adjacent pair the control value falls between
+    int findLayerPair(float control) const
+    {
+        int index = 0;
+        while (index < numLayers - 2 && SampleEngine::getLayerCentre(*layers[(size_t)index + 1]) <= control)
+            ++index;
+        return index;
+    }
+    
+    // Equal-power, since layers recorded separately don't sum in phase
+    void setTargetLayerGains(float control)
+    {
+        float lower = SampleEngine::getLayerCentre(*currentSample);
+        float upper = SampleEngine::getLayerCentre(*upperSample);
+        float mix = upper > lower ? juce::jlimit(0.0f, 1.0f, (control - lower) / (upper - lower)) : 0.0f;
+        targetLayerGains = { std::cos(mix * juce::MathConstants<float>::halfPi),
+                             std::sin(mix * juce::MathConstants<float>::halfPi) };
+    }
+    
+    // A layer joining mid-note starts at the same point in time as the one it pairs with
+    static double alignLayerPosition(const SampleData& from, double position, const SampleData& to)
+    {
+        return position / from.sampleRate * to.sampleRate;
+    }
+    
+    // Follows the mod wheel across layers while the note sounds. Moving to the next
+    // pair swaps in a layer where the crossfade has it silent, so nothing jumps.
+    void updateLayers()
+    {
+        float control = getLayerControlValue();
+        int target = findLayerPair(control);
+        
+        while (layerIndex < target)
+        {
+            currentSample = upperSample;
+            currentPosition = upperPosition;
+            positionIncrement = upperIncrement;
+            incrementSampleRate = upperIncrementSampleRate;
+            loopingForward = upperLoopingForward;
+            
+            upperSample = layers[(size_t)++layerIndex + 1];
+            upperPosition = alignLayerPosition(*currentSample, currentPosition, *upperSample);
+            upperIncrement = getPositionIncrement(*upperSample);
+            upperIncrementSampleRate = upperSample->sampleRate;
+            upperLoopingForward = loopingForward;
+            std::swap(layerGains[0], layerGains[1]);
+        }
+        
+        while (layerIndex > target)
+        {
+            upperSample = currentSample;
+            upperPosition = currentPosition;
+            upperIncrement = positionIncrement;
+            upperIncrementSampleRate = incrementSampleRate;
+            upperLoopingForward = loopingForward;
+            
+            currentSample = layers[(size_t)--layerIndex];
+            currentPosition = alignLayerPosition(*upperSample, upperPosition, *currentSample);
+            positionIncrement = getPositionIncrement(*currentSample);
+            incrementSampleRate = currentSample->sampleRate;
+            loopingForward = upperLoopingForward;
+            std::swap(layerGains[0], layerGains[1]);
+        }
+        
+        setTargetLayerGains(control);
+    }
+    
+    // Hot reload can swap in audio at another sample rate under a sounding note;
+    // the play position keeps its place in time and the step follows the new rate
+    void followSampleRateChanges()
+    {
+        if (currentSample->sampleRate != incrementSampleRate)
+        {
+            currentPosition *= currentSample->sampleRate / incrementSampleRate;
+            positionIncrement = getPositionIncrement(*currentSample);
+            incrementSampleRate = currentSample->sampleRate;
+        }
+        
+        if (upperSample != nullptr && upperSample->sampleRate != upperIncrementSampleRate)
+        {
+            upperPosition *= upperSample->sampleRate / upperIncrementSampleRate;
+            upperIncrement = getPositionIncrement(*upperSample);
+            upperIncrementSampleRate = upperSample->sampleRate;
+        }
+    }
+    
+    float normalizedPosition ;
+    juce::AudioProcessorValueTreeState* valueTreeState = nullptr;
+    std::atomic<float>* layerCrossfadeParam = nullptr;
+    std::atomic<float>* interpolationParam = nullptr;
+    SampleEngine& sampleEngine;
+    ModulationMatrix& modulationMatrix;
+    AdvancedSamplerProcessor& processor;
+    int voiceIndex;
+    SampleData* currentSample = nullptr;
+    juce::uint32 sampleSetGeneration = 0;
+    RenderKernel kernel = nullptr;
+    size_t kernelIndex = 0;
+    KernelInterpolation interpolationMode = KernelInterpolation::linear;
+    double currentPosition = 0.0;
+    double positionIncrement = 0.0;
+    double incrementSampleRate = 44100.0;  // The zone rate positionIncrement was worked out for
+    int noteNumber = 0;
+    float velocity = 0.0f;
+    bool loopingForward = true;
+    
+    // Layer crossfading: currentSample is layers[layerIndex] and upperSample the one above
+    enum class LayerControl { off, velocity, modWheel };
+    LayerControl layerControl = LayerControl::off;
+    std::array<SampleData*, SampleEngine::maxLayers> layers {};
+    int numLayers = 0;
+    int layerIndex = 0;
+    SampleData* upperSample = nullptr;
+    double upperPosition = 0.0;
+    double upperIncrement = 0.0;
+    double upperIncrementSampleRate = 44100.0;
+    bool upperLoopingForward = true;
+    std::array<float, 2> layerGains { 1.0f, 0.0f };  // At the start of the block
+    std::array<float, 2> targetLayerGains { 1.0f, 0.0f };  // At its end
+    
+    juce::ADSR adsr;
+    juce::ADSR::Parameters adsrParams;
+};
+
+//==============================================================================
+// CUSTOM KNOB COMPONENT
+//==============================================================================
+class CustomKnob : public juce::Component
+{
+public:
+    CustomKnob()
+    {
+        setSize(70, 100);
+    }
+    
+    void paint(juce::Graphics& g) override
+    {
+        auto bounds = getLocalBounds().reduced(5);
+        auto knobBounds = bounds.removeFromTop(60);
+        
+        // Draw knob shadow
+        g.setColour(juce::Colours::black.withAlpha(0.3f));
+        g.fillEllipse(knobBounds.toFloat().translated(2, 2));
+        
+        // Draw knob base
+        juce::ColourGradient gradient(
+            juce::Colour(0xff444444), knobBounds.getCentreX(), knobBounds.getY(),
+            juce::Colour(0xff222222), knobBounds.getCentreX(), knobBounds.getBottom(),
+            false
+        );
+        g.setGradientFill(gradient);
+        g.fillEllipse(knobBounds.toFloat());
+        
+        // Draw knob ring
+        g.setColour(juce::Colour(0xff333333));
+        g.drawEllipse(knobBounds.toFloat().reduced(2), 2.0f);
+        
+        // 7 o'clock = 210° = 7π/6 radians
+        // 5 o'clock = 150° = 5π/6 radians
+        // Total sweep = 300° clockwise = 5π/3 radians
+        constexpr float startAngle = juce::MathConstants<float>::pi * 7.0f / 6.0f;  // 7 o'clock
+        constexpr float endAngle = juce::MathConstants<float>::pi * 5.0f / 6.0f;    // 5 o'clock
+        constexpr float totalSweep = juce::MathConstants<float>::twoPi - (juce::MathConstants<float>::pi / 3.0f); // 300° = 5π/3
+        
+        // Draw active indicator arc (clockwise from 7 to current position)
+        float currentAngle = startAngle + (value * totalSweep);
+        juce::Path arcPath;
+        arcPath.addCentredArc(knobBounds.getCentreX(), knobBounds.getCentreY(),
+                             knobBounds.getWidth() / 2.0f - 5, knobBounds.getHeight() / 2.0f - 5,
+                             0.0f, startAngle, currentAngle, true);
+        
+        g.setColour(juce::Colour(0xff00ff88));
+        g.strokePath(arcPath, juce::PathStrokeType(3.0f));
+        
+        // Draw pointer
+        float pointerAngle = startAngle + (value * totalSweep);
+        float pointerLength = knobBounds.getWidth() / 2.0f - 10;
+        float pointerX = knobBounds.getCentreX() + pointerLength * std::cos(pointerAngle - juce::MathConstants<float>::pi / 2.0f);
+        float pointerY = knobBounds.getCentreY() + pointerLength * std::sin(pointerAngle - juce::MathConstants<float>::pi / 2.0f);
+        
+        g.setColour(juce::Colours::white);
+        g.drawLine(knobBounds.getCentreX(), knobBounds.getCentreY(), pointerX, pointerY, 3.0f);
+        
+        // Draw label
+        g.setColour(juce::Colour(0xffaaaaaa));
+        g.setFont(11.0f);
+        g.drawText(label, bounds.removeFromTop(15), juce::Justification::centred);
+        
+        // Draw value
+        g.setColour(juce::Colour(0xff00ff88));
+        g.setFont(12.0f);
+        g.drawText(valueText, bounds, juce::Justification::centred);
+    }
+    
+    void mouseDown(const juce::MouseEvent& e) override
+    {
+        startDragY = e.y;
+        startValue = value;
+    }
+    
+    void mouseDrag(const juce::MouseEvent& e) override
+    {
+        float delta = (startDragY - e.y) / 100.0f;
+        value = juce::jlimit(0.0f, 1.0f, startValue + delta);
+        
+        if (onValueChange)
+            onValueChange(value);
+        
+        repaint();
+    }
+    
+    void setValue(float newValue)
+    {
+        value = juce::jlimit(0.0f, 1.0f, newValue);
+        repaint();
+    }
+    
+    void setLabel(const juce::String& text) { label = text; repaint(); }
+    void setValueText(const juce::String& text) { valueText = text; repaint(); }
+    
+    std::function<void(float)> onValueChange;
+    
+private:
+    float value = 0.5f;
+    float startValue = 0.0f;
+    int startDragY = 0;
+    juce::String label;
+    juce::String valueText = "0.5";
+};
+
+
+
+
+//==============================================================================
+// AUDIO PROCESSOR
+//==============================================================================
+class AdvancedSamplerProcessor : public juce::AudioProcessor
+{
+public:
+    AdvancedSamplerProcessor()
+        : AudioProcessor(BusesProperties().withOutput("Output", juce::AudioChannelSet::stereo(), true)),
+          parameters(*this, nullptr, "Parameters", createParameterLayout()),
+          sampleEngine(parameters),
+          sampleEditEngine(sampleEngine),
+          hotReloader(sampleEngine),
+          embeddedAudio(sampleEngine),
+          modMatrix(parameters),
+          filterEngine(parameters),
+          programSwitcher(sampleEngine, parameters)
+    {
+        // Initialize voice position arrays
+        for (auto& pos : voicePositions)
+            pos.store(0.0f);
+        for (auto& active : voiceActive)
+            active.store(false);
+        
+        // Voices are created by the first prepareToPlay; plugin scans never get that far
+        synthesizer.addSound(new AdvancedSamplerSound());
+        
+        // Connect filter engine to modulation matrix
+        filterEngine.setModulationMatrix(&modMatrix);
+        
+        programSwitcher.onMidiProgramChange = [this](int index) { setCurrentProgram(index); };
+        programSwitcher.onProgramSwapped = [this](const ProgramSwitcher::PreparedProgram& program)
+        {
+            frozen = program.frozen;
+            currentProgram = program.programIndex;
+            if (program.script.has_value())
+                scriptEngine.setScript(*program.script);
+        };
+        
+        metricsExporter->addInstance(metrics);
+    }
+    
+    ~AdvancedSamplerProcessor() override;
+    
+    void prepareToPlay(double sampleRate, int samplesPerBlock) override
+    {
+        if (synthesizer.getNumVoices() == 0)
+        {
+            for (int i = 0; i < MAX_VOICES; ++i)
+            {
+                auto* voice = new AdvancedSamplerVoice(sampleEngine, modMatrix, *this, i);
+                voice->setValueTreeState(&parameters);
+                synthesizer.addVoice(voice);
+            }
+        }
+        
+        // Housekeeping timers only matter once audio runs. Offline renderers are
+        // prepared on worker threads, where timers can't be started, and don't need them.
+        if (!isNonRealtime())
+            hotReloader.start();
+        
+        synthesizer.setCurrentPlaybackSampleRate(sampleRate);
+        sampleEngine.prepareToPlay(sampleRate, samplesPerBlock);
+        modMatrix.prepareToPlay(sampleRate, samplesPerBlock);
+        filterEngine.prepareToPlay(sampleRate, samplesPerBlock, getTotalNumOutputChannels());
+        previewVoice.prepareToPlay(sampleRate, samplesPerBlock);
+        ambisonicEncoder.prepare(getChannelLayoutOfBus(false, 0), samplesPerBlock);
+        outputMeter.prepare(sampleRate);
+        scriptEngine.prepareToPlay(sampleRate);
+        
+        programFadeSamples = juce::jmax(1, (int)(sampleRate * programFadeSeconds));
+        programSwapTimeoutSamples = (int)(sampleRate * programSwapTimeoutSeconds);
+        retriggerMidi.ensureSize(4096);
+        
+        cpuLoadMeasurer.reset();
+        cpuLoadMeasurer.setSampleRate(sampleRate);
+        cpuLoadMeasurer.setBlockSize(samplesPerBlock);
+    }
+    
+    void releaseResources() override {}
+    
+    bool isBusesLayoutSupported(const BusesLayout& layouts) const override
+    {
+        // Multichannel zones play 1:1 onto these. Mono and stereo zones use the first
+        // two outputs, or are encoded to first order on the ambisonic layouts.
+        const auto output = layouts.getMainOutputChannelSet();
+        return output == juce::AudioChannelSet::stereo()
+            || output == juce::AudioChannelSet::create5point1()
+            || output == juce::AudioChannelSet::create7point1point4()
+            || output == juce::AudioChannelSet::ambisonic(1)
+            || output == juce::AudioChannelSet::ambisonic(3);
+    }
+    
+    void processBlock(juce::AudioBuffer<float>& buffer, juce::MidiBuffer& midiMessages) override
+    {
+        juce::ScopedNoDenormals noDenormals;
+        cpuLoadMeasurer.measureBlockStart();
+        pageFaultCounter.blockStart();
+        
+        // A capture starts from a reset processor, which is where its replay starts too
+        if (sessionCapture.isActive())
+        {
+            if (sessionCapture.takeResetRequest())
+                resetPlaybackState(captureSeed);
+            sessionCapture.writeBlock(buffer.getNumSamples(), midiMessages, sampleEngine.getSampleSetGeneration());
+        }
+        
+        auto totalNumInputChannels = getTotalNumInputChannels();
+        auto totalNumOutputChannels = getTotalNumOutputChannels();
+        
+        for (auto i = totalNumInputChannels; i < totalNumOutputChannels; ++i)
+            buffer.clear(i, 0, buffer.getNumSamples());
+        
+        auto stageStart = juce::Time::getHighResolutionTicks();
+        trackProgramChangeMidi(midiMessages);
+        
+        // A program is ready: fade the current one out before swapping
+        if (programSwitchState == ProgramSwitchState::idle && programSwitcher.hasReadyProgram())
+        {
+            programSwitchState = ProgramSwitchState::fadingOut;
+            programFadeRemaining = programFadeSamples;
+        }
+        
+        // Notes held across a program change are replayed on the new program
+        juce::MidiBuffer* midiToRender = &midiMessages;
+        if (retriggerHeldNotes)
+        {
+            retriggerMidi.clear();
+            for (int note = 0; note < 128; ++note)
+                if (heldNoteVelocities[(size_t)note] > 0.0f)
+                    retriggerMidi.addEvent(juce::MidiMessage::noteOn(1, note, heldNoteVelocities[(size_t)note]), 0);
+            retriggerMidi.addEvents(midiMessages, 0, -1, 0);
+            midiToRender = &retriggerMidi;
+            retriggerHeldNotes = false;
+        }
+        
+        // Articulation scripts rewrite the notes before the voices see them
+        midiToRender = &scriptEngine.process(*midiToRender, buffer.getNumSamples());
+        
+        // Voices only hear controllers while they play, so note-ons starting mod wheel
+        // crossfades read the wheel from here
+        for (const auto metadata : *midiToRender)
+        {
+            const auto* data = metadata.data;
+            if (metadata.numBytes == 3 && (data[0] & 0xf0) == 0xb0 && data[1] == 1)
+                modMatrix.setSourceValue(ModulationSource::ModWheel, data[2] / 127.0f);
+        }
+        
+        // A frozen patch has its modulation and filter baked into the zones
+        const bool bypassed = frozen.load(std::memory_order_relaxed);
+        if (bypassed)
+            modMatrix.clearDestinations();
+        else
+            modMatrix.processBlock(buffer.getNumSamples());
+        endStage(BlockStage::modulation, stageStart);
+        ambisonicEncoder.beginBlock(buffer.getNumSamples());
+        {
+            // Zones can only be swapped or removed between blocks
+            const juce::SpinLock::ScopedLockType sampleLock(sampleEngine.getRenderLock());
+            synthesizer.renderNextBlock(buffer, *midiToRender, 0, buffer.getNumSamples());
+        }
+        ambisonicEncoder.encodeInto(buffer, buffer.getNumSamples());
+        // One pass over the voices for the playback cursor and the voice count
+        int numActive = 0;
+        for (int i = 0; i < synthesizer.getNumVoices(); ++i)
+        {
+            auto* voice = static_cast<AdvancedSamplerVoice*>(synthesizer.getVoice(i));  // All voices are ours
+            if (voice->isVoiceActive())
+            {
+                currentPlaybackPosition = voice->getCurrentPlaybackPosition();
+                ++numActive;
+            }
+        }
+        activeVoiceCount = numActive;
+        endStage(BlockStage::voices, stageStart);
+        if (!bypassed)
+            filterEngine.processBlock(buffer);
+        endStage(BlockStage::filter, stageStart);
+        
+        float masterVolume = *masterVolumeParam;
+        buffer.applyGain(masterVolume);
+        
+        applyProgramSwitchFade(buffer);
+        
+        // Browser audition bypasses the filter and master volume
+        auto* previewBed = ambisonicEncoder.getBed();
+        previewVoice.renderNextBlock(previewBed != nullptr ? *previewBed : buffer, 0, buffer.getNumSamples());
+        ambisonicEncoder.encodeInto(buffer, buffer.getNumSamples());
+        
+        outputMeter.process(buffer);
+        endStage(BlockStage::output, stageStart);
+        
+        pageFaultCounter.blockEnd();
+        cpuLoadMeasurer.measureBlockEnd();
+        
+        metrics.recordBlock(cpuLoadMeasurer.getLastBlockSeconds(), buffer.getNumSamples() / getSampleRate());
+        metrics.activeVoices.store(activeVoiceCount.load(), std::memory_order_relaxed);
+        metrics.previewUnderruns.store(previewVoice.getNumUnderruns(), std::memory_order_relaxed);
+        metrics.sampleMemoryBytes.store(sampleEngine.getSampleMemoryBytes(), std::memory_order_relaxed);
+    }
+    
+    juce::AudioProcessorEditor* createEditor() override;
+    bool hasEditor() const override { return true; }
+    
+    const juce::String getName() const override { return "Advanced Sampler"; }
+    bool acceptsMidi() const override { return true; }
+    bool producesMidi() const override { return false; }
+    bool isMidiEffect() const override { return false; }
+    double getTailLengthSeconds() const override { return 0.0; }
+    
+    int getNumPrograms() override { return juce::jmax(1, presetLibrary->getNumPresets()); }
+    int getCurrentProgram() override { return currentProgram.load(); }
+    
+    // Loads the preset in the background; the swap happens in processBlock
+    void setCurrentProgram(int index) override
+    {
+        PresetInfo preset;
+        if (presetLibrary->getPreset(index, preset))
+            programSwitcher.requestProgram(index, preset.file);
+    }
+    
+    const juce::String getProgramName(int index) override
+    {
+        PresetInfo preset;
+        return presetLibrary->getPreset(index, preset) ? preset.name : juce::String();
+    }
+    
+    void changeProgramName(int, const juce::String&) override {}
+    
+    void getStateInformation(juce::MemoryBlock& destData) override
+    {
+        auto rootState = createStateTree(embeddedAudio.isEnabled());
+        rootState.setProperty("embedAudio", embeddedAudio.isEnabled(), nullptr);
+        
+        // Serialize
+        std::unique_ptr<juce::XmlElement> xml(rootState.createXml());
+        DBG("XML: " + xml->toString().substring(0, 200));  // Embedded audio makes the full text huge
+        copyXmlToBinary(*xml, destData);
+    }
+    
+    void setStateInformation(const void* data, int sizeInBytes) override
+    {
+        std::unique_ptr<juce::XmlElement> xmlState(getXmlFromBinary(data, sizeInBytes));
+        
+        DBG("=== LOADING STATE ===");
+        
+        if (xmlState != nullptr)
+        {
+            DBG("XML loaded: " + xmlState->toString().substring(0, 200));
+            applyStateTree(juce::ValueTree::fromXml(*xmlState));
+        }
+        else
+        {
+            DBG("ERROR: xmlState is null!");
+        }
+    }
+    
+    // Full plugin state (parameters + sample zones), shared by host state and presets.
+    // With embedAudio each zone also carries its audio as base64 FLAC.
+    juce::ValueTree createStateTree(bool embedAudio = false)
+    {
+        // Create root state containing everything
+        juce::ValueTree rootState("PluginState");
+        rootState.setProperty("frozen", frozen.load(), nullptr);
+        rootState.setProperty("script", scriptEngine.getScript(), nullptr);
+        
+        // Add APVTS parameters as a child
+        rootState.addChild(parameters.copyState(), -1, nullptr);
+        
+        // Add sample data as a separate child. Hosts can ask for state from any
+        // thread, so the zone list is held still meanwhile.
+        juce::ValueTree samplesState("SampleData");
+        const juce::ScopedLock zl(sampleEngine.getZoneListLock());
+        const auto& samples = sampleEngine.getAllSamples();
+        
+        DBG("=== SAVING STATE ===");
+        DBG("Number of samples: " + juce::String(samples.size()));
+        
+        for (size_t i = 0; i < samples.size(); ++i)
+        {
+            DBG("Sample " + juce::String((int)i) + " - file: " + samples[i].filePath.toString()
+                + " loopStart: " + juce::String(samples[i].loopStart) 
+                + " loopEnd: " + juce::String(samples[i].loopEnd) 
+                + " enabled: " + juce::String(samples[i].loopEnabled ? 1 : 0)
+                + " mode: " + juce::String(samples[i].loopMode));
+            
+            auto sampleState = SampleEngine::createSampleState(samples[i]);
+            if (embedAudio)
+            {
+                auto flac = embeddedAudio.getEncoded(samples[i]);
+                if (flac.getSize() > 0)
+                    sampleState.setProperty("embeddedAudio", flac.toBase64Encoding(), nullptr);
+            }
+            samplesState.addChild(sampleState, -1, nullptr);
+        }
+        rootState.addChild(samplesState, -1, nullptr);
+        return rootState;
+    }
+    
+    void applyStateTree(const juce::ValueTree& rootState)
+    {
+        if (!rootState.isValid())
+        {
+            DBG("ERROR: Root state invalid!");
+            return;
+        }
+        
+        DBG("Root state valid, type: " + rootState.getType().toString());
+        
+        // Restore APVTS - find the Parameters child
+        auto paramsState = rootState.getChildWithName("Parameters");
+        if (paramsState.isValid())
+        {
+            DBG("Found Parameters state, restoring...");
+            parameters.replaceState(paramsState);
+        }
+        else
+        {
+            DBG("WARNING: Parameters state not found!");
+        }
+        
+        frozen = (bool)rootState.getProperty("frozen", false);
+        
+        // Sample sets from a capture carry no script and leave the current one alone
+        if (rootState.hasProperty("script"))
+            scriptEngine.setScript(rootState["script"].toString());
+        
+        // Restore samples - RELOAD audio files first!
+        auto samplesState = rootState.getChildWithName("SampleData");
+        if (!samplesState.isValid())
+        {
+            DBG("WARNING: SampleData not found in state!");
+            return;
+        }
+        
+        DBG("Found SampleData with " + juce::String(samplesState.getNumChildren()) + " children");
+        
+        embeddedAudio.setEnabled(rootState.getProperty("embedAudio", false));
+        
+        // Clear existing samples
+        sampleEngine.clearSamples();
+        auto arena = sampleEngine.getCurrentArena();
+        
+        // Find each zone's audio first: embedded FLAC when the state carries it,
+        // otherwise the saved file (moved files are found again through the library index)
+        struct PendingZone
+        {
+            juce::ValueTree state;
+            juce::File file;
+            juce::MemoryBlock embedded;
+            SampleData sample;
+            bool decoded = false;
+        };
+        std::vector<PendingZone> zones;
+        
+        for (int i = 0; i < samplesState.getNumChildren(); ++i)
+        {
+            PendingZone zone;
+            zone.state = samplesState.getChild(i);
+            
+            if (zone.state.hasProperty("embeddedAudio"))
+            {
+                zone.embedded.fromBase64Encoding(zone.state.getProperty("embeddedAudio").toString());
+            }
+            else
+            {
+                juce::String filePath = zone.state.getProperty("filePath", "");
+                if (filePath.isEmpty())
+                    continue;
+                
+                zone.file = sampleRelocator.resolve(zone.state);
+                if (!zone.file.existsAsFile())
+                {
+                    DBG("WARNING: Sample file not found: " + filePath);
+                    continue;
+                }
+            }
+            zones.push_back(std::move(zone));
+        }
+        
+        // Decode all zones in parallel, then add them in their saved order
+        EmbeddedAudioCache::decodeInParallel((int)zones.size(), [this, &zones, &arena](int i)
+        {
+            auto& zone = zones[(size_t)i];
+            zone.decoded = zone.embedded.getSize() > 0
+                ? sampleEngine.decodeEmbeddedSample(zone.embedded, zone.state, zone.sample, arena)
+                : sampleEngine.decodeSample(zone.file, zone.state.getProperty("rootNote", 60), zone.sample, arena);
+        });
+        
+        for (size_t i = 0; i < zones.size(); ++i)
+        {
+            auto& zone = zones[i];
+            if (!zone.decoded)
+            {
+                DBG("WARNING: Could not decode sample: " + zone.state.getProperty("filePath", "").toString());
+                continue;
+            }
+            
+            // Restore the loop settings
+            SampleEngine::applySampleState(zone.state, zone.sample);
+            
+            DBG("Restored sample " + juce::String((int)i) + " - loopStart: " + juce::String(zone.sample.loopStart) 
+                + " loopEnd: " + juce::String(zone.sample.loopEnd) 
+                + " enabled: " + juce::String(zone.sample.loopEnabled ? 1 : 0)
+                + " mode: " + juce::String(zone.sample.loopMode));
+            
+            sampleEngine.addSample(std::move(zone.sample));
+        }
+        
+        DBG("Final sample count: " + juce::String(sampleEngine.getAllSamples().size()));
+    }
+    
+    SampleEngine& getSampleEngine() { return sampleEngine; }
+    PresetLibrary& getPresetLibrary() { return *presetLibrary; }
+    
+    // Marks a just-saved preset as current without reloading it
+    void setCurrentProgramIndex(int index) { currentProgram = index; }
+    SampleEditEngine& getSampleEditEngine() { return sampleEditEngine; }
+    EmbeddedAudioCache& getEmbeddedAudio() { return embeddedAudio; }
+    
+    void startPreview(const juce::File& file)
+    {
+        previewVoice.play(file, sampleEngine.getFormatManager(), *streamingThread);
+    }
+    
+    void stopPreview() { previewVoice.stop(); }
+    int getStreamingUnderruns() const { return previewVoice.getNumUnderruns(); }
+    const SampleIOBackend& getIOBackend() const { return streamingThread->getBackend(); }
+    juce::AudioProcessorValueTreeState& getValueTreeState() { return parameters; }
     double getCPULoad() const { return cpuLoadMeasurer.getLoad(); }
     int getActiveVoiceCount() const { return activeVoiceCount; }
+    const PageFaultCounter& getPageFaultCounter() const { return pageFaultCounter; }
+    OutputMeter& getOutputMeter() { return outputMeter; }
+    
+    // Audio thread: where mono and stereo zones render this block on ambisonic outputs
+    juce::AudioBuffer<float>* getAmbisonicBed() { return ambisonicEncoder.getBed(); }
+    
+    // True for patches made by PatchFreezer, which play without filter or modulation
+    bool isFrozen() const { return frozen.load(); }
+    
+    // Owned here rather than by the editor, so a freeze carries on when the editor
+    // closes. Created on first use.
+    PatchFreezer& getPatchFreezer();
+    bool isFreezing() const;
+    float getFreezeProgress() const;
+    
+    // Message thread. A script that doesn't compile leaves the current one playing.
+    juce::Result setScript(const juce::String& source) { return scriptEngine.setScript(source); }
+    const juce::String& getScript() const { return scriptEngine.getScript(); }
+    int getScriptBudgetOverruns() const { return scriptEngine.getBudgetOverruns(); }
+    
+    // Message thread: records from the next block on. Sounding notes are cut so the
+    // capture starts from a state a replay can reproduce.
+    bool startSessionCapture(const juce::File& file)
+    {
+        juce::MemoryBlock state;
+        getStateInformation(state);
+        
+        SessionCapture::Header header;
+        header.sampleRate = getSampleRate();
+        header.outputLayout = getChannelLayoutOfBus(false, 0).getSpeakerArrangementAsString();
+        header.maxBlockSize = getBlockSize();
+        header.seed = (juce::uint32)juce::Random::getSystemRandom().nextInt();
+        captureSeed = header.seed;
+        
+        return sessionCapture.start(file, header, state, getParameters(),
+                                    [this] { return sampleEngine.getSampleSetGeneration(); },
+                                    [this] { return createSampleSetState(); });
+    }
+    
+    void stopSessionCapture() { sessionCapture.stop(); }
+    bool isCapturingSession() const { return sessionCapture.isActive(); }
+    bool hasSessionCaptureOverflowed() const { return sessionCapture.hasOverflowed(); }
+    
+    // Just the zones, in the same format as getStateInformation
+    juce::MemoryBlock createSampleSetState()
+    {
+        juce::ValueTree rootState("PluginState");
+        rootState.setProperty("frozen", frozen.load(), nullptr);
+        rootState.addChild(createStateTree().getChildWithName("SampleData").createCopy(), -1, nullptr);
+        
+        juce::MemoryBlock data;
+        std::unique_ptr<juce::XmlElement> xml(rootState.createXml());
+        copyXmlToBinary(*xml, data);
+        return data;
+    }
+    
+    // Puts voices, modulation and the filter back to a known state, as at the start
+    // of a capture. Audio thread, or before processing starts.
+    void resetPlaybackState(juce::uint32 seed)
+    {
+        for (int i = 0; i < synthesizer.getNumVoices(); ++i)
+            static_cast<AdvancedSamplerVoice*>(synthesizer.getVoice(i))->reset();
+        
+        modMatrix.reset(seed);
+        filterEngine.reset();
+        scriptEngine.reset(seed);
+        heldNoteVelocities.fill(0.0f);
+        activeVoiceCount = 0;
+    }
+    
+    // Where the last block's time went, for diagnosing overruns. Audio thread only.
+    enum class BlockStage { modulation, voices, filter, output, numStages };
+    double getLastStageSeconds(BlockStage stage) const { return lastStageSeconds[(size_t)stage]; }
+    static const char* getStageName(BlockStage stage)
+    {
+        switch (stage)
+        {
+            case BlockStage::modulation: return "modulation";
+            case BlockStage::voices:     return "voices";
+            case BlockStage::filter:     return "filter";
+            case BlockStage::output:     return "output";
+            default:                     return "";
+        }
+    }
+    
+    std::atomic<double> currentPlaybackPosition{0.0}; // 0.0 to 1.0
+    
+    // Voice position tracking for multi-playhead display
+    static constexpr int MAX_VOICES = 16;
+    std::array<std::atomic<float>, MAX_VOICES> voicePositions;
+    std::array<std::atomic<bool>, MAX_VOICES> voiceActive;
+    
+private:
+    enum class ProgramSwitchState { idle, fadingOut, swapping, fadingIn };
+    
+    void endStage(BlockStage stage, juce::int64& stageStart)
+    {
+        auto now = juce::Time::getHighResolutionTicks();
+        lastStageSeconds[(size_t)stage] = juce::Time::highResolutionTicksToSeconds(now - stageStart);
+        stageStart = now;
+    }
+    
+    void trackProgramChangeMidi(const juce::MidiBuffer& midiMessages)
+    {
+        for (const auto metadata : midiMessages)
+        {
+            auto message = metadata.getMessage();
+            if (message.isNoteOn())
+                heldNoteVelocities[(size_t)message.getNoteNumber()] = message.getFloatVelocity();
+            else if (message.isNoteOff())
+                heldNoteVelocities[(size_t)message.getNoteNumber()] = 0.0f;
+            else if (message.isProgramChange())
+                requestProgramFromMidi(message.getProgramChangeNumber());
+        }
+    }
+    
+    void requestProgramFromMidi(int programIndex)
+    {
+        if (!isNonRealtime())
+        {
+            programSwitcher.requestProgramFromMidi(programIndex);
+            return;
+        }
+        
+        // Offline renders can block, so the program loads right here
+        PresetInfo preset;
+        presetLibrary->waitUntilIndexed(presetIndexTimeoutMs);
+        if (presetLibrary->getPreset(programIndex, preset))
+            programSwitcher.loadNow(programIndex, preset.file);
+    }
+    
+    // Offline renders swap on the render thread. An open editor reads the zones on
+    // the message thread without a lock, so it is held off for the swap.
+    void swapProgramNow()
+    {
+        std::optional<juce::MessageManagerLock> mml;
+        if (getActiveEditor() != nullptr && !juce::MessageManager::existsAndIsCurrentThread())
+            mml.emplace();
+        programSwitcher.swapNow();
+    }
+    
+    // Fades out over programFadeSeconds and swaps the zones, then fades back in.
+    // Live, the message thread swaps while the output is silent; if it doesn't get
+    // to it within programSwapTimeoutSeconds the old program fades back in and the
+    // swap is retried later. Offline renders swap at once, so every run matches.
+    void applyProgramSwitchFade(juce::AudioBuffer<float>& buffer)
+    {
+        int numSamples = buffer.getNumSamples();
+        float fadeLength = (float)programFadeSamples;
+        
+        if (programSwitchState == ProgramSwitchState::fadingOut)
+        {
+            int fadeSamples = juce::jmin(numSamples, programFadeRemaining);
+            buffer.applyGainRamp(0, fadeSamples, programFadeRemaining / fadeLength,
+                                 (programFadeRemaining - fadeSamples) / fadeLength);
+            buffer.clear(fadeSamples, numSamples - fadeSamples);
+            programFadeRemaining -= fadeSamples;
+            
+            if (programFadeRemaining == 0)
+            {
+                synthesizer.allNotesOff(0, false);
+                
+                if (isNonRealtime())
+                {
+                    swapProgramNow();
+                    retriggerHeldNotes = true;
+                    programSwitchState = ProgramSwitchState::fadingIn;
+                    programFadeRemaining = programFadeSamples;
+                }
+                else
+                {
+                    programSwitcher.requestSwap();
+                    programSwitchState = ProgramSwitchState::swapping;
+                    programSwapWaited = 0;
+                }
+            }
+        }
+        else if (programSwitchState == ProgramSwitchState::swapping)
+        {
+            buffer.clear();
+            programSwapWaited += numSamples;
+            
+            if (programSwitcher.takeSwapDone()
+                 || (programSwapWaited >= programSwapTimeoutSamples && programSwitcher.cancelSwap()))
+            {
+                retriggerHeldNotes = true;
+                programSwitchState = ProgramSwitchState::fadingIn;
+                programFadeRemaining = programFadeSamples;
+            }
+        }
+        else if (programSwitchState == ProgramSwitchState::fadingIn)
+        {
+            int fadeSamples = juce::jmin(numSamples, programFadeRemaining);
+            buffer.applyGainRamp(0, fadeSamples, 1.0f - programFadeRemaining / fadeLength,
+                                 1.0f - (programFadeRemaining - fadeSamples) / fadeLength);
+            programFadeRemaining -= fadeSamples;
+            
+            if (programFadeRemaining == 0)
+                programSwitchState = ProgramSwitchState::idle;
+        }
+    }
+    
+    static juce::AudioProcessorValueTreeState::ParameterLayout createParameterLayout()
+    {
+        std::vector<std::unique_ptr<juce::RangedAudioParameter>> params;
+        params.reserve(9 + 3 * lfoParameterIDs.size());
+        
+        params.push_back(std::make_unique<juce::AudioParameterFloat>("master_volume", "Master Volume", 0.0f, 1.0f, 0.7f));
+        params.push_back(std::make_unique<juce::AudioParameterFloat>("env_attack", "Attack", 0.0f, 5.0f, 0.01f));
+        params.push_back(std::make_unique<juce::AudioParameterFloat>("env_decay", "Decay", 0.0f, 5.0f, 0.1f));
+        params.push_back(std::make_unique<juce::AudioParameterFloat>("env_sustain", "Sustain", 0.0f, 1.0f, 0.8f));
+        params.push_back(std::make_unique<juce::AudioParameterFloat>("env_release", "Release", 0.0f, 10.0f, 0.5f));
+        params.push_back(std::make_unique<juce::AudioParameterFloat>("filter_cutoff", "Filter Cutoff", 20.0f, 20000.0f, 1000.0f));
+        params.push_back(std::make_unique<juce::AudioParameterFloat>("filter_resonance", "Filter Resonance", 0.1f, 10.0f, 1.0f));
+        params.push_back(std::make_unique<juce::AudioParameterChoice>("interpolation", "Interpolation",
+            juce::StringArray{"Linear", "Cubic"}, 0));
+        params.push_back(std::make_unique<juce::AudioParameterChoice>("layer_crossfade", "Layer Crossfade",
+            juce::StringArray{"Off", "Velocity", "Mod Wheel"}, 0));
+        
+        for (const auto& ids : lfoParameterIDs)
+        {
+            params.push_back(std::make_unique<juce::AudioParameterFloat>(ids.rate, ids.rateName, 0.01f, 20.0f, 1.0f));
+            params.push_back(std::make_unique<juce::AudioParameterFloat>(ids.amount, ids.amountName, 0.0f, 1.0f, 0.0f));
+            params.push_back(std::make_unique<juce::AudioParameterChoice>(ids.waveform, ids.waveformName,
+                juce::StringArray{"Sine", "Triangle", "Square", "Sawtooth", "Random"}, 0));
+        }
+        
+        return { params.begin(), params.end() };
+    }
+    
+    juce::AudioProcessorValueTreeState parameters;
+    SampleEngine sampleEngine;
+    SampleEditEngine sampleEditEngine;
+    SampleHotReloader hotReloader;
+    EmbeddedAudioCache embeddedAudio;
+    SampleRelocator sampleRelocator;
+    ModulationMatrix modMatrix;
+    FilterEngine filterEngine;
+    juce::Synthesiser synthesizer;
+    juce::SharedResourcePointer<SampleStreamingThread> streamingThread;
+    PreviewVoice previewVoice;
+    juce::SharedResourcePointer<PresetLibrary> presetLibrary;
+    ProgramSwitcher programSwitcher;
+    std::atomic<int> currentProgram{0};
+    
+    static constexpr double programFadeSeconds = 0.01;
+    static constexpr double programSwapTimeoutSeconds = 0.25;
+    static constexpr int presetIndexTimeoutMs = 30000;
+    ProgramSwitchState programSwitchState = ProgramSwitchState::idle;
+    int programFadeSamples = 441;
+    int programFadeRemaining = 0;
+    int programSwapTimeoutSamples = 11025;
+    int programSwapWaited = 0;
+    std::array<float, 128> heldNoteVelocities {};
+    bool retriggerHeldNotes = false;
+    juce::MidiBuffer retriggerMidi;
+    std::atomic<int> activeVoiceCount{0};
+    std::atomic<bool> frozen{false};
+    std::atomic<float>* masterVolumeParam = parameters.getRawParameterValue("master_volume");
+    
+    class CPULoadMeasurer
+    {
+    public:
+        void reset()
+        {
+            load = 0.0;
+        }
+        
+        void setSampleRate(double sr)
+        {
+            sampleRate = sr;
+        }
+        
+        void setBlockSize(int bs)
+        {
+            blockSize = bs;
+        }
+        
+        void measureBlockStart()
+        {
+            blockStartTime = juce::Time::getHighResolutionTicks();
+        }
+        
+        void measureBlockEnd()
+        {
+            auto blockEndTime = juce::Time::getHighResolutionTicks();
+            auto elapsedTicks = blockEndTime - blockStartTime;
+            auto elapsedSeconds = juce::Time::highResolutionTicksToSeconds(elapsedTicks);
+            auto expectedSeconds = blockSize / sampleRate;
+            lastBlockSeconds = elapsedSeconds;
+            
+            if (expectedSeconds > 0.0)
+            {
+                load = (elapsedSeconds / expectedSeconds) * 100.0;
+                load = juce::jlimit(0.0, 100.0, load);
+            }
+        }
+        
+        double getLoad() const { return load; }
+        double getLastBlockSeconds() const { return lastBlockSeconds; }
+        
+    private:
+        double sampleRate = 44100.0;
+        int blockSize = 512;
+        juce::int64 blockStartTime = 0;
+        double load = 0.0;
+        double lastBlockSeconds = 0.0;
+    };
+    
+    CPULoadMeasurer cpuLoadMeasurer;
+    PageFaultCounter pageFaultCounter;
+    OutputMeter outputMeter;
+    StereoAmbisonicEncoder ambisonicEncoder;
+    InstanceMetrics metrics;
+    SessionCapture sessionCapture;
+    juce::uint32 captureSeed = 1;
+    ScriptEngine scriptEngine;
+    std::array<double, (size_t)BlockStage::numStages> lastStageSeconds {};
+    juce::SharedResourcePointer<MetricsExporter> metricsExporter;
+    std::unique_ptr<PatchFreezer> patchFreezer;
+    
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(AdvancedSamplerProcessor)
+};
+
+//==============================================================================
+// VOICE METHOD IMPLEMENTATIONS (defined after processor is complete)
+//==============================================================================
+
+inline AdvancedSamplerVoice::AdvancedSamplerVoice(SampleEngine& sampleEng, ModulationMatrix& modMatrix, 
+                                                   AdvancedSamplerProcessor& proc, int index)
+    : sampleEngine(sampleEng), modulationMatrix(modMatrix), processor(proc), voiceIndex(index)
+{
+    adsrParams.attack = 0.01f;
+    adsrParams.decay = 0.1f;
+    adsrParams.sustain = 0.8f;
+    adsrParams.release = 0.5f;
+    adsr.setParameters(adsrParams);
+}
+
+inline void AdvancedSamplerVoice::startNote(int midiNoteNumber, float vel, juce::SynthesiserSound*, int)
+{
+    updateADSRParams();
+    
+    currentSample = sampleEngine.getSampleForNote(midiNoteNumber, juce::jlimit(1, 127, juce::roundToInt(vel * 127.0f)));
+    if (currentSample == nullptr || currentSample->audioData.getNumSamples() == 0)
+    {
+        clearCurrentNote();
+        processor.voiceActive[voiceIndex].store(false);
+        return;
+    }
+   
+    if (currentSample != nullptr)
+    {
+        noteNumber = midiNoteNumber;
+        velocity = vel;
+        sampleSetGeneration = sampleEngine.getSampleSetGeneration();
+        
+        // With crossfading on, the note plays the two layers either side of the control
+        layerControl = layerCrossfadeParam != nullptr
+                     ? (LayerControl)juce::roundToInt(layerCrossfadeParam->load())
+                     : LayerControl::off;
+        upperSample = nullptr;
+        numLayers = layerControl != LayerControl::off ? sampleEngine.getLayersForNote(midiNoteNumber, layers) : 0;
+        if (numLayers >= 2)
+        {
+            float control = getLayerControlValue();
+            layerIndex = findLayerPair(control);
+            currentSample = layers[(size_t)layerIndex];
+            upperSample = layers[(size_t)layerIndex + 1];
+            upperIncrement = getPositionIncrement(*upperSample);
+            upperIncrementSampleRate = upperSample->sampleRate;
+            upperPosition = 0.0;
+            upperLoopingForward = true;
+            setTargetLayerGains(control);
+            layerGains = targetLayerGains;
+        }
+        
+        positionIncrement = getPositionIncrement(*currentSample);
+        incrementSampleRate = currentSample->sampleRate;
+        currentPosition = 0.0;
+        loopingForward = true;
+        
+        interpolationMode = interpolationParam != nullptr && interpolationParam->load() >= 0.5f
+                          ? KernelInterpolation::cubic : KernelInterpolation::linear;
+        selectKernel(processor.getTotalNumOutputChannels());
+        
+        modulationMatrix.setSourceValue(ModulationSource::Velocity, velocity);
+        modulationMatrix.setSourceValue(ModulationSource::KeyTrack, (float)midiNoteNumber / 127.0f);
+        
+        adsr.noteOn();
+        processor.voiceActive[voiceIndex].store(true);
+    }
+}
+
+inline void AdvancedSamplerVoice::reset()
+{
+    adsr.reset();
+    currentSample = nullptr;
+    upperSample = nullptr;
+    clearCurrentNote();
+    processor.voiceActive[voiceIndex].store(false);
+    processor.voicePositions[voiceIndex].store(0.0f);
+}
+
+inline void AdvancedSamplerVoice::renderNextBlock(juce::AudioBuffer<float>& outputBuffer, int startSample, int numSamples)
+{
+    if (currentSample == nullptr && !isVoiceActive())
+        return;  // Already released; idle voices cost nothing per block
     
-    std::atomic<double> currentPlaybackPosition{0.0}; // 0.0 to 1.0
+    if (currentSample == nullptr || !adsr.isActive()
+        || sampleSetGeneration != sampleEngine.getSampleSetGeneration())
+    {
+        currentSample = nullptr;
+        upperSample = nullptr;
+        clearCurrentNote();
+        processor.voiceActive[voiceIndex].store(false);
+        processor.voicePositions[voiceIndex].store(0.0f);
+        return;
+    }
     
-    // Voice position tracking for multi-playhead display
-    static constexpr int MAX_VOICES = 16;
-    std::array<std::atomic<float>, MAX_VOICES> voicePositions;
-    std::array<std::atomic<bool>, MAX_VOICES> voiceActive;
+    if (upperSample != nullptr && layerControl == LayerControl::modWheel)
+        updateLayers();
+    
+    // On ambisonic outputs the processor encodes mono and stereo zones from its bed
+    auto* target = &outputBuffer;
+    if (auto* bed = processor.getAmbisonicBed(); bed != nullptr && currentSample->audioData.getNumChannels() <= 2)
+        target = bed;
+    
+    // Loop settings can be changed and zones edited or reloaded while a note sounds
+    followSampleRateChanges();
+    if (getKernelIndex(target->getNumChannels()) != kernelIndex)
+        selectKernel(target->getNumChannels());
+    
+    (this->*kernel)(*target, startSample, numSamples);
+    layerGains = targetLayerGains;
+}
+
+template <AdvancedSamplerVoice::KernelLoop loop,
+          AdvancedSamplerVoice::KernelChannels channels,
+          AdvancedSamplerVoice::KernelInterpolation interpolation,
+          AdvancedSamplerVoice::KernelLayers layering>
+inline void AdvancedSamplerVoice::renderKernel(juce::AudioBuffer<float>& outputBuffer, int startSample, int numSamples)
+{
+    if (outputBuffer.getNumChannels() < 2)
+        return;
+    
+    constexpr int fixedChannels = getFixedChannelCount(channels);
+    constexpr bool crossfade = layering == KernelLayers::crossfade;
+    constexpr int stride = channels == KernelChannels::interleavedStereo ? 2 : 1;
+    
+    // N-channel zones: zone channel i plays on output channel i
+    int numChannels = 0;
+    if constexpr (fixedChannels > 0)
+    {
+        numChannels = fixedChannels;
+    }
+    else if constexpr (fixedChannels == 0)
+    {
+        numChannels = juce::jmin(currentSample->audioData.getNumChannels(), outputBuffer.getNumChannels(), maxKernelChannels);
+        if constexpr (crossfade)
+            numChannels = juce::jmin(numChannels, upperSample->audioData.getNumChannels());
+    }
+    
+    KernelSource lower, upper;
+    getKernelSource<channels>(*currentSample, numChannels, lower);
+    if constexpr (crossfade)
+        getKernelSource<channels>(*upperSample, numChannels, upper);
     
+    std::array<float*, maxKernelChannels> outs {};
+    float* outLeft = nullptr;
+    float* outRight = nullptr;
+    
+    if constexpr (fixedChannels >= 0)
+    {
+        for (int ch = 0; ch < numChannels; ++ch)
+            outs[(size_t)ch] = outputBuffer.getWritePointer(ch, startSample);
+    }
+    else
+    {
+        outLeft = outputBuffer.getWritePointer(0, startSample);
+        outRight = outputBuffer.getWritePointer(1, startSample);
+    }
+    
+    // Modulation is updated once per block, so the pitch factor is block-constant
+    float pitchMod = modulationMatrix.getModulationValue(ModulationDestination::Pitch);
+    const double pitchFactor = std::pow(2.0, pitchMod);
+    const double increment = positionIncrement * pitchFactor;
+    const double upperLayerIncrement = upperIncrement * pitchFactor;
+    
+    // Layer gains ramp to this block's target, so mod wheel moves don't zipper
+    float lowerLayerGain = 1.0f, upperLayerGain = 0.0f;
+    float lowerLayerStep = 0.0f, upperLayerStep = 0.0f;
+    if constexpr (crossfade)
+    {
+        lowerLayerGain = layerGains[0];
+        upperLayerGain = layerGains[1];
+        lowerLayerStep = (targetLayerGains[0] - lowerLayerGain) / (float)numSamples;
+        upperLayerStep = (targetLayerGains[1] - upperLayerGain) / (float)numSamples;
+    }
+    
+    // Update normalized position for GUI display
+    normalizedPosition = (float)(currentPosition / lower.length);
+    processor.voicePositions[voiceIndex].store(normalizedPosition);
+    
+    for (int sample = 0; sample < numSamples; ++sample)
+    {
+        float gain = adsr.getNextSample() * velocity;
+        
+        // A layer outside its audio reads frame 0 at zero gain, so both layers
+        // are always read and mixed in registers before touching the output
+        bool audible = false;
+        int lowerIndex = 0, upperIndex = 0;
+        float lowerFraction = 0.0f, upperFraction = 0.0f;
+        float lowerGain = 0.0f, upperGain = 0.0f;
+        
+        if (currentPosition >= 0 && currentPosition < lower.length)
+        {
+            lowerIndex = (int)currentPosition;
+            lowerFraction = (float)(currentPosition - lowerIndex);
+            lowerGain = gain * lowerLayerGain;
+            audible = true;
+        }
+        
+        if constexpr (crossfade)
+        {
+            if (upperPosition >= 0 && upperPosition < upper.length)
+            {
+                upperIndex = (int)upperPosition;
+                upperFraction = (float)(upperPosition - upperIndex);
+                upperGain = gain * upperLayerGain;
+                audible = true;
+            }
+            lowerLayerGain += lowerLayerStep;
+            upperLayerGain += upperLayerStep;
+        }
+        
+        if (audible)
+        {
+            if constexpr (fixedChannels >= 0)
+            {
+                // Unrolled by the compiler for the fixed counts
+                for (int ch = 0; ch < numChannels; ++ch)
+                {
+                    float value = interpolate<interpolation>(lower.ins[(size_t)ch], lowerIndex, 1, lowerFraction) * lowerGain;
+                    if constexpr (crossfade)
+                        value += interpolate<interpolation>(upper.ins[(size_t)ch], upperIndex, 1, upperFraction) * upperGain;
+                    outs[(size_t)ch][sample] += value;
+                }
+            }
+            else
+            {
+                float leftSample = interpolate<interpolation>(lower.left, lowerIndex, stride, lowerFraction);
+                float rightSample = leftSample;
+                
+                if constexpr (channels != KernelChannels::mono)
+                    rightSample = interpolate<interpolation>(lower.right, lowerIndex, stride, lowerFraction);
+                
+                leftSample *= lowerGain;
+                rightSample *= lowerGain;
+                
+                if constexpr (crossfade)
+                {
+                    float upperLeft = interpolate<interpolation>(upper.left, upperIndex, stride, upperFraction);
+                    float upperRight = upperLeft;
+                    
+                    if constexpr (channels != KernelChannels::mono)
+                        upperRight = interpolate<interpolation>(upper.right, upperIndex, stride, upperFraction);
+                    
+                    leftSample += upperLeft * upperGain;
+                    rightSample += upperRight * upperGain;
+                }
+                
+                outLeft[sample] += leftSample;
+                outRight[sample] += rightSample;
+            }
+        }
+        
+        // Both layers follow the lower one's loop mode, each with its own loop points;
+        // the note ends once neither has audio left
+        bool reachedEnd = advancePosition<loop>(currentPosition, loopingForward, increment, lower);
+        if constexpr (crossfade)
+            reachedEnd = advancePosition<loop>(upperPosition, upperLoopingForward, upperLayerIncrement, upper) && reachedEnd;
+        
+        if (reachedEnd)
+        {
+            if (adsr.isActive())
+                adsr.noteOff();
+            break;
+        }
+        
+        if (!adsr.isActive())
+        {
+            clearCurrentNote();
+            processor.voiceActive[voiceIndex].store(false);
+            processor.voicePositions[voiceIndex].store(0.0f);
+            break;
+        }
+    }
+}
+
+//==============================================================================
+// SESSION REPLAY
+//==============================================================================
+// Feeds a capture written by SessionCapture to a processor block by block, for
+// profiling a reported passage headless. The processor is prepared and reset the
+// same way as at the start of the capture, so its output matches bit for bit as
+// long as the capture didn't overflow and nothing outside it (a program change,
+// an edit or a hot reload) changed the zones' audio while recording.
+class SessionReplay
+{
+public:
+    struct Block
+    {
+        juce::uint32 generation = 0;
+        int numSamples = 0;
+        std::vector<std::pair<int, float>> parameterChanges;
+        juce::MidiBuffer midi;
+    };
+
+    bool load(const juce::File& file)
+    {
+        juce::MemoryBlock data;
+        if (!file.loadFileAsData(data))
+            return false;
+
+        juce::MemoryInputStream in(data, false);
+        char magic[4] = {};
+        in.read(magic, 4);
+        if (std::memcmp(magic, "ASCP", 4) != 0 || (juce::uint32)in.readInt() != SessionCapture::fileVersion)
+            return false;
+
+        header.sampleRate = in.readDouble();
+        header.outputLayout = in.readString();
+        header.maxBlockSize = in.readInt();
+        header.seed = (juce::uint32)in.readInt();
+
+        parameterIDs.clear();
+        for (int i = in.readInt(); --i >= 0;)
+            parameterIDs.add(in.readString());
+
+        auto stateSize = in.readInt();
+        if (stateSize < 0 || stateSize > in.getNumBytesRemaining())
+            return false;
+        initialState.setSize((size_t)stateSize);
+        in.read(initialState.getData(), stateSize);
+
+        blocks.clear();
+        sampleSets.clear();
+        maxBlockSize = header.maxBlockSize;
+        std::vector<juce::uint8> message;
+
+        while (!in.isExhausted())
+        {
+            auto type = in.readByte();
+            if (type == 'B')
+            {
+                Block block;
+                block.generation = (juce::uint32)in.readInt();
+                block.numSamples = in.readInt();
+
+                for (int i = (juce::uint16)in.readShort(); --i >= 0;)
+                {
+                    int index = (juce::uint16)in.readShort();
+                    block.parameterChanges.emplace_back(index, in.readFloat());
+                }
+
+                for (int i = in.readInt(); --i >= 0;)
+                {
+                    int position = in.readInt();
+                    message.resize((juce::uint16)in.readShort());
+                    in.read(message.data(), (int)message.size());
+                    block.midi.addEvent(message.data(), (int)message.size(), position);
+                }
+
+                maxBlockSize = juce::jmax(maxBlockSize, block.numSamples);
+                blocks.push_back(std::move(block));
+            }
+            else if (type == 'S')
+            {
+                auto generation = (juce::uint32)in.readInt();
+                juce::MemoryBlock zones((size_t)juce::jmax(0, in.readInt()));
+                in.read(zones.getData(), (int)zones.getSize());
+                sampleSets[generation] = std::move(zones);
+            }
+            else
+            {
+                return false;  // Corrupt, or cut off mid-record
+            }
+        }
+
+        return true;
+    }
+
+    // Runs the whole capture and returns the time spent in processBlock.
+    // onBlock sees every output block, e.g. to compare against a reference render.
+    double replay(AdvancedSamplerProcessor& processor,
+                  const std::function<void(int, const juce::AudioBuffer<float>&)>& onBlock = {}) const
+    {
+        auto layout = juce::AudioChannelSet::fromAbbreviatedString(header.outputLayout);
+        if (!layout.isDisabled())
+        {
+            juce::AudioProcessor::BusesLayout buses;
+            buses.outputBuses.add(layout);
+            if (!processor.setBusesLayout(buses))
+                DBG("Replay: output layout " + header.outputLayout + " not accepted");
+        }
+
+        processor.setStateInformation(initialState.getData(), (int)initialState.getSize());
+        processor.setRateAndBufferSizeDetails(header.sampleRate, maxBlockSize);
+        processor.prepareToPlay(header.sampleRate, maxBlockSize);
+        processor.resetPlaybackState(header.seed);
+
+        // Parameters are matched by ID, so a capture survives parameters being added
+        std::vector<juce::AudioProcessorParameter*> mapped;
+        for (const auto& id : parameterIDs)
+        {
+            juce::AudioProcessorParameter* match = nullptr;
+            for (auto* parameter : processor.getParameters())
+                if (auto* withID = dynamic_cast<juce::AudioProcessorParameterWithID*>(parameter); withID != nullptr && withID->paramID == id)
+                    match = parameter;
+            mapped.push_back(match);
+        }
+
+        juce::AudioBuffer<float> buffer(processor.getTotalNumOutputChannels(), maxBlockSize);
+        juce::MidiBuffer midi;
+        double seconds = 0.0;
+
+        for (size_t i = 0; i < blocks.size(); ++i)
+        {
+            const auto& block = blocks[i];
+
+            if (i > 0 && block.generation != blocks[i - 1].generation)
+            {
+                auto zones = sampleSets.find(block.generation);
+                if (zones != sampleSets.end())
+                    processor.setStateInformation(zones->second.getData(), (int)zones->second.getSize());
+            }
+
+            for (const auto& [index, value] : block.parameterChanges)
+                if (index < (int)mapped.size() && mapped[(size_t)index] != nullptr)
+                    mapped[(size_t)index]->setValueNotifyingHost(value);
+
+            buffer.setSize(buffer.getNumChannels(), block.numSamples, false, false, true);
+            midi = block.midi;
+
+            auto start = juce::Time::getHighResolutionTicks();
+            processor.processBlock(buffer, midi);
+            seconds += juce::Time::highResolutionTicksToSeconds(juce::Time::getHighResolutionTicks() - start);
+
+            if (onBlock)
+                onBlock((int)i, buffer);
+        }
+
+        processor.releaseResources();
+        return seconds;
+    }
+
+    int getNumBlocks() const { return (int)blocks.size(); }
+    double getSampleRate() const { return header.sampleRate; }
+
+private:
+    SessionCapture::Header header;
+    juce::StringArray parameterIDs;
+    juce::MemoryBlock initialState;
+    std::vector<Block> blocks;
+    std::map<juce::uint32, juce::MemoryBlock> sampleSets;
+    int maxBlockSize = 512;
+};
+
+//==============================================================================
+// OFFLINE RENDERER
+//==============================================================================
+// Renders MIDI through the sampler to a WAV file, as fast as the CPU allows. A
+// renderer owns its processor and keeps the instrument loaded between jobs that
+// use the same state file, so a batch of stems only loads its samples once.
+// Instruments are loaded with the message thread locked (the parameter tree
+// syncs from it), so call this from the message thread or while a message loop runs.
+struct RenderJob
+{
+    juce::File stateFile;   // A preset, or plugin state saved by a host
+    juce::File midiFile;
+    juce::File outputFile;  // WAV, replaced only once the render is complete
+    double sampleRate = 48000.0;
+    int blockSize = 512;
+    int bitsPerSample = 24;
+    double tailSeconds = 2.0;  // Rendered past the last MIDI event so releases ring out
+
+    // Jobs with the same key can reuse a loaded instrument
+    juce::String getStateKey() const
+    {
+        return stateFile.getFullPathName() + "|" + juce::String(stateFile.getLastModificationTime().toMilliseconds());
+    }
+};
+
+class OfflineRenderer
+{
+public:
+    ~OfflineRenderer()
+    {
+        const juce::MessageManagerLock mml;
+        processor.reset();
+    }
+
+    // shouldContinue is polled once per block, so long renders can be abandoned
+    juce::Result render(const RenderJob& job, const std::function<bool()>& shouldContinue = {})
+    {
+        juce::MidiMessageSequence events;
+        if (!readMidi(job.midiFile, events))
+            return juce::Result::fail("Can't read MIDI file " + job.midiFile.getFullPathName());
+
+        if (auto loaded = loadState(job); loaded.failed())
+            return loaded;
+
+        juce::TemporaryFile temp(job.outputFile);
+        auto stream = std::make_unique<juce::FileOutputStream>(temp.getFile());
+        if (!stream->openedOk())
+            return juce::Result::fail("Can't write " + job.outputFile.getFullPathName());
+
+        auto numChannels = processor->getTotalNumOutputChannels();
+        juce::WavAudioFormat wav;
+        std::unique_ptr<juce::AudioFormatWriter> writer(wav.createWriterFor(stream.get(), job.sampleRate,
+                                                                            (unsigned int)numChannels,
+                                                                            job.bitsPerSample, {}, 0));
+        if (writer == nullptr)
+            return juce::Result::fail("Unsupported WAV format");
+        stream.release();  // Owned by the writer now
+
+        processor->setNonRealtime(true);
+        processor->setRateAndBufferSizeDetails(job.sampleRate, job.blockSize);
+        processor->prepareToPlay(job.sampleRate, job.blockSize);
+        processor->resetPlaybackState(1);
+
+        auto totalSamples = (juce::int64)std::ceil((events.getEndTime() + job.tailSeconds) * job.sampleRate);
+        juce::AudioBuffer<float> buffer(numChannels, job.blockSize);
+        juce::MidiBuffer midi;
+        int nextEvent = 0;
+        bool completed = true;
+
+        for (juce::int64 position = 0; position < totalSamples; position += job.blockSize)
+        {
+            if (shouldContinue && !shouldContinue())
+            {
+                completed = false;
+                break;
+            }
+
+            auto numSamples = (int)juce::jmin((juce::int64)job.blockSize, totalSamples - position);
+
+            midi.clear();
+            for (; nextEvent < events.getNumEvents(); ++nextEvent)
+            {
+                const auto& message = events.getEventPointer(nextEvent)->message;
+                auto eventPosition = (juce::int64)(message.getTimeStamp() * job.sampleRate);
+                if (eventPosition >= position + numSamples)
+                    break;
+
+                if (!message.isMetaEvent())
+                    midi.addEvent(message, (int)juce::jmax((juce::int64)0, eventPosition - position));
+            }
+
+            buffer.setSize(numChannels, numSamples, false, false, true);
+            processor->processBlock(buffer, midi);
+
+            if (!writer->writeFromAudioSampleBuffer(buffer, 0, numSamples))
+            {
+                processor->releaseResources();
+                return juce::Result::fail("Write failed for " + job.outputFile.getFullPathName());
+            }
+        }
+
+        processor->releaseResources();
+        writer.reset();
+
+        if (!completed)
+            return juce::Result::fail("Cancelled");
+        if (!temp.overwriteTargetFileWithTemporary())
+            return juce::Result::fail("Can't replace " + job.outputFile.getFullPathName());
+        return juce::Result::ok();
+    }
+
+    const juce::String& getLoadedStateKey() const { return loadedStateKey; }
+
+private:
+    static bool readMidi(const juce::File& file, juce::MidiMessageSequence& events)
+    {
+        juce::FileInputStream in(file);
+        juce::MidiFile midiFile;
+        if (!in.openedOk() || !midiFile.readFrom(in))
+            return false;
+
+        midiFile.convertTimestampTicksToSeconds();
+        for (int track = 0; track < midiFile.getNumTracks(); ++track)
+            events.addSequence(*midiFile.getTrack(track), 0.0);
+        return true;
+    }
+
+    juce::Result loadState(const RenderJob& job)
+    {
+        auto key = job.getStateKey();
+        if (processor != nullptr && key == loadedStateKey)
+            return juce::Result::ok();
+
+        juce::MemoryBlock data;
+        if (!job.stateFile.loadFileAsData(data))
+            return juce::Result::fail("Can't read state file " + job.stateFile.getFullPathName());
+
+        // Gives up if the calling worker is asked to stop while waiting for the lock
+        const juce::MessageManagerLock mml(juce::Thread::getCurrentThread());
+        if (!mml.lockWasGained())
+            return juce::Result::fail("Cancelled");
+
+        if (processor == nullptr)
+            processor = std::make_unique<AdvancedSamplerProcessor>();
+
+        // Presets are plain XML; host state is JUCE's binary-wrapped XML
+        if (auto xml = juce::parseXML(data.toString()))
+            processor->applyStateTree(juce::ValueTree::fromXml(*xml));
+        else
+            processor->setStateInformation(data.getData(), (int)data.getSize());
+
+        loadedStateKey = key;
+        return juce::Result::ok();
+    }
+
+    std::unique_ptr<AdvancedSamplerProcessor> processor;
+    juce::String loadedStateKey;
+};
+
+//==============================================================================
+// RENDER DAEMON
+//==============================================================================
+// A long-running render worker that keeps instruments warm and takes jobs over a
+// Unix domain socket, one JSON object per line:
+//     {"state": "/path/strings.xml", "midi": "/path/part.mid", "output": "/path/stem.wav",
+//      "sampleRate": 48000, "tail": 2.0, "bitsPerSample": 24}
+// Each job is answered on its connection once rendered, also as one JSON line:
+//     {"output": "/path/stem.wav", "ok": true, "seconds": 3.2}
+// There is one worker per core. A worker prefers queued jobs for the instrument it
+// already has loaded, and all workers share decoded samples through the sample
+// server, which the daemon runs in-process unless one is already running.
+class RenderDaemon : private juce::Thread
+{
+public:
+    explicit RenderDaemon(int numWorkersToUse = juce::SystemStats::getNumCpus())
+        : juce::Thread("Render Daemon"), numWorkers(juce::jmax(1, numWorkersToUse)) {}
+
+    ~RenderDaemon() override
+    {
+        stop();
+    }
+
+    // In the user's runtime directory; set ADVANCED_SAMPLER_RENDER_SOCKET to listen
+    // somewhere else. Empty when there is no private directory to put it in.
+    static juce::String getDefaultSocketPath()
+    {
+        auto configured = juce::SystemStats::getEnvironmentVariable("ADVANCED_SAMPLER_RENDER_SOCKET", {});
+        if (configured.isNotEmpty())
+            return configured;
+
+       #if JUCE_LINUX || JUCE_BSD || JUCE_MAC || JUCE_ANDROID
+        auto folder = LocalSocket::getRuntimeDirectory();
+        if (folder != juce::File())
+            return folder.getChildFile("advanced-sampler-render.sock").getFullPathName();
+       #endif
+        return {};
+    }
+
+    // False when the socket can't be bound, or another daemon is listening on it
+    bool start(const juce::String& path)
+    {
+       #if JUCE_LINUX || JUCE_BSD || JUCE_MAC || JUCE_ANDROID
+        stop();
+
+        listenFd = LocalSocket::listenOn(path, 16);
+        if (listenFd < 0)
+            return false;
+        socketPath = path;
+
+        if (!SampleServer::isRunning())
+        {
+            sampleServer = std::make_unique<SampleServer>();
+            if (!sampleServer->start())
+                sampleServer.reset();  // Workers then decode their own copies
+        }
+
+        for (int i = 0; i < numWorkers; ++i)
+        {
+            workers.push_back(std::make_unique<Worker>(*this, i));
+            workers.back()->startThread(juce::Thread::Priority::high);
+        }
+
+        return startThread(juce::Thread::Priority::normal);
+       #else
+        juce::ignoreUnused(path);
+        return false;
+       #endif
+    }
+
+    void stop()
+    {
+        stopThread(2000);
+
+        for (auto& worker : workers)
+            worker->signalThreadShouldExit();
+        jobAvailable.signal();
+        workers.clear();  // Each waits for its current block, then cancels the render
+
+        {
+            const juce::ScopedLock sl(queueLock);
+            queue.clear();
+        }
+
+        sampleServer.reset();
+
+       #if JUCE_LINUX || JUCE_BSD || JUCE_MAC || JUCE_ANDROID
+        if (listenFd >= 0)
+        {
+            ::close(listenFd);
+            ::unlink(socketPath.toRawUTF8());
+            listenFd = -1;
+        }
+       #endif
+    }
+
+    int getNumWorkers() const { return numWorkers; }
+    int getNumJobsDone() const { return jobsDone.load(); }
+
+    int getNumJobsQueued() const
+    {
+        const juce::ScopedLock sl(queueLock);
+        return (int)queue.size();
+    }
+
+private:
+    struct Connection
+    {
+        explicit Connection(int fdToUse) : fd(fdToUse) {}
+
+        ~Connection()
+        {
+           #if JUCE_LINUX || JUCE_BSD || JUCE_MAC || JUCE_ANDROID
+            ::close(fd);
+           #endif
+        }
+
+        // Workers answer from their own threads
+        void reply(const juce::var& message)
+        {
+           #if JUCE_LINUX || JUCE_BSD || JUCE_MAC || JUCE_ANDROID
+            auto line = (juce::JSON::toString(message, true) + "\n").toStdString();
+            const juce::ScopedLock sl(writeLock);
+            size_t sent = 0;
+            while (sent < line.size())
+            {
+               #ifdef MSG_NOSIGNAL
+                auto result = send(fd, line.data() + sent, line.size() - sent, MSG_NOSIGNAL);
+               #else
+                auto result = send(fd, line.data() + sent, line.size() - sent, 0);
+               #endif
+                if (result <= 0)
+                    break;  // The client went away
+                sent += (size_t)result;
+            }
+           #else
+            juce::ignoreUnused(message);
+           #endif
+        }
+
+        int fd;
+        std::string pending;  // Partial line, listener thread only
+        juce::CriticalSection writeLock;
+    };
+
+    struct QueuedJob
+    {
+        RenderJob job;
+        juce::String stateKey;
+        std::shared_ptr<Connection> connection;
+    };
+
+    class Worker : public juce::Thread
+    {
+    public:
+        Worker(RenderDaemon& daemonToUse, int index)
+            : juce::Thread("Render Worker " + juce::String(index)), daemon(daemonToUse) {}
+
+        ~Worker() override
+        {
+            stopThread(10000);
+        }
+
+        void run() override
+        {
+            while (!threadShouldExit())
+            {
+                QueuedJob queued;
+                if (!daemon.takeJob(renderer.getLoadedStateKey(), queued))
+                {
+                    daemon.jobAvailable.wait(100);
+                    continue;
+                }
+
+                auto startTime = juce::Time::getMillisecondCounterHiRes();
+                auto result = renderer.render(queued.job, [this] { return !threadShouldExit(); });
+
+                auto* reply = new juce::DynamicObject();
+                reply->setProperty("output", queued.job.outputFile.getFullPathName());
+                reply->setProperty("ok", result.wasOk());
+                reply->setProperty("seconds", (juce::Time::getMillisecondCounterHiRes() - startTime) / 1000.0);
+                if (result.failed())
+                    reply->setProperty("error", result.getErrorMessage());
+                queued.connection->reply(juce::var(reply));
+
+                ++daemon.jobsDone;
+            }
+        }
+
+    private:
+        RenderDaemon& daemon;
+        OfflineRenderer renderer;
+    };
+
+    // Oldest job for the worker's loaded instrument, otherwise the oldest job
+    bool takeJob(const juce::String& loadedStateKey, QueuedJob& job)
+    {
+        const juce::ScopedLock sl(queueLock);
+        if (queue.empty())
+            return false;
+
+        auto match = std::find_if(queue.begin(), queue.end(),
+                                  [&](const QueuedJob& queued) { return queued.stateKey == loadedStateKey; });
+        if (match == queue.end())
+            match = queue.begin();
+
+        job = std::move(*match);
+        queue.erase(match);
+        return true;
+    }
+
+    void handleLine(const std::shared_ptr<Connection>& connection, const juce::String& line)
+    {
+        auto request = juce::JSON::parse(line);
+        QueuedJob queued;
+        queued.job.stateFile = juce::File(request.getProperty("state", {}).toString());
+        queued.job.midiFile = juce::File(request.getProperty("midi", {}).toString());
+        queued.job.outputFile = juce::File(request.getProperty("output", {}).toString());
+        queued.job.sampleRate = request.getProperty("sampleRate", 48000.0);
+        queued.job.tailSeconds = request.getProperty("tail", 2.0);
+        queued.job.bitsPerSample = request.getProperty("bitsPerSample", 24);
+
+        // juce::File turns relative or empty paths into an empty path
+        if (queued.job.stateFile == juce::File() || queued.job.midiFile == juce::File()
+             || queued.job.outputFile == juce::File() || queued.job.sampleRate <= 0.0)
+        {
+            auto* reply = new juce::DynamicObject();
+            reply->setProperty("ok", false);
+            reply->setProperty("error", "Expected absolute \"state\", \"midi\" and \"output\" paths");
+            connection->reply(juce::var(reply));
+            return;
+        }
+
+        queued.stateKey = queued.job.getStateKey();
+        queued.connection = connection;
+        {
+            const juce::ScopedLock sl(queueLock);
+            queue.push_back(std::move(queued));
+        }
+        jobAvailable.signal();
+    }
+
+    void run() override
+    {
+       #if JUCE_LINUX || JUCE_BSD || JUCE_MAC || JUCE_ANDROID
+        std::vector<std::shared_ptr<Connection>> connections;
+        std::vector<pollfd> fds;
+        char data[4096];
+
+        while (!threadShouldExit())
+        {
+            fds.clear();
+            fds.push_back({ listenFd, POLLIN, 0 });
+            for (auto& connection : connections)
+                fds.push_back({ connection->fd, POLLIN, 0 });
+
+            if (poll(fds.data(), (nfds_t)fds.size(), 250) <= 0)
+                continue;
+
+            // Connections only go from this list once read to the end; queued jobs keep
+            // theirs alive until the last reply is sent
+            for (size_t i = fds.size() - 1; i > 0; --i)
+            {
+                if (fds[i].revents == 0)
+                    continue;
+
+                auto& connection = connections[i - 1];
+                auto received = recv(connection->fd, data, sizeof(data), 0);
+                if (received <= 0)
+                {
+                    connections.erase(connections.begin() + (std::ptrdiff_t)(i - 1));
+                    continue;
+                }
+
+                connection->pending.append(data, (size_t)received);
+                for (auto newline = connection->pending.find('\n'); newline != std::string::npos;
+                     newline = connection->pending.find('\n'))
+                {
+                    auto line = juce::String::fromUTF8(connection->pending.data(), (int)newline).trim();
+                    connection->pending.erase(0, newline + 1);
+                    if (line.isNotEmpty())
+                        handleLine(connection, line);
+                }
+            }
+
+            if ((fds[0].revents & POLLIN) != 0)
+            {
+                int clientFd = accept(listenFd, nullptr, nullptr);
+                if (clientFd >= 0)
+                {
+                   #ifdef SO_NOSIGPIPE
+                    int noSigPipe = 1;
+                    setsockopt(clientFd, SOL_SOCKET, SO_NOSIGPIPE, &noSigPipe, sizeof(noSigPipe));
+                   #endif
+                    connections.push_back(std::make_shared<Connection>(clientFd));
+                }
+            }
+        }
+       #endif
+    }
+
+    const int numWorkers;
+    juce::String socketPath;
+    int listenFd = -1;
+    std::unique_ptr<SampleServer> sampleServer;
+    std::vector<std::unique_ptr<Worker>> workers;
+    juce::CriticalSection queueLock;
+    std::deque<QueuedJob> queue;
+    juce::WaitableEvent jobAvailable;
+    std::atomic<int> jobsDone{0};
+};
+
+//==============================================================================
+// PATCH FREEZER
+//==============================================================================
+// Bakes the current patch into a plain multisample. Every zone is rendered through
+// the full voice, modulation and filter path into a new WAV file, spread over all
+// cores, and the patch is then swapped for one that plays those files with the
+// filter and modulation bypassed. Zones are rendered at their root note, at their
+// own sample rate and with the note held, so frames (and so loop points) line up
+// 1:1 with the source zone. Each velocity layer is rendered at the centre of its
+// range, so velocity modulation is baked in as that layer heard it, and the
+// output is divided by that velocity because playback applies it again. Attack,
+// decay and sustain are baked in; the release and master volume still apply on
+// playback.
+class PatchFreezer : private juce::Thread,
+                     private juce::AsyncUpdater
+{
+public:
+    static constexpr int blockSize = 512;
+
+    explicit PatchFreezer(AdvancedSamplerProcessor& processorToFreeze)
+        : juce::Thread("Patch Freezer"), processor(processorToFreeze) {}
+
+    ~PatchFreezer() override
+    {
+        stopThread(30000);
+        cancelPendingUpdate();
+    }
+
+    // Message thread. The rendered files go into folder, which should be new.
+    juce::Result start(const juce::File& folderToUse)
+    {
+        if (isThreadRunning())
+            return juce::Result::fail("Already freezing");
+
+        state = processor.createStateTree();
+        zones = processor.getSampleEngine().getAllSamples();  // Copies share the audio, which keeps it alive
+        if (zones.empty())
+            return juce::Result::fail("There are no zones to freeze");
+        if (!folderToUse.createDirectory())
+            return juce::Result::fail("Can't create " + folderToUse.getFullPathName());
+
+        folder = folderToUse;
+        outputLayout = processor.getChannelLayoutOfBus(false, 0);
+        results.assign(zones.size(), juce::Result::ok());
+        files.clear();
+        for (size_t i = 0; i < zones.size(); ++i)
+            files.push_back(folder.getChildFile(juce::String((int)i + 1).paddedLeft('0', 3) + " "
+                                                + juce::File::createLegalFileName(zones[i].name.toString()) + ".wav"));
+        zonesDone = 0;
+
+        startThread(juce::Thread::Priority::normal);
+        return juce::Result::ok();
+    }
+
+    bool isFreezing() const { return isThreadRunning() || isUpdatePending(); }
+    float getProgress() const { return zones.empty() ? 0.0f : (float)zonesDone.load() / (float)zones.size(); }
+
+    // Message thread, once the frozen patch is in place or freezing failed
+    std::function<void(const juce::Result&)> onFinished;
+
 private:
-    static juce::AudioProcessorValueTreeState::ParameterLayout createParameterLayout()
+    void run() override
     {
-        std::vector<std::unique_ptr<juce::RangedAudioParameter>> params;
-        
-        params.push_back(std::make_unique<juce::AudioParameterFloat>("master_volume", "Master Volume", 0.0f, 1.0f, 0.7f));
-        params.push_back(std::make_unique<juce::AudioParameterFloat>("env_attack", "Attack", 0.0f, 5.0f, 0.01f));
-        params.push_back(std::make_unique<juce::AudioParameterFloat>("env_decay", "Decay", 0.0f, 5.0f, 0.1f));
-        params.push_back(std::make_unique<juce::AudioParameterFloat>("env_sustain", "Sustain", 0.0f, 1.0f, 0.8f));
-        params.push_back(std::make_unique<juce::AudioParameterFloat>("env_release", "Release", 0.0f, 10.0f, 0.5f));
-        params.push_back(std::make_unique<juce::AudioParameterFloat>("filter_cutoff", "Filter Cutoff", 20.0f, 20000.0f, 1000.0f));
-        params.push_back(std::make_unique<juce::AudioParameterFloat>("filter_resonance", "Filter Resonance", 0.1f, 10.0f, 1.0f));
-        
-        for (int i = 0; i < 3; ++i)
+        EmbeddedAudioCache::decodeInParallel((int)zones.size(), [this](int i)
         {
-            juce::String prefix = "lfo" + juce::String(i + 1) + "_";
-            params.push_back(std::make_unique<juce::AudioParameterFloat>(prefix + "rate", "LFO" + juce::String(i + 1) + " Rate", 0.01f, 20.0f, 1.0f));
-            params.push_back(std::make_unique<juce::AudioParameterFloat>(prefix + "amount", "LFO" + juce::String(i + 1) + " Amount", 0.0f, 1.0f, 0.0f));
-            params.push_back(std::make_unique<juce::AudioParameterChoice>(prefix + "waveform", "LFO" + juce::String(i + 1) + " Waveform",
-                juce::StringArray{"Sine", "Triangle", "Square", "Sawtooth", "Random"}, 0));
+            results[(size_t)i] = threadShouldExit() ? juce::Result::fail("Cancelled") : freezeZone(i);
+            ++zonesDone;
+        });
+
+        triggerAsyncUpdate();
+    }
+
+    // Pool thread. Each zone gets a processor of its own holding just that zone.
+    juce::Result freezeZone(int index)
+    {
+        const auto& zone = zones[(size_t)index];
+        std::unique_ptr<AdvancedSamplerProcessor> renderer;
+
+        {
+            // The parameter tree syncs on the message thread
+            const juce::MessageManagerLock mml(this);
+            if (!mml.lockWasGained())
+                return juce::Result::fail("Cancelled");
+
+            renderer = std::make_unique<AdvancedSamplerProcessor>();
+            renderer->getValueTreeState().replaceState(state.getChildWithName("Parameters").createCopy());
+            if (auto* volume = renderer->getValueTreeState().getParameter("master_volume"))
+                volume->setValueNotifyingHost(volume->convertTo0to1(1.0f));
+
+            juce::AudioProcessor::BusesLayout layout;
+            layout.outputBuses.add(outputLayout);
+            renderer->setBusesLayout(layout);
+
+            SampleData copy = zone;
+            copy.lowestNote = 0;
+            copy.highestNote = 127;
+            renderer->getSampleEngine().addSample(std::move(copy));
         }
-        
-        return { params.begin(), params.end() };
+
+        auto result = render(*renderer, zone, files[(size_t)index]);
+
+        // Without the lock only when cancelled, while the message thread waits for us
+        // and so can't be touching this processor's parameter tree
+        const juce::MessageManagerLock mml(this);
+        renderer.reset();
+        return result;
     }
-    
-    juce::AudioProcessorValueTreeState parameters;
-    SampleEngine sampleEngine;
-    ModulationMatrix modMatrix;
-    FilterEngine filterEngine;
-    juce::Synthesiser synthesizer;
-    std::atomic<int> activeVoiceCount{0};
-    
-    class CPULoadMeasurer
+
+    juce::Result render(AdvancedSamplerProcessor& renderer, const SampleData& zone, const juce::File& file)
+    {
+        auto numFrames = zone.audioData.getNumSamples();
+        auto numChannels = renderer.getTotalNumOutputChannels();
+
+        file.deleteFile();
+        auto stream = std::make_unique<juce::FileOutputStream>(file);
+        if (!stream->openedOk())
+            return juce::Result::fail("Can't write " + file.getFullPathName());
+
+        // Float, so nothing is requantised on the way in
+        juce::WavAudioFormat wav;
+        std::unique_ptr<juce::AudioFormatWriter> writer(wav.createWriterFor(stream.get(), zone.sampleRate,
+                                                                            (unsigned int)numChannels, 32, {}, 0));
+        if (writer == nullptr)
+            return juce::Result::fail("Unsupported WAV format");
+        stream.release();  // Owned by the writer now
+
+        renderer.setNonRealtime(true);
+        renderer.setRateAndBufferSizeDetails(zone.sampleRate, blockSize);
+        renderer.prepareToPlay(zone.sampleRate, blockSize);
+        renderer.resetPlaybackState(1);
+
+        juce::AudioBuffer<float> buffer(numChannels, blockSize);
+        juce::MidiBuffer midi;
+        auto velocity = getRenderVelocity(zone);
+        midi.addEvent(juce::MidiMessage::noteOn(1, zone.rootNote, velocity), 0);
+
+        for (int position = 0; position < numFrames; position += blockSize)
+        {
+            if (threadShouldExit())
+                break;
+
+            auto numSamples = juce::jmin(blockSize, numFrames - position);
+            buffer.setSize(numChannels, numSamples, false, false, true);
+            renderer.processBlock(buffer, midi);
+            midi.clear();
+            buffer.applyGain(1.0f / velocity);
+
+            if (!writer->writeFromAudioSampleBuffer(buffer, 0, numSamples))
+                break;
+        }
+
+        renderer.releaseResources();
+        return threadShouldExit() ? juce::Result::fail("Cancelled") : juce::Result::ok();
+    }
+
+    // The centre of the zone's velocity layer, as a note-on velocity
+    static float getRenderVelocity(const SampleData& zone)
+    {
+        auto centre = juce::roundToInt((zone.lowestVelocity + zone.highestVelocity) * 0.5f);
+        return (float)juce::jlimit(1, 127, centre) / 127.0f;
+    }
+
+    // Points the zones at the frozen files and bypasses what was baked in
+    void handleAsyncUpdate() override
+    {
+        juce::Result result = juce::Result::ok();
+        for (const auto& zoneResult : results)
+            if (zoneResult.failed())
+                result = zoneResult;
+
+        if (result.wasOk())
+        {
+            auto samplesState = state.getChildWithName("SampleData");
+            for (int i = 0; i < samplesState.getNumChildren(); ++i)
+            {
+                auto zoneState = samplesState.getChild(i);
+                const auto& file = files[(size_t)i];
+                zoneState.removeProperty("embeddedAudio", nullptr);
+                zoneState.setProperty("filePath", file.getFullPathName(), nullptr);
+                zoneState.setProperty("name", zoneState.getProperty("name").toString() + " (frozen)", nullptr);
+                zoneState.setProperty("contentHash", SampleContentHash::toString(SampleContentHash::ofFile(file)), nullptr);
+                zoneState.setProperty("fileSize", file.getSize(), nullptr);
+            }
+
+            auto parametersState = state.getChildWithName("Parameters");
+            parametersState.getChildWithProperty("id", "env_attack").setProperty("value", 0.0f, nullptr);
+            parametersState.getChildWithProperty("id", "env_decay").setProperty("value", 0.0f, nullptr);
+            parametersState.getChildWithProperty("id", "env_sustain").setProperty("value", 1.0f, nullptr);
+
+            state.setProperty("frozen", true, nullptr);
+            processor.applyStateTree(state);
+        }
+
+        zones.clear();
+        if (onFinished)
+            onFinished(result);
+    }
+
+    AdvancedSamplerProcessor& processor;
+    juce::ValueTree state;
+    std::vector<SampleData> zones;
+    std::vector<juce::File> files;
+    std::vector<juce::Result> results;
+    juce::AudioChannelSet outputLayout;
+    juce::File folder;
+    std::atomic<int> zonesDone{0};
+};
+
+// Defined here, where PatchFreezer is complete
+inline AdvancedSamplerProcessor::~AdvancedSamplerProcessor()
+{
+    patchFreezer.reset();  // Cancels a freeze still running
+    metricsExporter->removeInstance(metrics);
+}
+
+inline PatchFreezer& AdvancedSamplerProcessor::getPatchFreezer()
+{
+    if (patchFreezer == nullptr)
+        patchFreezer = std::make_unique<PatchFreezer>(*this);
+    return *patchFreezer;
+}
+
+inline bool AdvancedSamplerProcessor::isFreezing() const
+{
+    return patchFreezer != nullptr && patchFreezer->isFreezing();
+}
+
+inline float AdvancedSamplerProcessor::getFreezeProgress() const
+{
+    return patchFreezer != nullptr ? patchFreezer->getProgress() : 0.0f;
+}
+
+//==============================================================================
+// SOAK TEST HARNESS
+//==============================================================================
+// Runs a processor for hours under a simulated host: callbacks wake up late by a
+// random amount, block sizes change every callback, zones are loaded and state
+// is saved in the meantime, and other threads burn CPU and cache. Every block
+// that finishes after its deadline is recorded with what the processor was doing.
+// Call run() on the message thread of a console app so the plugin's timers and
+// async updates keep running alongside.
+struct SoakTestOptions
+{
+    double durationSeconds = 3600.0;
+    double sampleRate = 48000.0;
+    int minBlockSize = 16;
+    int maxBlockSize = 1024;
+    double maxWakeLateness = 0.25;       // Fraction of the block period a callback may start late
+    double notesPerSecond = 20.0;
+    int contentionThreads = 2;
+    double contentionDutyCycle = 0.5;
+    juce::Array<juce::File> sampleFiles;  // Loaded and cleared at random while playing
+    double loaderIntervalSeconds = 2.0;
+    double uiIntervalSeconds = 1.0 / 30.0;
+    juce::File logFile;                  // CSV of missed deadlines, written when the run ends
+    juce::int64 seed = 1;
+};
+
+class SoakTestHarness
+{
+public:
+    static constexpr size_t maxRecordedMisses = 100000;
+
+    struct MissedDeadline
+    {
+        double timeSeconds = 0.0;     // Since the start of the run
+        int blockSize = 0;
+        double budgetSeconds = 0.0;   // From the late wake-up to the deadline
+        double elapsedSeconds = 0.0;
+        int activeVoices = 0;
+        int numZones = 0;
+        std::array<double, (size_t)AdvancedSamplerProcessor::BlockStage::numStages> stageSeconds {};
+    };
+
+    struct Report
+    {
+        juce::uint64 blocks = 0;
+        juce::uint64 missed = 0;  // Can exceed missedDeadlines.size() on very bad runs
+        double worstLatenessSeconds = 0.0;
+        std::vector<MissedDeadline> missedDeadlines;
+    };
+
+    SoakTestHarness(AdvancedSamplerProcessor& p, const SoakTestOptions& o) : processor(p), options(o) {}
+
+    // Returns when the run is over
+    Report run()
+    {
+        processor.setRateAndBufferSizeDetails(options.sampleRate, options.maxBlockSize);
+        processor.prepareToPlay(options.sampleRate, options.maxBlockSize);
+        report = {};
+        report.missedDeadlines.reserve(maxRecordedMisses);
+
+        std::vector<std::unique_ptr<ContentionThread>> contention;
+        for (int i = 0; i < options.contentionThreads; ++i)
+        {
+            contention.push_back(std::make_unique<ContentionThread>(options.contentionDutyCycle));
+            contention.back()->startThread(juce::Thread::Priority::normal);
+        }
+
+        HostThread host(*this);
+        if (!host.startRealtimeThread({}))
+            host.startThread(juce::Thread::Priority::highest);
+
+        // Loader and UI activity happen here, as they would on the message thread
+        juce::Random random(options.seed + 1);
+        auto start = juce::Time::getMillisecondCounterHiRes() * 0.001;
+        double nextLoad = 0.0, nextUI = 0.0;
+
+        while (host.isThreadRunning())
+        {
+            auto now = juce::Time::getMillisecondCounterHiRes() * 0.001 - start;
+            if (now >= nextLoad)
+            {
+                runLoaderStep(random);
+                nextLoad = now + options.loaderIntervalSeconds * (0.5 + random.nextDouble());
+            }
+            if (now >= nextUI)
+            {
+                runUIStep();
+                nextUI = now + options.uiIntervalSeconds;
+            }
+
+           #if JUCE_MODAL_LOOPS_PERMITTED
+            auto* messageManager = juce::MessageManager::getInstanceWithoutCreating();
+            if (messageManager != nullptr && messageManager->isThisTheMessageThread())
+                messageManager->runDispatchLoopUntil(5);
+            else
+           #endif
+                juce::Thread::sleep(5);
+        }
+
+        contention.clear();
+        processor.releaseResources();
+
+        if (options.logFile != juce::File())
+            writeLog();
+
+        return std::move(report);
+    }
+
+private:
+    // Plays the part of the audio device, pacing callbacks in real time
+    class HostThread : public juce::Thread
     {
     public:
-        void reset()
+        explicit HostThread(SoakTestHarness& h) : juce::Thread("Soak Test Host"), harness(h) {}
+        ~HostThread() override { stopThread(5000); }
+
+        void run() override
         {
-            load = 0.0;
+            const auto& options = harness.options;
+            auto& processor = harness.processor;
+            juce::Random random(options.seed);
+            juce::AudioBuffer<float> buffer(processor.getTotalNumOutputChannels(), options.maxBlockSize);
+            juce::MidiBuffer midi;
+            std::array<bool, 128> held {};
+
+            auto start = now();
+            auto periodStart = start;
+
+            while (!threadShouldExit() && periodStart - start < options.durationSeconds)
+            {
+                int blockSize = random.nextInt(juce::Range<int>(options.minBlockSize, options.maxBlockSize + 1));
+                double period = blockSize / options.sampleRate;
+                double deadline = periodStart + period;
+                double wake = periodStart + random.nextDouble() * options.maxWakeLateness * period;
+                waitUntil(wake);
+
+                generateMidi(midi, held, blockSize, period, random);
+                buffer.setSize(buffer.getNumChannels(), blockSize, false, false, true);
+
+                auto started = now();
+                processor.processBlock(buffer, midi);
+                auto finished = now();
+                ++harness.report.blocks;
+
+                if (finished > deadline)
+                    harness.recordMiss(processor, finished - start, blockSize, deadline - started, finished - started,
+                                       finished - deadline);
+
+                // A callback late by more than a period loses its slot, like a real device dropping out
+                periodStart = finished > deadline + period ? finished : deadline;
+            }
         }
-        
-        void setSampleRate(double sr)
+
+    private:
+        static double now() { return juce::Time::getMillisecondCounterHiRes() * 0.001; }
+
+        void waitUntil(double time)
+        {
+            for (auto remaining = time - now(); remaining > 0.0; remaining = time - now())
+            {
+                if (remaining > 0.002)
+                    juce::Thread::sleep((int)((remaining - 0.001) * 1000.0));
+                else
+                    juce::Thread::yield();
+            }
+        }
+
+        // Random notes at the requested rate, with the odd mod wheel move
+        void generateMidi(juce::MidiBuffer& midi, std::array<bool, 128>& held, int blockSize, double period, juce::Random& random)
+        {
+            midi.clear();
+            double expectedNotes = harness.options.notesPerSecond * period;
+
+            while (random.nextDouble() < expectedNotes)
+            {
+                int note = random.nextInt(juce::Range<int>(36, 97));
+                int position = random.nextInt(blockSize);
+                if (held[(size_t)note])
+                    midi.addEvent(juce::MidiMessage::noteOff(1, note), position);
+                else
+                    midi.addEvent(juce::MidiMessage::noteOn(1, note, (juce::uint8)random.nextInt(juce::Range<int>(1, 128))), position);
+
+                held[(size_t)note] = !held[(size_t)note];
+                expectedNotes -= 1.0;
+            }
+
+            if (random.nextDouble() < 0.05)
+                midi.addEvent(juce::MidiMessage::controllerEvent(1, 1, random.nextInt(128)), random.nextInt(blockSize));
+        }
+
+        SoakTestHarness& harness;
+    };
+
+    // Keeps a core busy for part of every 10 ms, walking a buffer larger than the caches
+    class ContentionThread : public juce::Thread
+    {
+    public:
+        explicit ContentionThread(double duty) : juce::Thread("Soak Test Contention"), dutyCycle(duty) {}
+        ~ContentionThread() override { stopThread(2000); }
+
+        void run() override
+        {
+            std::vector<float> memory(16 * 1024 * 1024 / sizeof(float), 1.0f);
+            size_t position = 0;
+            float sink = 0.0f;
+
+            while (!threadShouldExit())
+            {
+                auto busyUntil = juce::Time::getMillisecondCounterHiRes() + 10.0 * dutyCycle;
+                while (juce::Time::getMillisecondCounterHiRes() < busyUntil)
+                {
+                    for (int i = 0; i < 4096; ++i)
+                    {
+                        sink += memory[position];
+                        memory[position] = sink * 0.5f;
+                        position = (position + 16) % memory.size();  // One float per cache line
+                    }
+                }
+                juce::Thread::sleep(juce::roundToInt(10.0 * (1.0 - dutyCycle)));
+            }
+        }
+
+    private:
+        double dutyCycle;
+    };
+
+    // Host thread
+    void recordMiss(AdvancedSamplerProcessor& p, double time, int blockSize, double budget, double elapsed, double lateness)
+    {
+        ++report.missed;
+        report.worstLatenessSeconds = juce::jmax(report.worstLatenessSeconds, lateness);
+        if (report.missedDeadlines.size() >= maxRecordedMisses)
+            return;
+
+        MissedDeadline miss;
+        miss.timeSeconds = time;
+        miss.blockSize = blockSize;
+        miss.budgetSeconds = budget;
+        miss.elapsedSeconds = elapsed;
+        miss.activeVoices = p.getActiveVoiceCount();
+        {
+            const juce::SpinLock::ScopedLockType sl(p.getSampleEngine().getRenderLock());
+            miss.numZones = (int)p.getSampleEngine().getAllSamples().size();
+        }
+        for (size_t i = 0; i < miss.stageSeconds.size(); ++i)
+            miss.stageSeconds[i] = p.getLastStageSeconds((AdvancedSamplerProcessor::BlockStage)i);
+
+        report.missedDeadlines.push_back(miss);  // Reserved up front
+    }
+
+    void runLoaderStep(juce::Random& random)
+    {
+        auto& engine = processor.getSampleEngine();
+        auto action = random.nextInt(10);
+
+        if (action < 5 && !options.sampleFiles.isEmpty())
+        {
+            if (engine.getAllSamples().size() >= 8)
+                engine.clearSamples();
+            engine.loadSample(options.sampleFiles[random.nextInt(options.sampleFiles.size())],
+                              random.nextInt(juce::Range<int>(36, 97)));
+        }
+        else if (action < 7)
+        {
+            // Host saving and restoring the session
+            juce::MemoryBlock state;
+            processor.getStateInformation(state);
+            processor.setStateInformation(state.getData(), (int)state.getSize());
+        }
+        else if (action < 9)
         {
-            sampleRate = sr;
+            juce::MemoryBlock state;
+            processor.getStateInformation(state);  // Autosave
         }
-        
-        void setBlockSize(int bs)
+        else
         {
-            blockSize = bs;
+            engine.clearSamples();
         }
-        
-        void measureBlockStart()
+    }
+
+    // What the editor reads on every refresh
+    void runUIStep()
+    {
+        processor.getCPULoad();
+        processor.getActiveVoiceCount();
+
+        auto& meter = processor.getOutputMeter();
+        for (int ch = 0; ch < meter.getNumChannels(); ++ch)
         {
-            blockStartTime = juce::Time::getHighResolutionTicks();
+            meter.takePeak(ch);
+            meter.takeTruePeak(ch);
         }
-        
-        void measureBlockEnd()
+
+        float sum = 0.0f;
+        for (const auto& sample : processor.getSampleEngine().getAllSamples())
+            if (sample.audioData.getNumSamples() > 0)
+                sum += sample.audioData.getMagnitude(0, juce::jmin(4096, sample.audioData.getNumSamples()));
+        juce::ignoreUnused(sum);
+    }
+
+    void writeLog() const
+    {
+        options.logFile.deleteFile();
+        juce::FileOutputStream out(options.logFile);
+        if (!out.openedOk())
+            return;
+
+        out << "time_s,block_size,budget_ms,elapsed_ms,active_voices,zones";
+        for (int i = 0; i < (int)AdvancedSamplerProcessor::BlockStage::numStages; ++i)
+            out << "," << AdvancedSamplerProcessor::getStageName((AdvancedSamplerProcessor::BlockStage)i) << "_ms";
+        out << "\n";
+
+        for (const auto& miss : report.missedDeadlines)
         {
-            auto blockEndTime = juce::Time::getHighResolutionTicks();
-            auto elapsedTicks = blockEndTime - blockStartTime;
-            auto elapsedSeconds = juce::Time::highResolutionTicksToSeconds(elapsedTicks);
-            auto expectedSeconds = blockSize / sampleRate;
-            
-            if (expectedSeconds > 0.0)
-            {
-                load = (elapsedSeconds / expectedSeconds) * 100.0;
-                load = juce::jlimit(0.0, 100.0, load);
-            }
+            out << juce::String(miss.timeSeconds, 3) << "," << miss.blockSize << ","
+                << juce::String(miss.budgetSeconds * 1000.0, 3) << "," << juce::String(miss.elapsedSeconds * 1000.0, 3) << ","
+                << miss.activeVoices << "," << miss.numZones;
+            for (auto seconds : miss.stageSeconds)
+                out << "," << juce::String(seconds * 1000.0, 3);
+            out << "\n";
         }
-        
-        double getLoad() const { return load; }
-        
-    private:
-        double sampleRate = 44100.0;
-        int blockSize = 512;
-        juce::int64 blockStartTime = 0;
-        double load = 0.0;
-    };
-    
-    CPULoadMeasurer cpuLoadMeasurer;
-    
-    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(AdvancedSamplerProcessor)
+    }
+
+    AdvancedSamplerProcessor& processor;
+    SoakTestOptions options;
+    Report report;
 };
 
 //==============================================================================
-// VOICE METHOD IMPLEMENTATIONS (defined after processor is complete)
+// INSTANCE SCALING BENCHMARK
 //==============================================================================
-
-inline AdvancedSamplerVoice::AdvancedSamplerVoice(SampleEngine& sampleEng, ModulationMatrix& modMatrix, 
-                                                   AdvancedSamplerProcessor& proc, int index)
-    : sampleEngine(sampleEng), modulationMatrix(modMatrix), processor(proc), voiceIndex(index)
+// Creates growing numbers of instances in this process and measures what each
+// one costs while idle: construction time, resident memory and processBlock time
+// with no notes playing. Memory is split into the one-off cost of the first
+// instance (resources shared by all of them) and the marginal cost of each
+// further one. Resident memory is read from /proc, so it is only reported on Linux.
+struct InstanceBenchmarkOptions
 {
-    adsrParams.attack = 0.01f;
-    adsrParams.decay = 0.1f;
-    adsrParams.sustain = 0.8f;
-    adsrParams.release = 0.5f;
-    adsr.setParameters(adsrParams);
-}
+    std::vector<int> instanceCounts { 1, 10, 50, 100, 250, 500 };
+    bool withEditors = false;  // Needs the message thread of a GUI app
+    double sampleRate = 48000.0;
+    int blockSize = 256;
+    int idleBlocks = 200;
+};
 
-inline void AdvancedSamplerVoice::startNote(int midiNoteNumber, float vel, juce::SynthesiserSound*, int)
+class InstanceScalingBenchmark
 {
-    updateADSRParams();
-    
-    currentSample = sampleEngine.getSampleForNote(midiNoteNumber);
-    if (currentSample == nullptr || currentSample->audioData.getNumSamples() == 0)
-    {
-        clearCurrentNote();
-        processor.voiceActive[voiceIndex].store(false);
-        return;
-    }
-   
-    if (currentSample != nullptr)
+public:
+    struct Result
     {
-        noteNumber = midiNoteNumber;
-        velocity = vel;
-        
-        double pitchRatio = std::pow(2.0, (midiNoteNumber - currentSample->rootNote) / 12.0);
-        positionIncrement = pitchRatio * currentSample->sampleRate / getSampleRate();
-        
-        currentPosition = 0.0;
-        loopingForward = true;
-        
-        modulationMatrix.setSourceValue(ModulationSource::Velocity, velocity);
-        modulationMatrix.setSourceValue(ModulationSource::KeyTrack, (float)midiNoteNumber / 127.0f);
-        
-        adsr.noteOn();
-        processor.voiceActive[voiceIndex].store(true);
-    }
-}
+        int numInstances = 0;
+        double constructionMsPerInstance = 0.0;
+        double idleMicrosPerBlock = 0.0;        // Per instance
+        juce::int64 sharedBytes = 0;            // Paid once, by the first instance
+        juce::int64 privateBytesPerInstance = 0;
+    };
 
-inline void AdvancedSamplerVoice::renderNextBlock(juce::AudioBuffer<float>& outputBuffer, int startSample, int numSamples)
-{
-    if (currentSample == nullptr || !adsr.isActive())
-    {
-        clearCurrentNote();
-        processor.voiceActive[voiceIndex].store(false);
-        processor.voicePositions[voiceIndex].store(0.0f);
-        return;
-    }
-    
-    const float* sampleData = currentSample->audioData.getReadPointer(0);
-    const float* sampleDataRight = currentSample->audioData.getNumChannels() > 1 ? 
-        currentSample->audioData.getReadPointer(1) : nullptr;
-    int sampleLength = currentSample->audioData.getNumSamples();
-    
-    int loopStartSample = (int)(currentSample->loopStart * sampleLength);
-    int loopEndSample = (int)(currentSample->loopEnd * sampleLength);
-    
-    for (int sample = 0; sample < numSamples; ++sample)
+    static std::vector<Result> run(const InstanceBenchmarkOptions& options)
     {
-        float leftSample = 0.0f;
-        float rightSample = 0.0f;
-        
-        // Update normalized position for GUI display
-        normalizedPosition = currentPosition / sampleLength;
-        processor.voicePositions[voiceIndex].store(normalizedPosition);
-        
-        if (currentPosition >= 0 && currentPosition < sampleLength)
+        std::vector<Result> results;
+        auto baseline = getResidentBytes();
+        juce::int64 firstInstanceBytes = 0;  // Needs a run with a single instance first
+
+        for (int count : options.instanceCounts)
         {
-            int index = (int)currentPosition;
-            float fraction = currentPosition - index;
-            
-            if (index < sampleLength - 1)
+            Result result;
+            result.numInstances = count;
+
+            std::vector<std::unique_ptr<AdvancedSamplerProcessor>> instances;
+            std::vector<std::unique_ptr<juce::AudioProcessorEditor>> editors;
+            instances.reserve((size_t)count);
+
+            auto start = juce::Time::getMillisecondCounterHiRes();
+            for (int i = 0; i < count; ++i)
             {
-                leftSample = sampleData[index] * (1.0f - fraction) + 
-                           sampleData[index + 1] * fraction;
-                
-                if (sampleDataRight != nullptr)
-                    rightSample = sampleDataRight[index] * (1.0f - fraction) + 
-                                sampleDataRight[index + 1] * fraction;
-                else
-                    rightSample = leftSample;
+                instances.push_back(std::make_unique<AdvancedSamplerProcessor>());
+                if (options.withEditors)
+                    editors.emplace_back(instances.back()->createEditorAndMakeActive());
             }
-            else
+            result.constructionMsPerInstance = (juce::Time::getMillisecondCounterHiRes() - start) / count;
+
+            juce::AudioBuffer<float> buffer(2, options.blockSize);
+            juce::MidiBuffer midi;
+            for (auto& instance : instances)
             {
-                leftSample = sampleData[index];
-                rightSample = sampleDataRight ? sampleDataRight[index] : leftSample;
+                instance->setRateAndBufferSizeDetails(options.sampleRate, options.blockSize);
+                instance->prepareToPlay(options.sampleRate, options.blockSize);
             }
-        }
-        
-        float envelopeValue = adsr.getNextSample();
-        leftSample *= envelopeValue * velocity;
-        rightSample *= envelopeValue * velocity;
-        
-        if (outputBuffer.getNumChannels() > 0)
-            outputBuffer.addSample(0, startSample + sample, leftSample);
-        if (outputBuffer.getNumChannels() > 1)
-            outputBuffer.addSample(1, startSample + sample, rightSample);
-        
-        float pitchMod = modulationMatrix.getModulationValue(ModulationDestination::Pitch);
-        double modifiedIncrement = positionIncrement * std::pow(2.0, pitchMod);
-        
-        if (currentSample->loopEnabled && currentPosition >= loopStartSample)
-        {
-            switch (currentSample->loopMode)
+
+            // Blocks go round the instances like a host's graph, so caches are shared as in a session
+            auto ticks = juce::Time::getHighResolutionTicks();
+            for (int block = 0; block < options.idleBlocks; ++block)
+                for (auto& instance : instances)
+                    instance->processBlock(buffer, midi);
+            auto seconds = juce::Time::highResolutionTicksToSeconds(juce::Time::getHighResolutionTicks() - ticks);
+            result.idleMicrosPerBlock = seconds * 1.0e6 / ((double)options.idleBlocks * count);
+
+            auto resident = getResidentBytes() - baseline;
+            if (count == 1)
             {
-                case 0: // Forward
-                    currentPosition += modifiedIncrement;
-                    if (currentPosition >= loopEndSample)
-                        currentPosition = loopStartSample + (currentPosition - loopEndSample);
-                    break;
-                case 1: // Backward
-                    currentPosition -= modifiedIncrement;
-                    if (currentPosition <= loopStartSample)
-                        currentPosition = loopEndSample - (loopStartSample - currentPosition);
-                    break;
-                case 2: // Ping-Pong
-                    if (loopingForward)
-                    {
-                        currentPosition += modifiedIncrement;
-                        if (currentPosition >= loopEndSample)
-                        {
-                            currentPosition = loopEndSample - (currentPosition - loopEndSample);
-                            loopingForward = false;
-                        }
-                    }
-                    else
-                    {
-                        currentPosition -= modifiedIncrement;
-                        if (currentPosition <= loopStartSample)
-                        {
-                            currentPosition = loopStartSample + (loopStartSample - currentPosition);
-                            loopingForward = true;
-                        }
-                    }
-                    break;
+                firstInstanceBytes = resident;
             }
-        }
-        else
-        {
-            currentPosition += modifiedIncrement;
-            if (currentPosition >= sampleLength)
+            else if (firstInstanceBytes > 0)
             {
-                if (adsr.isActive())
-                    adsr.noteOff();
-                break;
+                result.privateBytesPerInstance = (resident - firstInstanceBytes) / (count - 1);
+                result.sharedBytes = firstInstanceBytes - result.privateBytesPerInstance;
             }
+
+            editors.clear();  // Editors must go before their processors
+            for (auto& instance : instances)
+                instance->releaseResources();
+
+            results.push_back(result);
         }
-        
-        if (!adsr.isActive())
+
+        return results;
+    }
+
+    static juce::String formatResults(const std::vector<Result>& results)
+    {
+        juce::String text;
+        text << "instances  construct_ms  idle_us_per_block  shared_kb  private_kb_per_instance\n";
+        for (const auto& r : results)
         {
-            clearCurrentNote();
-            processor.voiceActive[voiceIndex].store(false);
-            processor.voicePositions[voiceIndex].store(0.0f);
-            break;
+            text << juce::String(r.numInstances).paddedLeft(' ', 9)
+                 << juce::String(r.constructionMsPerInstance, 3).paddedLeft(' ', 14)
+                 << juce::String(r.idleMicrosPerBlock, 2).paddedLeft(' ', 19)
+                 << juce::String(r.sharedBytes / 1024).paddedLeft(' ', 11)
+                 << juce::String(r.privateBytesPerInstance / 1024).paddedLeft(' ', 25) << "\n";
         }
+        return text;
     }
-}
+
+private:
+    static juce::int64 getResidentBytes()
+    {
+       #if JUCE_LINUX
+        auto fields = juce::StringArray::fromTokens(juce::File("/proc/self/statm").loadFileAsString(), false);
+        if (fields.size() > 1)
+            return fields[1].getLargeIntValue() * (juce::int64)sysconf(_SC_PAGESIZE);
+       #endif
+        return 0;
+    }
+};
 
 //==============================================================================
 // WAVEFORM DISPLAY COMPONENT
@@ -1072,7 +9550,38 @@ public:
         : sampleEngine(engine), processor(proc)
 
     {
-        startTimer(30);
+        loopFinder.onResultsReady = [this] { repaint(); };
+    }
+    
+    // The playhead animation only runs while the editor is on screen
+    void setActive(bool shouldBeActive)
+    {
+        if (shouldBeActive)
+            startTimer(30);
+        else
+            stopTimer();
+    }
+    
+    void findLoopPoints()
+    {
+        auto& samples = sampleEngine.getAllSamples();
+        if (!samples.empty())
+            loopFinder.findLoopPoints(samples[0]);
+    }
+    
+    void applyLoopSuggestion(int index)
+    {
+        auto& samples = sampleEngine.getAllSamples();
+        auto& results = loopFinder.getResults();
+        if (samples.empty() || !juce::isPositiveAndBelow(index, (int)results.size()))
+            return;
+        
+        auto& sample = samples[0];
+        float length = (float)juce::jmax(1, sample.audioData.getNumSamples());
+        sample.loopStart = results[(size_t)index].startFrame / length;
+        sample.loopEnd = results[(size_t)index].endFrame / length;
+        sample.loopEnabled = true;
+        repaint();
     }
     
     void paint(juce::Graphics& g) override
@@ -1179,59 +9688,471 @@ public:
                 g.drawVerticalLine(loopStartX, 0, getHeight());
                 g.drawVerticalLine(loopEndX, 0, getHeight());
             }
+            
+            // Suggested loop points, strongest first
+            auto& suggestions = loopFinder.getResults();
+            for (int i = (int)suggestions.size() - 1; i >= 0; --i)
+            {
+                float alpha = i == 0 ? 0.9f : 0.3f;
+                g.setColour(juce::Colours::cyan.withAlpha(alpha));
+                g.drawVerticalLine((int)(suggestions[(size_t)i].startFrame / (float)numSamples * width), 0, height);
+                g.drawVerticalLine((int)(suggestions[(size_t)i].endFrame / (float)numSamples * width), 0, height);
+            }
+            
+            if (loopFinder.isSearching())
+            {
+                g.setColour(juce::Colours::cyan);
+                g.setFont(juce::FontOptions(12.0f));
+                g.drawText("Searching loop points...", getLocalBounds().reduced(6), juce::Justification::topRight);
+            }
+        }
+    }
+    
+    void timerCallback() override
+    {
+        repaint();
+    }
+    
+    void mouseDown(const juce::MouseEvent& e) override
+    {
+        auto& samples = sampleEngine.getAllSamples();
+        if (samples.empty()) return;
+        
+        if (e.mods.isPopupMenu())
+        {
+            showEditMenu();
+            return;
+        }
+        
+        float mouseX = (float)e.x / getWidth();
+        auto& sample = samples[0];
+        
+        float loopStartDist = std::abs(mouseX - sample.loopStart);
+        float loopEndDist = std::abs(mouseX - sample.loopEnd);
+        float grabRadius = grabRadiusPixels / (float)juce::jmax(1, getWidth());
+        
+        if (loopStartDist < grabRadius && loopStartDist <= loopEndDist)
+            draggingLoopStart = true;
+        else if (loopEndDist < grabRadius)
+            draggingLoopEnd = true;
+    }
+    
+    void mouseDrag(const juce::MouseEvent& e) override
+    {
+        auto& samples = sampleEngine.getAllSamples();
+        if (samples.empty()) return;
+        
+        float mouseX = juce::jlimit(0.0f, 1.0f, (float)e.x / getWidth());
+        auto& sample = samples[0];
+        
+        // Snap to the nearest rising zero crossing unless shift is held
+        int length = sample.audioData.getNumSamples();
+        if (length > 0 && !e.mods.isShiftDown() && (draggingLoopStart || draggingLoopEnd))
+        {
+            int framesPerPixel = juce::jmax(1, length / juce::jmax(1, getWidth()));
+            int frame = LoopPointFinder::findNearestZeroCrossing(sample.audioData.getReadPointer(0), length,
+                                                                  (int)(mouseX * length), framesPerPixel * 4);
+            mouseX = frame / (float)length;
         }
+        
+        if (draggingLoopStart)
+            sample.loopStart = juce::jmin(mouseX, sample.loopEnd - 0.01f);
+        else if (draggingLoopEnd)
+            sample.loopEnd = juce::jmax(mouseX, sample.loopStart + 0.01f);
+        
+        repaint();
+    }
+    
+    void mouseUp(const juce::MouseEvent&) override
+    {
+        draggingLoopStart = false;
+        draggingLoopEnd = false;
+    }
+    
+private:
+    // Edits act on the loop region when looping is enabled, otherwise on the whole sample
+    void showEditMenu()
+    {
+        auto& sample = sampleEngine.getAllSamples()[0];
+        auto& editEngine = processor.getSampleEditEngine();
+        
+        int length = sample.audioData.getNumSamples();
+        bool useLoopRegion = sample.loopEnabled;
+        int start = useLoopRegion ? (int)(sample.loopStart * length) : 0;
+        int end = useLoopRegion ? (int)(sample.loopEnd * length) : length;
+        
+        juce::PopupMenu menu;
+        menu.addSectionHeader(useLoopRegion ? "Edit Loop Region" : "Edit Sample");
+        menu.addItem(1, "Trim to Loop Region", useLoopRegion && !editEngine.isBusy());
+        menu.addItem(2, "Normalise", !editEngine.isBusy());
+        menu.addItem(3, "Reverse", !editEngine.isBusy());
+        menu.addItem(4, "Fade In", !editEngine.isBusy());
+        menu.addItem(5, "Fade Out", !editEngine.isBusy());
+        menu.addItem(6, "Gain +3 dB", !editEngine.isBusy());
+        menu.addItem(7, "Gain -3 dB", !editEngine.isBusy());
+        menu.addSeparator();
+        menu.addItem(10, "Undo", editEngine.canUndo(0));
+        menu.addItem(11, "Redo", editEngine.canRedo(0));
+        menu.addSeparator();
+        menu.addItem(20, "Find Loop Points", !loopFinder.isSearching());
+        
+        auto& suggestions = loopFinder.getResults();
+        for (int i = 0; i < (int)suggestions.size(); ++i)
+            menu.addItem(30 + i, "Use Suggestion " + juce::String(i + 1)
+                                     + " (correlation " + juce::String(suggestions[(size_t)i].correlation, 3) + ")");
+        
+        juce::Component::SafePointer<WaveformDisplay> safeThis(this);
+        menu.showMenuAsync(juce::PopupMenu::Options().withTargetComponent(this),
+            [safeThis, start, end](int result)
+            {
+                if (safeThis == nullptr || result == 0 || safeThis->sampleEngine.getAllSamples().empty())
+                    return;
+                
+                auto& editEngine = safeThis->processor.getSampleEditEngine();
+                SampleEdit edit;
+                edit.startFrame = start;
+                edit.endFrame = end;
+                
+                switch (result)
+                {
+                    case 1: edit.type = SampleEdit::Type::Trim; break;
+                    case 2: edit.type = SampleEdit::Type::Normalise; break;
+                    case 3: edit.type = SampleEdit::Type::Reverse; break;
+                    case 4: edit.type = SampleEdit::Type::FadeIn; break;
+                    case 5: edit.type = SampleEdit::Type::FadeOut; break;
+                    case 6: edit.type = SampleEdit::Type::Gain; edit.gainDecibels = 3.0f; break;
+                    case 7: edit.type = SampleEdit::Type::Gain; edit.gainDecibels = -3.0f; break;
+                    case 10: editEngine.undo(0); return;
+                    case 11: editEngine.redo(0); return;
+                    case 20: safeThis->findLoopPoints(); return;
+                    default:
+                        if (result >= 30)
+                            safeThis->applyLoopSuggestion(result - 30);
+                        return;
+                }
+                
+                editEngine.applyEdit(0, edit);
+            });
+    }
+    
+    static constexpr float grabRadiusPixels = 8.0f;
+    
+    AdvancedSamplerProcessor& processor;
+    SampleEngine& sampleEngine;
+    LoopPointFinder loopFinder;
+    bool draggingLoopStart = false;
+    bool draggingLoopEnd = false;
+};
+//==============================================================================
+// SAMPLE BROWSER COMPONENT
+//==============================================================================
+class SampleBrowserComponent : public juce::Component,
+                               private juce::ListBoxModel,
+                               private juce::Timer
+{
+public:
+    SampleBrowserComponent(AdvancedSamplerProcessor& p) : audioProcessor(p)
+    {
+        searchBox.setTextToShowWhenEmpty("Search library...", juce::Colour(0xff666666));
+        searchBox.onTextChange = [this] { updateResults(); };
+        addAndMakeVisible(searchBox);
+        
+        addFolderButton.setButtonText("Add Folder");
+        addFolderButton.onClick = [this] { chooseFolder(); };
+        addAndMakeVisible(addFolderButton);
+        
+        rescanButton.setButtonText("Rescan");
+        rescanButton.onClick = [this] { library->getScanner().startScan(); };
+        addAndMakeVisible(rescanButton);
+        
+        resultsList.setModel(this);
+        resultsList.setRowHeight(24);
+        resultsList.setColour(juce::ListBox::backgroundColourId, juce::Colour(0xff141414));
+        addAndMakeVisible(resultsList);
+        
+        updateResults();
+        startTimer(250);
+    }
+    
+    ~SampleBrowserComponent() override
+    {
+        audioProcessor.stopPreview();
+        resultsList.setModel(nullptr);
+    }
+    
+    void visibilityChanged() override
+    {
+        if (!isVisible())
+            audioProcessor.stopPreview();
+    }
+    
+    void paint(juce::Graphics& g) override
+    {
+        g.fillAll(juce::Colour(0xff1a1a1a));
+        g.setColour(juce::Colour(0xff333333));
+        g.drawRect(getLocalBounds());
+        
+        g.setColour(juce::Colour(0xff888888));
+        g.setFont(juce::FontOptions(11.0f));
+        g.drawText(statusText, getLocalBounds().removeFromBottom(22).reduced(8, 0), juce::Justification::left);
     }
     
-    void timerCallback() override
+    void resized() override
     {
-        repaint();
+        auto bounds = getLocalBounds().reduced(8);
+        auto top = bounds.removeFromTop(25);
+        rescanButton.setBounds(top.removeFromRight(80));
+        top.removeFromRight(5);
+        addFolderButton.setBounds(top.removeFromRight(100));
+        top.removeFromRight(5);
+        searchBox.setBounds(top);
+        
+        bounds.removeFromTop(5);
+        bounds.removeFromBottom(18);
+        resultsList.setBounds(bounds);
     }
     
-    void mouseDown(const juce::MouseEvent& e) override
+private:
+    static constexpr int maxResults = 1000;
+    
+    int getNumRows() override { return (int)results.size(); }
+    
+    void paintListBoxItem(int row, juce::Graphics& g, int width, int height, bool rowIsSelected) override
     {
-        auto& samples = sampleEngine.getAllSamples();
-        if (samples.empty()) return;
+        if (!juce::isPositiveAndBelow(row, (int)results.size()))
+            return;
         
-        float mouseX = (float)e.x / getWidth();
-        auto& sample = samples[0];
+        const auto& entry = *results[(size_t)row];
+        if (rowIsSelected)
+            g.fillAll(juce::Colour(0xff00ff88).withAlpha(0.15f));
         
-        float loopStartDist = std::abs(mouseX - sample.loopStart);
-        float loopEndDist = std::abs(mouseX - sample.loopEnd);
+        // Peak overview
+        auto overview = juce::Rectangle<int>(width - 140, 2, 130, height - 4);
+        g.setColour(juce::Colours::darkorange.withAlpha(0.8f));
+        float binWidth = overview.getWidth() / (float)entry.peaks.size();
+        for (size_t bin = 0; bin < entry.peaks.size(); ++bin)
+        {
+            float peakHeight = entry.peaks[bin] / 255.0f * overview.getHeight();
+            g.fillRect(overview.getX() + bin * binWidth, overview.getCentreY() - peakHeight / 2.0f,
+                       juce::jmax(1.0f, binWidth - 0.5f), peakHeight);
+        }
         
-        if (loopStartDist < 0.02f)
-            draggingLoopStart = true;
-        else if (loopEndDist < 0.02f)
-            draggingLoopEnd = true;
+        juce::String details = entry.formatName.upToFirstOccurrenceOf(" ", false, false)
+                             + " | " + juce::String(entry.numChannels) + "ch"
+                             + " | " + juce::String(entry.sampleRate / 1000.0, 1) + " kHz"
+                             + " | " + juce::String(entry.getLengthSeconds(), 2) + " s";
+        if (entry.getMidiNote() >= 0)
+            details << " | " << juce::MidiMessage::getMidiNoteName(entry.getMidiNote(), true, true, 4);
+        
+        g.setFont(juce::FontOptions(12.0f));
+        g.setColour(juce::Colours::white);
+        g.drawText(juce::File(entry.path).getFileName(), 8, 0, width / 2, height, juce::Justification::centredLeft);
+        g.setColour(juce::Colour(0xff888888));
+        g.drawText(details, width / 2, 0, width / 2 - 150, height, juce::Justification::centredRight);
     }
     
-    void mouseDrag(const juce::MouseEvent& e) override
+    // Selecting a row auditions it through the preview voice
+    void selectedRowsChanged(int lastRowSelected) override
     {
-        auto& samples = sampleEngine.getAllSamples();
-        if (samples.empty()) return;
+        if (juce::isPositiveAndBelow(lastRowSelected, (int)results.size()))
+            audioProcessor.startPreview(juce::File(results[(size_t)lastRowSelected]->path));
+        else
+            audioProcessor.stopPreview();
+    }
+    
+    void listBoxItemDoubleClicked(int row, const juce::MouseEvent&) override
+    {
+        if (juce::isPositiveAndBelow(row, (int)results.size()))
+        {
+            audioProcessor.stopPreview();
+            juce::File file(results[(size_t)row]->path);
+            if (file.existsAsFile())
+                audioProcessor.getSampleEngine().loadSample(file);
+        }
+    }
+    
+    void timerCallback() override
+    {
+        auto& scanner = library->getScanner();
+        if (scanner.isScanning())
+            statusText = "Scanning: " + juce::String(scanner.getNumFilesFound()) + " files found, "
+                       + juce::String(scanner.getNumFilesAnalysed()) + "/" + juce::String(scanner.getNumFilesToAnalyse()) + " analysed";
+        else
+            statusText = juce::String(library->getIndex().getNumEntries()) + " files in library, "
+                       + juce::String((int)results.size()) + " shown";
         
-        float mouseX = juce::jlimit(0.0f, 1.0f, (float)e.x / getWidth());
-        auto& sample = samples[0];
+        const auto& io = audioProcessor.getIOBackend();
+        statusText << " | I/O " << io.getName() << ": queue " << io.getStats().lastQueueDepth.load()
+                   << " (max " << io.getStats().maxQueueDepth.load() << "), "
+                   << juce::String(io.getStats().getAverageLatencyMicros() / 1000.0, 2) << " ms avg";
         
-        if (draggingLoopStart)
-            sample.loopStart = juce::jmin(mouseX, sample.loopEnd - 0.01f);
-        else if (draggingLoopEnd)
-            sample.loopEnd = juce::jmax(mouseX, sample.loopStart + 0.01f);
+        if (library->getIndex().getRevision() != shownRevision)
+            updateResults();
         
-        repaint();
+        repaint(getLocalBounds().removeFromBottom(22));
     }
     
-    void mouseUp(const juce::MouseEvent&) override
+    void updateResults()
     {
-        draggingLoopStart = false;
-        draggingLoopEnd = false;
+        shownRevision = library->getIndex().getRevision();
+        results = library->getIndex().search(searchBox.getText(), maxResults);
+        resultsList.updateContent();
+        resultsList.repaint();
+    }
+    
+    void chooseFolder()
+    {
+        folderChooser = std::make_unique<juce::FileChooser>("Add library folder...");
+        auto flags = juce::FileBrowserComponent::openMode | juce::FileBrowserComponent::canSelectDirectories;
+        
+        folderChooser->launchAsync(flags, [this](const juce::FileChooser& fc)
+        {
+            auto folder = fc.getResult();
+            if (folder.isDirectory())
+                library->addRoot(folder);
+        });
     }
     
+    AdvancedSamplerProcessor& audioProcessor;
+    juce::SharedResourcePointer<SampleLibrary> library;
+    
+    juce::TextEditor searchBox;
+    juce::TextButton addFolderButton, rescanButton;
+    juce::ListBox resultsList;
+    std::unique_ptr<juce::FileChooser> folderChooser;
+    
+    std::vector<SampleLibraryIndex::EntryPtr> results;
+    int shownRevision = -1;
+    juce::String statusText;
+};
+
+//==============================================================================
+// OUTPUT METER COMPONENT
+//==============================================================================
+// Bars per output channel: RMS filled, peak as a line with a held tick above it.
+// The readout below holds the highest true-peak until the meter is clicked;
+// right-click switches true-peak measurement on or off.
+class OutputMeterComponent : public juce::Component,
+                             private juce::Timer
+{
+public:
+    static constexpr float minDecibels = -60.0f;
+    static constexpr float maxDecibels = 6.0f;
+    static constexpr float decayDecibelsPerSecond = 20.0f;
+    static constexpr int holdTimeMs = 1500;
+    static constexpr int refreshRateHz = 30;
+
+    explicit OutputMeterComponent(OutputMeter& meterToShow) : meter(meterToShow) {}
+
+    void setActive(bool shouldBeActive)
+    {
+        if (shouldBeActive)
+            startTimerHz(refreshRateHz);
+        else
+            stopTimer();
+    }
+
+    void paint(juce::Graphics& g) override
+    {
+        auto bounds = getLocalBounds().toFloat();
+        auto readoutArea = bounds.removeFromBottom(14.0f);
+
+        g.setColour(juce::Colour(0xff111111));
+        g.fillRoundedRectangle(bounds, 3.0f);
+
+        int numChannels = (int)displays.size();
+        if (numChannels > 0)
+        {
+            float barWidth = bounds.getWidth() / (float)numChannels;
+            for (int ch = 0; ch < numChannels; ++ch)
+            {
+                const auto& display = displays[(size_t)ch];
+                auto bar = bounds.withX(bounds.getX() + barWidth * (float)ch).withWidth(barWidth).reduced(1.0f, 2.0f);
+
+                g.setColour(juce::Colour(0xff00ff88).withAlpha(0.8f));
+                g.fillRect(bar.withTop(levelToY(display.rms, bar)));
+
+                g.setColour(display.peak >= 1.0f ? juce::Colour(0xffff6b6b) : juce::Colour(0xff00ddff));
+                g.fillRect(bar.getX(), levelToY(display.peak, bar), bar.getWidth(), 2.0f);
+
+                g.setColour(display.heldPeak >= 1.0f ? juce::Colour(0xffff6b6b) : juce::Colours::white);
+                g.fillRect(bar.getX(), levelToY(display.heldPeak, bar), bar.getWidth(), 1.0f);
+            }
+        }
+
+        g.setFont(juce::FontOptions(10.0f));
+        if (meter.isTruePeakEnabled())
+        {
+            g.setColour(maxTruePeak >= 1.0f ? juce::Colour(0xffff6b6b) : juce::Colour(0xff888888));
+            g.drawText(maxTruePeak > 0.0f ? "TP " + juce::String(juce::Decibels::gainToDecibels(maxTruePeak), 1)
+                                          : juce::String("TP -inf"),
+                       readoutArea, juce::Justification::centred);
+        }
+        else
+        {
+            g.setColour(juce::Colour(0xff555555));
+            g.drawText("TP off", readoutArea, juce::Justification::centred);
+        }
+    }
+
+    void mouseDown(const juce::MouseEvent& e) override
+    {
+        if (e.mods.isPopupMenu())
+            meter.setTruePeakEnabled(!meter.isTruePeakEnabled());
+
+        maxTruePeak = 0.0f;
+        for (auto& display : displays)
+            display.heldPeak = 0.0f;
+        repaint();
+    }
+
 private:
-    AdvancedSamplerProcessor& processor;
-    SampleEngine& sampleEngine;
-    bool draggingLoopStart = false;
-    bool draggingLoopEnd = false;
+    struct ChannelDisplay
+    {
+        float rms = 0.0f;
+        float peak = 0.0f;
+        float heldPeak = 0.0f;
+        juce::uint32 heldSince = 0;
+    };
+
+    void timerCallback() override
+    {
+        int numChannels = meter.getNumChannels();
+        if ((int)displays.size() != numChannels)
+            displays.assign((size_t)numChannels, {});
+
+        auto now = juce::Time::getMillisecondCounter();
+        float decay = juce::Decibels::decibelsToGain(-decayDecibelsPerSecond / (float)refreshRateHz);
+
+        for (int ch = 0; ch < numChannels; ++ch)
+        {
+            auto& display = displays[(size_t)ch];
+            display.rms = meter.getRMS(ch);
+            display.peak = juce::jmax(meter.takePeak(ch), display.peak * decay);
+
+            if (display.peak >= display.heldPeak || now - display.heldSince > (juce::uint32)holdTimeMs)
+            {
+                display.heldPeak = display.peak;
+                display.heldSince = now;
+            }
+
+            maxTruePeak = juce::jmax(maxTruePeak, meter.takeTruePeak(ch));
+        }
+
+        repaint();
+    }
+
+    static float levelToY(float level, juce::Rectangle<float> bar)
+    {
+        float db = juce::jlimit(minDecibels, maxDecibels, juce::Decibels::gainToDecibels(level, minDecibels));
+        return juce::jmap(db, minDecibels, maxDecibels, bar.getBottom(), bar.getY());
+    }
+
+    OutputMeter& meter;
+    std::vector<ChannelDisplay> displays;
+    float maxTruePeak = 0.0f;
 };
+
 //==============================================================================
 // AUDIO PROCESSOR EDITOR
 //==============================================================================
@@ -1243,7 +10164,8 @@ public:
     AdvancedSamplerEditor(AdvancedSamplerProcessor& p)
         : AudioProcessorEditor(&p), 
           audioProcessor(p),
-          waveformDisplay(p.getSampleEngine(),p)
+          waveformDisplay(p.getSampleEngine(),p),
+          outputMeter(p.getOutputMeter())
     {
         setSize(1200, 800);
         
@@ -1260,6 +10182,58 @@ public:
         clearButton.onClick = [this] { audioProcessor.getSampleEngine().clearSamples(); };
         addAndMakeVisible(clearButton);
         
+        // Find Loop button
+        findLoopButton.setButtonText("Find Loop");
+        findLoopButton.onClick = [this] { waveformDisplay.findLoopPoints(); };
+        addAndMakeVisible(findLoopButton);
+        
+        // Library browser toggle (the browser itself is created on first use)
+        browserButton.setButtonText("Browser");
+        browserButton.setClickingTogglesState(true);
+        browserButton.onClick = [this] { showBrowser(browserButton.getToggleState()); };
+        addAndMakeVisible(browserButton);
+        
+        // Preset bar: search filters the preset list, selecting one switches program
+        presetSearchBox.setTextToShowWhenEmpty("Search presets...", juce::Colour(0xff666666));
+        presetSearchBox.onTextChange = [this] { updatePresetList(); };
+        addAndMakeVisible(presetSearchBox);
+        
+        presetCombo.setTextWhenNothingSelected("No preset");
+        presetCombo.onChange = [this] {
+            if (presetCombo.getSelectedId() > 0)
+                audioProcessor.setCurrentProgram(presetCombo.getSelectedId() - 1);
+        };
+        addAndMakeVisible(presetCombo);
+        
+        savePresetButton.setButtonText("Save");
+        savePresetButton.onClick = [this] { savePreset(); };
+        addAndMakeVisible(savePresetButton);
+        
+        // Saves the zones' audio inside the host session
+        embedAudioButton.setButtonText("Embed Audio");
+        embedAudioButton.setClickingTogglesState(true);
+        embedAudioButton.setToggleState(audioProcessor.getEmbeddedAudio().isEnabled(), juce::dontSendNotification);
+        embedAudioButton.onClick = [this] { audioProcessor.getEmbeddedAudio().setEnabled(embedAudioButton.getToggleState()); };
+        addAndMakeVisible(embedAudioButton);
+        
+        // Records the session's input for replay on a dev machine
+        captureButton.setButtonText("Capture");
+        captureButton.setClickingTogglesState(true);
+        captureButton.setToggleState(audioProcessor.isCapturingSession(), juce::dontSendNotification);
+        captureButton.onClick = [this] { toggleSessionCapture(); };
+        addAndMakeVisible(captureButton);
+        
+        // Bakes the patch into plain samples for low-power rigs
+        freezeButton.setButtonText("Freeze");
+        freezeButton.onClick = [this] { freezePatch(); };
+        addAndMakeVisible(freezeButton);
+        
+        // Articulation logic that runs ahead of the voices
+        scriptButton.onClick = [this] { showScriptMenu(); };
+        addAndMakeVisible(scriptButton);
+        
+        addAndMakeVisible(outputMeter);
+        
         // Setup Master knobs
         masterVolumeKnob.setLabel("Volume");
         masterVolumeKnob.onValueChange = [this](float value) {
@@ -1325,8 +10299,7 @@ public:
         {
             lfoRateKnobs[i].setLabel("Rate");
             lfoRateKnobs[i].onValueChange = [this, i](float value) {
-                juce::String paramID = "lfo" + juce::String(i + 1) + "_rate";
-                if (auto* param = audioProcessor.getValueTreeState().getParameter(paramID))
+                if (auto* param = audioProcessor.getValueTreeState().getParameter(lfoParameterIDs[(size_t)i].rate))
                     param->setValueNotifyingHost(value);
                 lfoRateKnobs[i].setValueText(juce::String(value * 20.0f, 2) + " Hz");
             };
@@ -1334,8 +10307,7 @@ public:
             
             lfoAmountKnobs[i].setLabel("Amount");
             lfoAmountKnobs[i].onValueChange = [this, i](float value) {
-                juce::String paramID = "lfo" + juce::String(i + 1) + "_amount";
-                if (auto* param = audioProcessor.getValueTreeState().getParameter(paramID))
+                if (auto* param = audioProcessor.getValueTreeState().getParameter(lfoParameterIDs[(size_t)i].amount))
                     param->setValueNotifyingHost(value);
                 lfoAmountKnobs[i].setValueText(juce::String(value, 2));
             };
@@ -1366,8 +10338,6 @@ public:
             }
         };
         addAndMakeVisible(loopModeCombo);
-        
-        startTimer(50);
     }
     
     ~AdvancedSamplerEditor() override
@@ -1375,6 +10345,26 @@ public:
         stopTimer();
     }
     
+    // Timers, and with them the preset list and knob sync, start the first time the
+    // host shows the editor, and pause while it is hidden. Hosts that create editors
+    // they never open don't pay for them.
+    void visibilityChanged() override
+    {
+        bool active = isVisible();
+        waveformDisplay.setActive(active);
+        outputMeter.setActive(active);
+        
+        if (active)
+        {
+            timerCallback();
+            startTimer(50);
+        }
+        else
+        {
+            stopTimer();
+        }
+    }
+    
     void paint(juce::Graphics& g) override
     {
         // Background gradient
@@ -1488,6 +10478,14 @@ public:
         
         g.fillRoundedRectangle(cpuBarFill, 2.0f);
         
+        // Audio thread page faults, which should stay at zero once samples are resident
+        if (PageFaultCounter::isSupported())
+        {
+            g.setColour(audioThreadFaults == 0 ? juce::Colour(0xff666666) : juce::Colour(0xffff6b6b));
+            g.drawText("Faults: " + juce::String(audioThreadFaults), 180, getHeight() - 20, 90, 15,
+                       juce::Justification::left);
+        }
+        
         // Voice count
         g.setColour(juce::Colour(0xff00ff88));
         juce::String voiceText = juce::String("Voices: ") + juce::String(activeVoices) + "/16";
@@ -1526,9 +10524,24 @@ public:
         // Sample buttons
         loadSampleButton.setBounds(getWidth() - 230, 75, 100, 25);
         clearButton.setBounds(getWidth() - 120, 75, 100, 25);
+        findLoopButton.setBounds(getWidth() - 340, 75, 100, 25);
+        browserButton.setBounds(getWidth() - 450, 75, 100, 25);
+        scriptButton.setBounds(getWidth() - 560, 75, 100, 25);
+        
+        // Preset bar in the header
+        presetSearchBox.setBounds(340, 18, 150, 25);
+        presetCombo.setBounds(500, 18, 300, 25);
+        savePresetButton.setBounds(810, 18, 70, 25);
+        embedAudioButton.setBounds(890, 18, 100, 25);
+        captureButton.setBounds(1000, 18, 80, 25);
+        freezeButton.setBounds(1090, 18, 90, 25);
+        
+        if (sampleBrowser != nullptr)
+            sampleBrowser->setBounds(20, 100, getWidth() - 40, getHeight() - 135);
         
         // Master controls
         masterVolumeKnob.setBounds(50, 380, 70, 100);
+        outputMeter.setBounds(150, 375, 70, 110);
         
         // ADSR controls
         attackKnob.setBounds(260, 380, 70, 100);
@@ -1601,6 +10614,14 @@ public:
         // Update CPU and voice display from processor
         currentCPULoad = audioProcessor.getCPULoad();
         activeVoices = audioProcessor.getActiveVoiceCount();
+        audioThreadFaults = audioProcessor.getPageFaultCounter().getMinorFaults()
+                          + audioProcessor.getPageFaultCounter().getMajorFaults();
+        captureButton.setButtonText(audioProcessor.hasSessionCaptureOverflowed() ? "Overflow" : "Capture");
+        freezeButton.setButtonText(audioProcessor.isFreezing()
+                                       ? "Freezing " + juce::String(juce::roundToInt(audioProcessor.getFreezeProgress() * 100.0f)) + "%"
+                                       : audioProcessor.isFrozen() ? "Frozen" : "Freeze");
+        scriptButton.setButtonText(audioProcessor.getScript().isEmpty() ? "Script"
+                                   : audioProcessor.getScriptBudgetOverruns() > 0 ? "Script Slow" : "Script On");
         
         // Sync GUI knobs with parameter values (for state restore)
         auto& vts = audioProcessor.getValueTreeState();
@@ -1636,15 +10657,18 @@ public:
         // LFO knobs
         for (int i = 0; i < 3; ++i)
         {
-            juce::String prefix = "lfo" + juce::String(i + 1) + "_";
-            float rate = *vts.getRawParameterValue(prefix + "rate");
+            float rate = *vts.getRawParameterValue(lfoParameterIDs[(size_t)i].rate);
             lfoRateKnobs[i].setValue((rate - 0.01f) / (20.0f - 0.01f));  // Normalize to 0-1
             lfoRateKnobs[i].setValueText(juce::String(rate, 2) + " Hz");
             
-            float amount = *vts.getRawParameterValue(prefix + "amount");
+            float amount = *vts.getRawParameterValue(lfoParameterIDs[(size_t)i].amount);
             lfoAmountKnobs[i].setValue(amount);
             lfoAmountKnobs[i].setValueText(juce::String(amount, 2));
         }
+        if (audioProcessor.getPresetLibrary().getRevision() != shownPresetRevision)
+            updatePresetList();
+        presetCombo.setSelectedId(audioProcessor.getCurrentProgram() + 1, juce::dontSendNotification);
+        
         //=====START=== modification 2025-12-10 >
         // Sync loop controls with sample state
                auto& samples = audioProcessor.getSampleEngine().getAllSamples();
@@ -1658,6 +10682,67 @@ public:
     }
     
 private:
+    void updatePresetList()
+    {
+        auto& presets = audioProcessor.getPresetLibrary();
+        shownPresetRevision = presets.getRevision();
+        
+        presetCombo.clear(juce::dontSendNotification);
+        PresetInfo preset;
+        for (int index : presets.search(presetSearchBox.getText()))
+            if (presets.getPreset(index, preset))
+                presetCombo.addItem(preset.name + (preset.author.isNotEmpty() ? " (" + preset.author + ")" : juce::String()),
+                                    index + 1);
+        
+        presetCombo.setSelectedId(audioProcessor.getCurrentProgram() + 1, juce::dontSendNotification);
+    }
+    
+    void savePreset()
+    {
+        auto* window = new juce::AlertWindow("Save Preset", "Name, author and comma-separated tags",
+                                             juce::MessageBoxIconType::NoIcon, this);
+        window->addTextEditor("name", "New Preset", "Name");
+        window->addTextEditor("author", {}, "Author");
+        window->addTextEditor("tags", {}, "Tags");
+        window->addButton("Save", 1, juce::KeyPress(juce::KeyPress::returnKey));
+        window->addButton("Cancel", 0, juce::KeyPress(juce::KeyPress::escapeKey));
+        
+        juce::Component::SafePointer<AdvancedSamplerEditor> safeThis(this);
+        window->enterModalState(true, juce::ModalCallbackFunction::create([safeThis, window](int result)
+        {
+            if (safeThis == nullptr || result != 1)
+                return;
+            
+            auto name = window->getTextEditorContents("name").trim();
+            if (name.isEmpty())
+                return;
+            
+            auto& processor = safeThis->audioProcessor;
+            auto file = processor.getPresetLibrary().savePreset(processor.createStateTree(), name,
+                                                                 window->getTextEditorContents("author").trim(),
+                                                                 window->getTextEditorContents("tags"));
+            processor.updateHostDisplay(juce::AudioProcessor::ChangeDetails().withProgramChanged(true));
+            safeThis->updatePresetList();
+            
+            int index = processor.getPresetLibrary().indexOf(file);
+            if (index >= 0)
+                processor.setCurrentProgramIndex(index);
+        }), true);
+    }
+    
+    void showBrowser(bool shouldShow)
+    {
+        if (shouldShow && sampleBrowser == nullptr)
+        {
+            sampleBrowser = std::make_unique<SampleBrowserComponent>(audioProcessor);
+            addChildComponent(*sampleBrowser);
+            resized();
+        }
+        
+        if (sampleBrowser != nullptr)
+            sampleBrowser->setVisible(shouldShow);
+    }
+    
     void loadSampleFile()
     {
         fileChooser = std::make_unique<juce::FileChooser>("Select audio file to load...", 
@@ -1679,9 +10764,22 @@ private:
     
     AdvancedSamplerProcessor& audioProcessor;
     WaveformDisplay waveformDisplay;
+    OutputMeterComponent outputMeter;
     
     juce::TextButton loadSampleButton;
     juce::TextButton clearButton;
+    juce::TextButton findLoopButton;
+    juce::TextButton browserButton;
+    std::unique_ptr<SampleBrowserComponent> sampleBrowser;
+    
+    juce::TextEditor presetSearchBox;
+    juce::ComboBox presetCombo;
+    juce::TextButton savePresetButton;
+    juce::TextButton embedAudioButton;
+    juce::TextButton captureButton;
+    juce::TextButton freezeButton;
+    juce::TextButton scriptButton;
+    int shownPresetRevision = -1;
     
     CustomKnob masterVolumeKnob;
     CustomKnob attackKnob, decayKnob, sustainKnob, releaseKnob;
@@ -1694,9 +10792,79 @@ private:
     
     std::unique_ptr<juce::FileChooser> fileChooser;
     
+    void showScriptMenu()
+    {
+        juce::PopupMenu menu;
+        menu.addItem("Load Script...", [this] { loadScriptFile(); });
+        menu.addItem("Remove Script", audioProcessor.getScript().isNotEmpty(), false,
+                     [this] { audioProcessor.setScript({}); });
+        menu.showMenuAsync(juce::PopupMenu::Options().withTargetComponent(scriptButton));
+    }
+    
+    void loadScriptFile()
+    {
+        fileChooser = std::make_unique<juce::FileChooser>("Select articulation script...", juce::File(), "*.txt");
+        
+        auto flags = juce::FileBrowserComponent::openMode | juce::FileBrowserComponent::canSelectFiles;
+        
+        fileChooser->launchAsync(flags, [this](const juce::FileChooser& fc)
+        {
+            auto file = fc.getResult();
+            if (!file.existsAsFile())
+                return;
+            
+            if (auto result = audioProcessor.setScript(file.loadFileAsString()); result.failed())
+                juce::AlertWindow::showAsync(juce::MessageBoxOptions()
+                                                 .withIconType(juce::MessageBoxIconType::WarningIcon)
+                                                 .withTitle(file.getFileName())
+                                                 .withMessage(result.getErrorMessage())
+                                                 .withButton("OK"), nullptr);
+        });
+    }
+    
+    void freezePatch()
+    {
+        // Captures nothing, so it stays safe to call after this editor has closed
+        auto& freezer = audioProcessor.getPatchFreezer();
+        freezer.onFinished = [](const juce::Result& result)
+        {
+            if (result.failed())
+                juce::AlertWindow::showAsync(juce::MessageBoxOptions()
+                                                 .withIconType(juce::MessageBoxIconType::WarningIcon)
+                                                 .withTitle("Freeze")
+                                                 .withMessage(result.getErrorMessage())
+                                                 .withButton("OK"), nullptr);
+        };
+        
+        auto folder = juce::File::getSpecialLocation(juce::File::userApplicationDataDirectory)
+                          .getChildFile("AdvancedSampler").getChildFile("Frozen")
+                          .getChildFile(juce::Time::getCurrentTime().formatted("%Y%m%d-%H%M%S"));
+        
+        if (auto result = freezer.start(folder); result.failed())
+            freezer.onFinished(result);
+    }
+    
+    void toggleSessionCapture()
+    {
+        if (!captureButton.getToggleState())
+        {
+            audioProcessor.stopSessionCapture();
+            return;
+        }
+        
+        auto folder = juce::File::getSpecialLocation(juce::File::userApplicationDataDirectory)
+                          .getChildFile("AdvancedSampler").getChildFile("Captures");
+        folder.createDirectory();
+        auto file = folder.getChildFile("capture-" + juce::Time::getCurrentTime().formatted("%Y%m%d-%H%M%S") + ".ascp");
+        
+        if (!audioProcessor.startSessionCapture(file))
+            captureButton.setToggleState(false, juce::dontSendNotification);
+    }
+    
     bool isDragOver = false;
     int activeVoices = 0;
     double currentCPULoad = 0.0;
+    juce::int64 audioThreadFaults = 0;
     
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(AdvancedSamplerEditor)
 };
@@ -1713,6 +10881,176 @@ juce::AudioProcessor* JUCE_CALLTYPE createPluginFilter()
     return new AdvancedSamplerProcessor();
 }
 
+//==============================================================================
+// Build this file as a console app with ADVANCED_SAMPLER_RENDER_DAEMON=1 to get
+// the render daemon. It prints its socket path and runs until SIGINT or SIGTERM.
+#if ADVANCED_SAMPLER_RENDER_DAEMON && (JUCE_LINUX || JUCE_BSD || JUCE_MAC)
+int main()
+{
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+    
+    // Workers load instruments with the message thread locked, so it has to run
+    juce::ScopedJuceInitialiser_GUI juceInitialiser;
+    
+    RenderDaemon daemon;
+    auto socketPath = RenderDaemon::getDefaultSocketPath();
+    if (LocalSocket::isAnswering(socketPath))
+    {
+        std::cerr << "A render daemon is already listening on " << socketPath << std::endl;
+        return 1;
+    }
+    if (!daemon.start(socketPath))
+    {
+        std::cerr << "Couldn't listen on " << (socketPath.isNotEmpty() ? socketPath : juce::String("a private runtime directory")) << std::endl;
+        return 1;
+    }
+    std::cout << "Rendering on " << daemon.getNumWorkers() << " workers, listening on " << socketPath << std::endl;
+    
+    std::thread signalWaiter([&signals]
+    {
+        int signal = 0;
+        sigwait(&signals, &signal);
+        juce::MessageManager::getInstance()->stopDispatchLoop();
+    });
+    juce::MessageManager::getInstance()->runDispatchLoop();
+    signalWaiter.join();
+    
+    daemon.stop();
+    std::cout << "Rendered " << daemon.getNumJobsDone() << " jobs" << std::endl;
+    return 0;
+}
+#endif
+
+//==============================================================================
+// Build this file as a console app with ADVANCED_SAMPLER_SAMPLE_SERVER=1 to get
+// the sample server process. It serves until SIGINT or SIGTERM.
+#if ADVANCED_SAMPLER_SAMPLE_SERVER && SAMPLER_USE_SHARED_MEMORY
+int main()
+{
+    // Blocked before the server thread starts so it inherits the mask and only sigwait sees them
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+    
+    if (SampleServer::isRunning())
+    {
+        std::cerr << "A sample server is already running" << std::endl;
+        return 1;
+    }
+    
+    SampleServer server;
+    if (!server.start())
+    {
+        std::cerr << "Couldn't create " << SampleServer::controlName << std::endl;
+        return 1;
+    }
+    
+    int signal = 0;
+    sigwait(&signals, &signal);
+    
+    std::cout << "Served " << server.getNumSegments() << " samples, "
+              << server.getSharedBytes() / (1024 * 1024) << " MB" << std::endl;
+    server.stop();
+    return 0;
+}
+#endif
+
+//==============================================================================
+// Build this file as a console app with ADVANCED_SAMPLER_SOAK_TEST=1 to get the
+// soak test. Options: --duration <seconds>, --sample-rate, --min-block, --max-block,
+// --notes <per second>, --contention <threads>, --samples <folder>, --seed and
+// --log <csv> (soak.csv by default). Exits with 2 if any deadline was missed.
+#if ADVANCED_SAMPLER_SOAK_TEST
+int main(int argc, char* argv[])
+{
+    juce::ArgumentList args(argc, argv);
+    
+    // The harness runs the plugin's timers and async updates on this thread
+    juce::ScopedJuceInitialiser_GUI juceInitialiser;
+    
+    auto option = [&args](const char* name, double defaultValue)
+    {
+        return args.containsOption(name) ? args.getValueForOption(name).getDoubleValue() : defaultValue;
+    };
+    
+    SoakTestOptions options;
+    options.durationSeconds = option("--duration", options.durationSeconds);
+    options.sampleRate = option("--sample-rate", options.sampleRate);
+    options.minBlockSize = (int)option("--min-block", options.minBlockSize);
+    options.maxBlockSize = juce::jmax(options.minBlockSize, (int)option("--max-block", options.maxBlockSize));
+    options.notesPerSecond = option("--notes", options.notesPerSecond);
+    options.contentionThreads = (int)option("--contention", options.contentionThreads);
+    options.seed = (juce::int64)option("--seed", (double)options.seed);
+    
+    auto workingDirectory = juce::File::getCurrentWorkingDirectory();
+    if (args.containsOption("--samples"))
+    {
+        auto folder = workingDirectory.getChildFile(args.getValueForOption("--samples"));
+        options.sampleFiles = folder.findChildFiles(juce::File::findFiles, true, SampleLibraryScanner::audioFileWildcard);
+    }
+    options.logFile = workingDirectory.getChildFile(args.containsOption("--log") ? args.getValueForOption("--log")
+                                                                                 : juce::String("soak.csv"));
+    
+    AdvancedSamplerProcessor processor;
+    auto report = SoakTestHarness(processor, options).run();
+    
+    std::cout << report.blocks << " blocks, " << report.missed << " missed deadlines, worst "
+              << juce::String(report.worstLatenessSeconds * 1000.0, 3) << " ms late" << std::endl
+              << "Missed deadlines written to " << options.logFile.getFullPathName() << std::endl;
+    return report.missed == 0 ? 0 : 2;
+}
+#endif
+
+//==============================================================================
+// Build this file as a console app with ADVANCED_SAMPLER_SCALING_BENCH=1 to get the
+// instance scaling benchmark. Options: --counts 1,10,100, --block-size, --blocks,
+// --sample-rate, --editors, and --output <file> to save the table as well.
+#if ADVANCED_SAMPLER_SCALING_BENCH
+int main(int argc, char* argv[])
+{
+    juce::ArgumentList args(argc, argv);
+    
+    // Editors, when asked for, are created on this thread
+    juce::ScopedJuceInitialiser_GUI juceInitialiser;
+    
+    InstanceBenchmarkOptions options;
+    if (args.containsOption("--counts"))
+    {
+        options.instanceCounts.clear();
+        for (const auto& count : juce::StringArray::fromTokens(args.getValueForOption("--counts"), ",", {}))
+            if (count.getIntValue() > 0)
+                options.instanceCounts.push_back(count.getIntValue());
+    }
+    if (args.containsOption("--block-size"))
+        options.blockSize = juce::jmax(1, args.getValueForOption("--block-size").getIntValue());
+    if (args.containsOption("--blocks"))
+        options.idleBlocks = juce::jmax(1, args.getValueForOption("--blocks").getIntValue());
+    if (args.containsOption("--sample-rate"))
+        options.sampleRate = args.getValueForOption("--sample-rate").getDoubleValue();
+    options.withEditors = args.containsOption("--editors");
+    
+    auto table = InstanceScalingBenchmark::formatResults(InstanceScalingBenchmark::run(options));
+    std::cout << table;
+    
+    if (args.containsOption("--output"))
+    {
+        auto file = juce::File::getCurrentWorkingDirectory().getChildFile(args.getValueForOption("--output"));
+        if (!file.replaceWithText(table))
+        {
+            std::cerr << "Couldn't write " << file.getFullPathName() << std::endl;
+            return 1;
+        }
+    }
+    return 0;
+}
+#endif
+
 /*******************************************************************************
  JUCE PiP USAGE INSTRUCTIONS
  ============================